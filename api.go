@@ -68,6 +68,12 @@ type LineMatch struct {
 	LineEnd    int
 	LineNumber int
 
+	// Up to SearchOptions.NumContextLines lines preceding and
+	// following Line, each including its newline. Context that
+	// would repeat a neighboring match or its context is omitted.
+	Before []byte
+	After  []byte
+
 	// If set, this was a match on the filename.
 	FileName bool
 
@@ -87,6 +93,10 @@ type LineFragmentMatch struct {
 
 	// Number bytes that match.
 	MatchLength int
+
+	// If the match lies in a symbol definition that has metadata,
+	// the symbol.
+	SymbolInfo *Symbol
 }
 
 // Stats contains interesting numbers on the search
@@ -123,6 +133,25 @@ type Stats struct {
 	// Shards that we did not process because a query was canceled.
 	ShardsSkipped int
 
+	// Shards that were not loaded yet when the search ran. If it
+	// is nonzero, the result only covers part of the index.
+	ShardsPending int
+
+	// Truncated is set if the search was canceled, eg. because
+	// MaxWallTime passed, before it covered all candidates. Long
+	// work on a single document is interrupted too, so its
+	// matches may be incomplete. Stopping at TotalMaxMatchCount
+	// does not count.
+	Truncated bool
+
+	// Bytes of memory accounted to the candidate matches and
+	// results of the search.
+	MemoryBytes int64
+
+	// MemoryBudgetExceeded is set if the search stopped early
+	// because it used up SearchOptions.MaxMemoryBytes.
+	MemoryBudgetExceeded bool
+
 	// Number of non-overlapping matches
 	MatchCount int
 
@@ -134,6 +163,32 @@ type Stats struct {
 
 	// Number of times regexp was called on files that we evaluated.
 	RegexpsConsidered int
+
+	// Time spent in the phases of the search, summed over
+	// shards. Apart from MatchTreeDuration and MergeDuration, they
+	// are extrapolated from a sample of the evaluated documents.
+
+	// Building the match tree from the query.
+	MatchTreeDuration time.Duration
+
+	// Iterating ngram postings to find candidate documents.
+	IterateDuration time.Duration
+
+	// Verifying substring candidates against the content,
+	// including loading it.
+	VerifyDuration time.Duration
+
+	// Running regular expressions.
+	RegexpDuration time.Duration
+
+	// Finding the lines of the matches.
+	FillDuration time.Duration
+
+	// Scoring and sorting the matches.
+	ScoreDuration time.Duration
+
+	// Merging the results of all shards.
+	MergeDuration time.Duration
 }
 
 func (s *Stats) Add(o Stats) {
@@ -148,6 +203,17 @@ func (s *Stats) Add(o Stats) {
 	s.NgramMatches += o.NgramMatches
 	s.ShardFilesConsidered += o.ShardFilesConsidered
 	s.ShardsSkipped += o.ShardsSkipped
+	s.ShardsPending += o.ShardsPending
+	s.Truncated = s.Truncated || o.Truncated
+	s.MemoryBytes += o.MemoryBytes
+	s.MemoryBudgetExceeded = s.MemoryBudgetExceeded || o.MemoryBudgetExceeded
+	s.MatchTreeDuration += o.MatchTreeDuration
+	s.IterateDuration += o.IterateDuration
+	s.VerifyDuration += o.VerifyDuration
+	s.RegexpDuration += o.RegexpDuration
+	s.FillDuration += o.FillDuration
+	s.ScoreDuration += o.ScoreDuration
+	s.MergeDuration += o.MergeDuration
 }
 
 // SearchResult contains search matches and extra data
@@ -161,6 +227,83 @@ type SearchResult struct {
 	// FragmentNames holds a repo => template string map, for
 	// the line number fragment.
 	LineFragments map[string]string
+
+	// Facets holds the match histograms of a CountOnly search.
+	Facets *Facets
+
+	// NextCursor continues a paginated search with the next page
+	// of results. It is empty after the last page.
+	NextCursor string
+
+	// ResumeDocs is set by a paginated search of a single shard.
+	// ResumeDocs[i] is the document following Files[i]. If the
+	// shard was not searched to the end, a final entry holds the
+	// first document that was not evaluated.
+	ResumeDocs []uint32 `json:"-"`
+
+	// SlowestShards describes the shards that took longest to
+	// search, slowest first.
+	SlowestShards []ShardTiming
+}
+
+// ShardTiming describes the search in a single shard.
+type ShardTiming struct {
+	Shard    string
+	Duration time.Duration
+	Stats    Stats
+
+	// MatchTree is the match tree that the shard evaluated. It
+	// is only set if the search took at least
+	// SearchOptions.ExplainSlowerThan.
+	MatchTree string
+}
+
+// FacetCount counts the matching files and matches in one bucket.
+type FacetCount struct {
+	Files   int
+	Matches int
+}
+
+// Facets holds match counts bucketed by some file properties.
+type Facets struct {
+	Repository map[string]FacetCount
+	Language   map[string]FacetCount
+
+	// Extension is keyed by file name extension, including the
+	// dot, or "" for files without one.
+	Extension map[string]FacetCount
+}
+
+func (f *Facets) add(repo, lang, ext string, matches int) {
+	addFacet(&f.Repository, repo, FacetCount{1, matches})
+	addFacet(&f.Language, lang, FacetCount{1, matches})
+	addFacet(&f.Extension, ext, FacetCount{1, matches})
+}
+
+// Add merges the counts of o into f. o may be nil.
+func (f *Facets) Add(o *Facets) {
+	if o == nil {
+		return
+	}
+	for k, v := range o.Repository {
+		addFacet(&f.Repository, k, v)
+	}
+	for k, v := range o.Language {
+		addFacet(&f.Language, k, v)
+	}
+	for k, v := range o.Extension {
+		addFacet(&f.Extension, k, v)
+	}
+}
+
+func addFacet(m *map[string]FacetCount, key string, c FacetCount) {
+	if *m == nil {
+		*m = map[string]FacetCount{}
+	}
+	cur := (*m)[key]
+	cur.Files += c.Files
+	cur.Matches += c.Matches
+	(*m)[key] = cur
 }
 
 // RepositoryBranch describes an indexed branch, which is a name
@@ -251,6 +394,18 @@ func (s *RepoStats) Add(o *RepoStats) {
 	s.ContentBytes += o.ContentBytes
 }
 
+// SectionResidency reports how much of one kind of index data is
+// held in the page cache.
+type SectionResidency struct {
+	Section string
+
+	// Size of the data in the index file.
+	Bytes int64
+
+	// Bytes of it that are resident in memory.
+	Resident int64
+}
+
 type RepoListEntry struct {
 	Repository    Repository
 	IndexMetadata IndexMetadata
@@ -275,6 +430,19 @@ type Searcher interface {
 	String() string
 }
 
+// PinningSearcher is implemented by searchers that can hand out
+// results referring directly to index memory rather than to copies of
+// it.
+type PinningSearcher interface {
+	Searcher
+
+	// SearchPinned is like Search, but the byte slices in the
+	// result (Content, Checksum and the LineMatch lines) are only
+	// valid until release is called. release must be called once
+	// the caller is done with the result, also if err is set.
+	SearchPinned(ctx context.Context, q query.Q, opts *SearchOptions) (sr *SearchResult, release func(), err error)
+}
+
 type SearchOptions struct {
 	// Return an upper-bound estimate of eligible documents in
 	// stats.ShardFilesConsidered.
@@ -304,8 +472,60 @@ type SearchOptions struct {
 	// Trim the number of results after collating and sorting the
 	// results
 	MaxDocDisplayCount int
+
+	// Return this many lines of context around each line
+	// match, in LineMatch.Before and LineMatch.After.
+	NumContextLines int
+
+	// Return results in pages of MaxDocDisplayCount files. Pages
+	// are ordered by shard rank and document order, rather than
+	// by score, so each page continues where the last one ended.
+	// Files within a page are in document order.
+	Paginate bool
+
+	// Cursor is the NextCursor of the previous page of a
+	// paginated search. It is only valid for the same query and
+	// as long as the loaded shards do not change.
+	Cursor string
+
+	// StartDoc makes a paginated search of a single shard skip
+	// the documents before it.
+	StartDoc uint32 `json:"-"`
+
+	// If the search takes at least this long, describe the match
+	// trees of SearchResult.SlowestShards.
+	ExplainSlowerThan time.Duration
+
+	// Only count matches: no FileMatches are built or scored.
+	// The result has FileCount, MatchCount (the number of
+	// non-overlapping matches) and Facets set. The match limits
+	// still apply.
+	CountOnly bool
+
+	// If set, look this many candidate documents ahead of
+	// verification, and prefetch their contents and newlines, so
+	// reading from a cold page cache overlaps with verifying the
+	// documents before them. This walks the posting lists twice, so
+	// it only pays off if the index is not in memory.
+	PrefetchCandidates int
+
+	// Stop the search once its candidate matches and results,
+	// including the lines and file contents they return, take
+	// about this many bytes. The budget is shared by the shards
+	// searched for the query. Zero means no limit.
+	MaxMemoryBytes int64
+
+	// If set, LimitPolicy is called with an upper-bound estimate
+	// of the eligible documents (the number EstimateDocCount
+	// would return) before searching, so it can adjust the match
+	// limits above without a separate estimation request.
+	LimitPolicy LimitPolicy `json:"-"`
 }
 
+// LimitPolicy sets the match limits in opts for a search that can
+// match at most numDocs documents.
+type LimitPolicy func(numDocs int, opts *SearchOptions)
+
 func (s *SearchOptions) String() string {
 	return fmt.Sprintf("%#v", s)
 }
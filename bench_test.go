@@ -0,0 +1,146 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package zoekt_test
+
+import (
+	"bytes"
+	"context"
+	"sync"
+	"testing"
+
+	"github.com/google/zoekt"
+	"github.com/google/zoekt/internal/corpus"
+	"github.com/google/zoekt/query"
+)
+
+type benchSeeker struct {
+	data []byte
+}
+
+func (s *benchSeeker) Name() string { return "bench" }
+func (s *benchSeeker) Close()       {}
+func (s *benchSeeker) Read(off, sz uint32) ([]byte, error) {
+	return s.data[off : off+sz], nil
+}
+
+func (s *benchSeeker) Size() (uint32, error) {
+	return uint32(len(s.data)), nil
+}
+
+var (
+	benchOnce   sync.Once
+	benchOpts   = corpus.DefaultOptions()
+	benchCorpus *corpus.Corpus
+	benchShard  []byte
+)
+
+// benchIndex returns the default corpus and its index, which are
+// built once for all benchmarks.
+func benchIndex(b *testing.B) (*corpus.Corpus, []byte) {
+	benchOnce.Do(func() {
+		benchCorpus = corpus.Generate(benchOpts)
+		benchShard = buildIndex(b, benchCorpus)
+	})
+	return benchCorpus, benchShard
+}
+
+func buildIndex(b *testing.B, c *corpus.Corpus) []byte {
+	builder, err := zoekt.NewIndexBuilder(benchOpts.Repository("bench"))
+	if err != nil {
+		b.Fatalf("NewIndexBuilder: %v", err)
+	}
+	for _, d := range c.Docs {
+		if err := builder.Add(d); err != nil {
+			b.Fatalf("Add: %v", err)
+		}
+	}
+	var buf bytes.Buffer
+	if err := builder.Write(&buf); err != nil {
+		b.Fatalf("Write: %v", err)
+	}
+	return buf.Bytes()
+}
+
+func corpusSize(c *corpus.Corpus) int64 {
+	var sz int64
+	for _, d := range c.Docs {
+		sz += int64(len(d.Content))
+	}
+	return sz
+}
+
+func BenchmarkIndexBuilder(b *testing.B) {
+	c, _ := benchIndex(b)
+	b.SetBytes(corpusSize(c))
+	b.ReportAllocs()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		buildIndex(b, c)
+	}
+}
+
+func BenchmarkNewSearcher(b *testing.B) {
+	_, data := benchIndex(b)
+	b.SetBytes(int64(len(data)))
+	b.ReportAllocs()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		s, err := zoekt.NewSearcher(&benchSeeker{data})
+		if err != nil {
+			b.Fatalf("NewSearcher: %v", err)
+		}
+		s.Close()
+	}
+}
+
+func BenchmarkSearch(b *testing.B) {
+	c, data := benchIndex(b)
+	s, err := zoekt.NewSearcher(&benchSeeker{data})
+	if err != nil {
+		b.Fatalf("NewSearcher: %v", err)
+	}
+	defer s.Close()
+
+	// Words are sorted by frequency.
+	common, medium, rare := c.Words[1], c.Words[50], c.Words[len(c.Words)/2]
+	for _, tc := range []struct {
+		name  string
+		query string
+	}{
+		{"substring_common", "case:yes " + common},
+		{"substring_rare", "case:yes " + rare},
+		{"case_insensitive", "case:no " + medium},
+		{"regex", "case:yes " + common + `\(\)`},
+		{"symbol", "sym:" + medium},
+		{"file", `file:\.go$ ` + medium},
+		{"lang", "lang:Python " + medium},
+		{"branch", "branch:dev " + medium},
+		{"boolean", "(" + common + " or " + rare + ") -" + medium},
+	} {
+		q, err := query.Parse(tc.query)
+		if err != nil {
+			b.Fatalf("Parse(%q): %v", tc.query, err)
+		}
+		b.Run(tc.name, func(b *testing.B) {
+			b.ReportAllocs()
+			for i := 0; i < b.N; i++ {
+				opts := zoekt.SearchOptions{MaxDocDisplayCount: 50}
+				if _, err := s.Search(context.Background(), q, &opts); err != nil {
+					b.Fatalf("Search: %v", err)
+				}
+			}
+		})
+	}
+}
@@ -0,0 +1,84 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package zoekt
+
+import (
+	"context"
+	"sync/atomic"
+	"unsafe"
+)
+
+// Approximate sizes of the values that results hold.
+var (
+	candidateMatchBytes    = int64(unsafe.Sizeof(candidateMatch{}))
+	fileMatchBytes         = int64(unsafe.Sizeof(FileMatch{}))
+	lineMatchBytes         = int64(unsafe.Sizeof(LineMatch{}))
+	lineFragmentMatchBytes = int64(unsafe.Sizeof(LineFragmentMatch{}))
+)
+
+// memoryBudget accounts the memory that a search allocates, across
+// the shards it searches concurrently.
+type memoryBudget struct {
+	limit int64
+	used  int64
+}
+
+type memoryBudgetKey struct{}
+
+// WithMemoryBudget returns a context under which searches share a
+// budget of limit bytes, as set by SearchOptions.MaxMemoryBytes. If
+// ctx already carries a budget, it is returned unchanged.
+func WithMemoryBudget(ctx context.Context, limit int64) context.Context {
+	if memoryBudgetFromContext(ctx) != nil {
+		return ctx
+	}
+	return context.WithValue(ctx, memoryBudgetKey{}, &memoryBudget{limit: limit})
+}
+
+func memoryBudgetFromContext(ctx context.Context) *memoryBudget {
+	b, _ := ctx.Value(memoryBudgetKey{}).(*memoryBudget)
+	return b
+}
+
+// charge adds n bytes to the memory accounted in st, and returns false
+// if they don't fit in the budget. A nil budget has no limit.
+func (b *memoryBudget) charge(st *Stats, n int64) bool {
+	st.MemoryBytes += n
+	if b == nil {
+		return true
+	}
+	if atomic.AddInt64(&b.used, n) > b.limit {
+		st.MemoryBudgetExceeded = true
+		return false
+	}
+	return true
+}
+
+// exhausted returns whether a search of another shard used up the
+// budget.
+func (b *memoryBudget) exhausted() bool {
+	return b != nil && atomic.LoadInt64(&b.used) > b.limit
+}
+
+// fileMatchSize returns the memory held by m.
+func fileMatchSize(m *FileMatch) int64 {
+	n := fileMatchBytes + int64(len(m.FileName)+len(m.Content))
+	for i := range m.LineMatches {
+		l := &m.LineMatches[i]
+		n += lineMatchBytes + int64(len(l.Line)+len(l.Before)+len(l.After))
+		n += int64(len(l.LineFragments)) * lineFragmentMatchBytes
+	}
+	return n
+}
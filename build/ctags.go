@@ -154,11 +154,12 @@ func ctagsAddSymbolsParser(todo []*zoekt.Document, parser ctags.Parser) error {
 		}
 		doc.Language = strings.ToLower(es[0].Language)
 
-		symOffsets, err := tagsToSections(doc.Content, es)
+		symOffsets, metaData, err := tagsToSections(doc.Content, es)
 		if err != nil {
 			return fmt.Errorf("%s: %v", doc.Name, err)
 		}
 		doc.Symbols = symOffsets
+		doc.SymbolsMetaData = metaData
 	}
 
 	return nil
@@ -198,11 +199,12 @@ func ctagsAddSymbols(todo []*zoekt.Document, parser ctags.Parser, bin string) er
 	}
 
 	for k, tags := range fileTags {
-		symOffsets, err := tagsToSections(contents[k], tags)
+		symOffsets, metaData, err := tagsToSections(contents[k], tags)
 		if err != nil {
 			return fmt.Errorf("%s: %v", k, err)
 		}
 		todo[pathIndices[k]].Symbols = symOffsets
+		todo[pathIndices[k]].SymbolsMetaData = metaData
 		if len(tags) > 0 {
 			todo[pathIndices[k]].Language = strings.ToLower(tags[0].Language)
 		}
@@ -210,10 +212,13 @@ func ctagsAddSymbols(todo []*zoekt.Document, parser ctags.Parser, bin string) er
 	return nil
 }
 
-func tagsToSections(content []byte, tags []*ctags.Entry) ([]zoekt.DocumentSection, error) {
+// tagsToSections returns the sections of the symbols that ctags found,
+// along with their kind and scope.
+func tagsToSections(content []byte, tags []*ctags.Entry) ([]zoekt.DocumentSection, []*zoekt.Symbol, error) {
 	nls := newLinesIndices(content)
 	nls = append(nls, uint32(len(content)))
 	var symOffsets []zoekt.DocumentSection
+	var metaData []*zoekt.Symbol
 	var lastEnd uint32
 	var lastLine int
 	var lastIntraEnd int
@@ -224,7 +229,7 @@ func tagsToSections(content []byte, tags []*ctags.Entry) ([]zoekt.DocumentSectio
 		}
 		lineIdx := t.Line - 1
 		if lineIdx >= len(nls) {
-			return nil, fmt.Errorf("linenum for entry out of range %v", t)
+			return nil, nil, fmt.Errorf("linenum for entry out of range %v", t)
 		}
 
 		lineOff := uint32(0)
@@ -259,12 +264,18 @@ func tagsToSections(content []byte, tags []*ctags.Entry) ([]zoekt.DocumentSectio
 			Start: start,
 			End:   endSym,
 		})
+		metaData = append(metaData, &zoekt.Symbol{
+			Sym:        t.Sym,
+			Kind:       t.Kind,
+			Parent:     t.Parent,
+			ParentKind: t.ParentType,
+		})
 		lastEnd = endSym
 		lastLine = lineIdx
 		lastIntraEnd = intraOff + len(t.Sym)
 	}
 
-	return symOffsets, nil
+	return symOffsets, metaData, nil
 }
 
 func newLinesIndices(in []byte) []uint32 {
@@ -33,7 +33,7 @@ func TestTagsToSections(t *testing.T) {
 		},
 	}
 
-	secs, err := tagsToSections(c, tags)
+	secs, _, err := tagsToSections(c, tags)
 	if err != nil {
 		t.Fatal("tagsToSections", err)
 	}
@@ -49,8 +49,11 @@ func TestTagsToSectionsMultiple(t *testing.T) {
 
 	tags := []*ctags.Entry{
 		{
-			Sym:  "x",
-			Line: 1,
+			Sym:        "x",
+			Line:       1,
+			Kind:       "field",
+			Parent:     "Foob",
+			ParentType: "class",
 		},
 		{
 			Sym:  "b",
@@ -58,7 +61,7 @@ func TestTagsToSectionsMultiple(t *testing.T) {
 		},
 	}
 
-	got, err := tagsToSections(c, tags)
+	got, meta, err := tagsToSections(c, tags)
 	if err != nil {
 		t.Fatal("tagsToSections", err)
 	}
@@ -70,6 +73,14 @@ func TestTagsToSectionsMultiple(t *testing.T) {
 	if !reflect.DeepEqual(got, want) {
 		t.Errorf("got %v, want %v", got, want)
 	}
+
+	wantMeta := []*zoekt.Symbol{
+		{Sym: "x", Kind: "field", Parent: "Foob", ParentKind: "class"},
+		{Sym: "b"},
+	}
+	if !reflect.DeepEqual(meta, wantMeta) {
+		t.Errorf("got metadata %v, want %v", meta, wantMeta)
+	}
 }
 
 func TestTagsToSectionsEOF(t *testing.T) {
@@ -83,7 +94,7 @@ func TestTagsToSectionsEOF(t *testing.T) {
 		},
 	}
 
-	secs, err := tagsToSections(c, tags)
+	secs, _, err := tagsToSections(c, tags)
 	if err != nil {
 		t.Fatal("tagsToSections", err)
 	}
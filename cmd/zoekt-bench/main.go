@@ -0,0 +1,307 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// zoekt-bench replays a query log against an index directory and
+// reports latency, throughput and allocation numbers.
+//
+// The query log holds one query per line. Lines may be plain query
+// strings, or entries of the zoekt-webserver slow query log, which are
+// replayed with their original search options.
+package main
+
+import (
+	"bufio"
+	"context"
+	"encoding/json"
+	"flag"
+	"fmt"
+	"io"
+	"log"
+	"os"
+	"runtime"
+	"sort"
+	"strings"
+	"sync"
+	"time"
+
+	"github.com/google/zoekt"
+	"github.com/google/zoekt/build"
+	"github.com/google/zoekt/query"
+	"github.com/google/zoekt/shards"
+	"github.com/google/zoekt/web"
+)
+
+type benchQuery struct {
+	text string
+	q    query.Q
+	opts *zoekt.SearchOptions
+}
+
+func readQueries(r io.Reader, num int) ([]*benchQuery, error) {
+	var res []*benchQuery
+	scanner := bufio.NewScanner(r)
+	scanner.Buffer(nil, 16<<20)
+	for lineNum := 1; scanner.Scan(); lineNum++ {
+		line := strings.TrimSpace(scanner.Text())
+		if line == "" || strings.HasPrefix(line, "#") {
+			continue
+		}
+
+		bq := &benchQuery{text: line}
+		if strings.HasPrefix(line, "{") {
+			var e web.SlowQuery
+			if err := json.Unmarshal([]byte(line), &e); err != nil {
+				return nil, fmt.Errorf("line %d: %v", lineNum, err)
+			}
+			bq.text = e.Query
+			bq.opts = e.SearchOptions()
+		} else {
+			bq.opts = &zoekt.SearchOptions{}
+			bq.opts.SetDefaults()
+			bq.opts.MaxDocDisplayCount = num
+		}
+
+		q, err := query.Parse(bq.text)
+		if err != nil {
+			return nil, fmt.Errorf("query %q: %v", bq.text, err)
+		}
+		bq.q = q
+		res = append(res, bq)
+	}
+	return res, scanner.Err()
+}
+
+type sample struct {
+	latency time.Duration
+	stats   zoekt.Stats
+	err     error
+}
+
+// Report is the machine readable result of a run.
+type Report struct {
+	Mode        string
+	Queries     int
+	Errors      int
+	Elapsed     time.Duration
+	QPS         float64
+	Latency     Percentiles
+	AllocsPerOp uint64
+	BytesPerOp  uint64
+	Stats       zoekt.Stats
+}
+
+// Percentiles of the query latency.
+type Percentiles struct {
+	Mean, P50, P90, P99, P999, Max time.Duration
+}
+
+func percentiles(lat []time.Duration) Percentiles {
+	var p Percentiles
+	if len(lat) == 0 {
+		return p
+	}
+	sort.Slice(lat, func(i, j int) bool { return lat[i] < lat[j] })
+
+	var sum time.Duration
+	for _, l := range lat {
+		sum += l
+	}
+	at := func(q float64) time.Duration {
+		return lat[int(q*float64(len(lat)-1))]
+	}
+	p.Mean = sum / time.Duration(len(lat))
+	p.P50 = at(0.5)
+	p.P90 = at(0.9)
+	p.P99 = at(0.99)
+	p.P999 = at(0.999)
+	p.Max = lat[len(lat)-1]
+	return p
+}
+
+func search(s zoekt.Searcher, bq *benchQuery, scheduled time.Time) sample {
+	res, err := s.Search(context.Background(), bq.q, bq.opts)
+	smp := sample{latency: time.Since(scheduled), err: err}
+	if err == nil {
+		smp.stats = res.Stats
+	}
+	return smp
+}
+
+// closedLoop runs n queries from concurrency workers, each issuing
+// its next query when the previous one returns.
+func closedLoop(s zoekt.Searcher, queries []*benchQuery, n, concurrency int) []sample {
+	samples := make([]sample, n)
+	next := make(chan int, n)
+	for i := 0; i < n; i++ {
+		next <- i
+	}
+	close(next)
+
+	var wg sync.WaitGroup
+	for w := 0; w < concurrency; w++ {
+		wg.Add(1)
+		go func() {
+			defer wg.Done()
+			for i := range next {
+				samples[i] = search(s, queries[i%len(queries)], time.Now())
+			}
+		}()
+	}
+	wg.Wait()
+	return samples
+}
+
+// openLoop issues n queries at a fixed rate, regardless of how long
+// they take. Latency is measured from the scheduled start, so a
+// backlog shows up in the numbers rather than slowing the load.
+func openLoop(s zoekt.Searcher, queries []*benchQuery, n int, qps float64) []sample {
+	samples := make([]sample, n)
+	interval := time.Duration(float64(time.Second) / qps)
+	start := time.Now()
+
+	var wg sync.WaitGroup
+	for i := 0; i < n; i++ {
+		scheduled := start.Add(time.Duration(i) * interval)
+		time.Sleep(time.Until(scheduled))
+
+		wg.Add(1)
+		go func(i int) {
+			defer wg.Done()
+			samples[i] = search(s, queries[i%len(queries)], scheduled)
+		}(i)
+	}
+	wg.Wait()
+	return samples
+}
+
+func printReport(w io.Writer, r *Report) {
+	fmt.Fprintf(w, "mode:        %s\n", r.Mode)
+	fmt.Fprintf(w, "queries:     %d (%d errors)\n", r.Queries, r.Errors)
+	fmt.Fprintf(w, "elapsed:     %v\n", r.Elapsed)
+	fmt.Fprintf(w, "throughput:  %.1f qps\n", r.QPS)
+	fmt.Fprintf(w, "latency:     mean %v p50 %v p90 %v p99 %v p99.9 %v max %v\n",
+		r.Latency.Mean, r.Latency.P50, r.Latency.P90, r.Latency.P99, r.Latency.P999, r.Latency.Max)
+	fmt.Fprintf(w, "allocations: %d allocs/op, %d B/op\n", r.AllocsPerOp, r.BytesPerOp)
+	fmt.Fprintf(w, "stats:       %+v\n", r.Stats)
+}
+
+func main() {
+	os.Exit(run())
+}
+
+// run runs the benchmark, and returns the exit code. It is separate
+// from main so deferred calls run before the exit.
+func run() int {
+	index := flag.String("index", build.DefaultDir, "index directory to search.")
+	queryLog := flag.String("queries", "", "file with one query per line, or '-' for stdin.")
+	num := flag.Int("num", 50, "number of results for plain queries.")
+	count := flag.Int("n", 0, "number of searches to run, cycling through the log. Default: the number of queries in the log.")
+	qps := flag.Float64("qps", 0, "if set, issue searches at this rate (open loop) instead of from --concurrency workers.")
+	concurrency := flag.Int("concurrency", runtime.GOMAXPROCS(0), "number of searches in flight for the closed loop.")
+	jsonOut := flag.Bool("json", false, "print the report as JSON.")
+	prefetch := flag.Int("prefetch", 0, "prefetch this many candidate documents ahead of verification.")
+	flag.Parse()
+
+	if *queryLog == "" {
+		log.Print("must set --queries")
+		return 2
+	}
+	in := os.Stdin
+	if *queryLog != "-" {
+		f, err := os.Open(*queryLog)
+		if err != nil {
+			log.Print(err)
+			return 1
+		}
+		defer f.Close()
+		in = f
+	}
+	queries, err := readQueries(in, *num)
+	if err != nil {
+		log.Print(err)
+		return 1
+	}
+	if len(queries) == 0 {
+		log.Print("no queries found")
+		return 1
+	}
+	if *prefetch > 0 {
+		for _, bq := range queries {
+			bq.opts.PrefetchCandidates = *prefetch
+		}
+	}
+
+	n := *count
+	if n <= 0 {
+		n = len(queries)
+	}
+
+	searcher, err := shards.NewDirectorySearcher(*index)
+	if err != nil {
+		log.Print(err)
+		return 1
+	}
+	defer searcher.Close()
+
+	var before, after runtime.MemStats
+	runtime.GC()
+	runtime.ReadMemStats(&before)
+	start := time.Now()
+
+	var samples []sample
+	report := Report{Queries: n}
+	if *qps > 0 {
+		report.Mode = fmt.Sprintf("open loop, %g qps", *qps)
+		samples = openLoop(searcher, queries, n, *qps)
+	} else {
+		if *concurrency < 1 {
+			*concurrency = 1
+		}
+		report.Mode = fmt.Sprintf("closed loop, concurrency %d", *concurrency)
+		samples = closedLoop(searcher, queries, n, *concurrency)
+	}
+
+	report.Elapsed = time.Since(start)
+	runtime.ReadMemStats(&after)
+
+	var lat []time.Duration
+	for i, s := range samples {
+		if s.err != nil {
+			report.Errors++
+			log.Printf("search %q: %v", queries[i%len(queries)].text, s.err)
+			continue
+		}
+		lat = append(lat, s.latency)
+		report.Stats.Add(s.stats)
+	}
+	report.Latency = percentiles(lat)
+	report.QPS = float64(n) / report.Elapsed.Seconds()
+	report.AllocsPerOp = (after.Mallocs - before.Mallocs) / uint64(n)
+	report.BytesPerOp = (after.TotalAlloc - before.TotalAlloc) / uint64(n)
+
+	if *jsonOut {
+		enc := json.NewEncoder(os.Stdout)
+		enc.SetIndent("", "  ")
+		if err := enc.Encode(&report); err != nil {
+			log.Print(err)
+			return 1
+		}
+	} else {
+		printReport(os.Stdout, &report)
+	}
+	if report.Errors > 0 {
+		return 1
+	}
+	return 0
+}
@@ -0,0 +1,270 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// zoekt-placement assigns the shards of an index directory to serving
+// nodes, and writes a manifest for each node. Run zoekt-webserver with
+// --manifest on each node to serve only its shards.
+//
+// Placement is stable: rerunning it after nodes join or leave moves
+// only a small fraction of the shards. Existing manifests in the
+// output directory are compared with the new ones, and the number of
+// shard copies to transfer is reported.
+package main
+
+import (
+	"bufio"
+	"context"
+	"flag"
+	"fmt"
+	"io/ioutil"
+	"log"
+	"os"
+	"path/filepath"
+	"strconv"
+	"strings"
+
+	"github.com/google/zoekt"
+	"github.com/google/zoekt/build"
+	"github.com/google/zoekt/placement"
+	"github.com/google/zoekt/query"
+)
+
+const manifestSuffix = ".manifest"
+
+// parseNodes parses a list like "a,b=2,c".
+func parseNodes(s string) ([]placement.Node, error) {
+	var nodes []placement.Node
+	for _, f := range strings.Split(s, ",") {
+		if f == "" {
+			continue
+		}
+		n := placement.Node{Name: f}
+		if i := strings.Index(f, "="); i >= 0 {
+			w, err := strconv.ParseFloat(f[i+1:], 64)
+			if err != nil || w <= 0 {
+				return nil, fmt.Errorf("bad weight in %q", f)
+			}
+			n.Name, n.Weight = f[:i], w
+		}
+		nodes = append(nodes, n)
+	}
+	return nodes, nil
+}
+
+// readLoads reads lines of repository names and their query load,
+// separated by whitespace.
+func readLoads(fn string) (map[string]float64, error) {
+	f, err := os.Open(fn)
+	if err != nil {
+		return nil, err
+	}
+	defer f.Close()
+
+	loads := map[string]float64{}
+	scanner := bufio.NewScanner(f)
+	for scanner.Scan() {
+		fields := strings.Fields(scanner.Text())
+		if len(fields) == 0 || strings.HasPrefix(fields[0], "#") {
+			continue
+		}
+		if len(fields) != 2 {
+			return nil, fmt.Errorf("%s: bad line %q", fn, scanner.Text())
+		}
+		l, err := strconv.ParseFloat(fields[1], 64)
+		if err != nil {
+			return nil, fmt.Errorf("%s: %v", fn, err)
+		}
+		loads[fields[0]] += l
+	}
+	return loads, scanner.Err()
+}
+
+// loadShard returns the shard for a file. Its size is the size of the
+// file, which is mapped, plus the memory the index needs once loaded.
+func loadShard(fn string, loads map[string]float64) (placement.Shard, error) {
+	s := placement.Shard{Name: filepath.Base(fn)}
+
+	f, err := os.Open(fn)
+	if err != nil {
+		return s, err
+	}
+	iFile, err := zoekt.NewIndexFile(f)
+	if err != nil {
+		f.Close()
+		return s, err
+	}
+	searcher, err := zoekt.NewSearcher(iFile)
+	if err != nil {
+		iFile.Close()
+		return s, err
+	}
+	defer searcher.Close()
+
+	sz, err := iFile.Size()
+	if err != nil {
+		return s, err
+	}
+	l, err := searcher.List(context.Background(), &query.Const{Value: true})
+	if err != nil {
+		return s, err
+	}
+
+	s.Bytes = int64(sz)
+	for _, r := range l.Repos {
+		s.Bytes += r.Stats.IndexBytes
+		s.Load += loads[r.Repository.Name]
+	}
+	return s, nil
+}
+
+// readManifests reads the manifests in dir, keyed by node.
+func readManifests(dir string) (placement.Plan, error) {
+	fs, err := filepath.Glob(filepath.Join(dir, "*"+manifestSuffix))
+	if err != nil {
+		return nil, err
+	}
+	plan := placement.Plan{}
+	for _, fn := range fs {
+		f, err := os.Open(fn)
+		if err != nil {
+			return nil, err
+		}
+		shards, err := placement.ReadManifest(f)
+		f.Close()
+		if err != nil {
+			return nil, fmt.Errorf("%s: %v", fn, err)
+		}
+		node := strings.TrimSuffix(filepath.Base(fn), manifestSuffix)
+		for s := range shards {
+			plan[node] = append(plan[node], s)
+		}
+	}
+	return plan, nil
+}
+
+func writeManifests(dir string, plan placement.Plan) error {
+	for node, shards := range plan {
+		fn := filepath.Join(dir, node+manifestSuffix)
+		tmp, err := ioutil.TempFile(dir, node+".*.tmp")
+		if err != nil {
+			return err
+		}
+		err = placement.WriteManifest(tmp, shards)
+		if cerr := tmp.Close(); err == nil {
+			err = cerr
+		}
+		if err == nil {
+			// Rename, so servers never read a partial manifest.
+			err = os.Rename(tmp.Name(), fn)
+		}
+		if err != nil {
+			os.Remove(tmp.Name())
+			return err
+		}
+	}
+	return nil
+}
+
+func main() {
+	index := flag.String("index", build.DefaultDir, "index directory holding the shards to place.")
+	nodeList := flag.String("nodes", "", "comma separated nodes to place shards on. A node may have a relative capacity, eg. 'a,b,c=2'.")
+	replicas := flag.Int("replicas", 1, "number of nodes serving each shard.")
+	loadFile := flag.String("load", "", "file with lines of a repository name and its query load, eg. its queries per second.")
+	loadWeight := flag.Float64("load_weight", 0.5, "if using --load, how much the query load counts for the cost of a shard, between 0 (only size) and 1 (only load).")
+	slack := flag.Float64("slack", 0.1, "how much a node may exceed its fair share of the cost. Less slack balances better but moves more shards.")
+	out := flag.String("out", "", "directory to write NODE"+manifestSuffix+" files to.")
+	dryRun := flag.Bool("n", false, "only report the changes; don't write manifests.")
+	flag.Parse()
+
+	if *out == "" {
+		log.Fatal("must set --out")
+	}
+	nodes, err := parseNodes(*nodeList)
+	if err != nil {
+		log.Fatal(err)
+	}
+	if len(nodes) == 0 {
+		log.Fatal("must set --nodes")
+	}
+
+	loads := map[string]float64{}
+	weight := 0.0
+	if *loadFile != "" {
+		if loads, err = readLoads(*loadFile); err != nil {
+			log.Fatal(err)
+		}
+		weight = *loadWeight
+	}
+
+	fs, err := filepath.Glob(filepath.Join(*index, "*.zoekt"))
+	if err != nil {
+		log.Fatal(err)
+	}
+	if len(fs) == 0 {
+		log.Fatalf("no shards in %s", *index)
+	}
+	var shards []placement.Shard
+	for _, fn := range fs {
+		s, err := loadShard(fn, loads)
+		if err != nil {
+			log.Printf("skipping %s: %v", fn, err)
+			continue
+		}
+		shards = append(shards, s)
+	}
+
+	plan, err := placement.Place(shards, nodes, placement.Options{
+		Replicas:   *replicas,
+		LoadWeight: weight,
+		Slack:      *slack,
+	})
+	if err != nil {
+		log.Fatal(err)
+	}
+
+	if err := os.MkdirAll(*out, 0o755); err != nil {
+		log.Fatal(err)
+	}
+	old, err := readManifests(*out)
+	if err != nil {
+		log.Fatal(err)
+	}
+
+	size := map[string]int64{}
+	for _, s := range shards {
+		size[s.Name] = s.Bytes
+	}
+	for _, n := range nodes {
+		var bytes int64
+		for _, s := range plan[n.Name] {
+			bytes += size[s]
+		}
+		fmt.Printf("%s: %d shards, %d bytes\n", n.Name, len(plan[n.Name]), bytes)
+	}
+	if len(old) > 0 {
+		fmt.Printf("%d of %d shard copies move\n", placement.Moves(old, plan), len(shards)**replicas)
+	}
+
+	if *dryRun {
+		return
+	}
+	if err := writeManifests(*out, plan); err != nil {
+		log.Fatal(err)
+	}
+	for node := range old {
+		if _, ok := plan[node]; !ok {
+			os.Remove(filepath.Join(*out, node+manifestSuffix))
+		}
+	}
+}
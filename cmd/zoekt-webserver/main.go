@@ -63,6 +63,13 @@ func divertLogs(dir string, interval time.Duration) {
 	}
 }
 
+const (
+	// Start a new slow query log file after this many bytes, and
+	// keep this many files.
+	slowQueryLogSize  = 64 << 20
+	slowQueryLogFiles = 10
+)
+
 const templateExtension = ".html.tpl"
 
 func loadTemplates(tpl *template.Template, dir string) error {
@@ -104,10 +111,19 @@ func writeTemplates(dir string) error {
 func main() {
 	logDir := flag.String("log_dir", "", "log to this directory rather than stderr.")
 	logRefresh := flag.Duration("log_refresh", 24*time.Hour, "if using --log_dir, start writing a new file this often.")
+	slowQueryDir := flag.String("slow_query_log_dir", "", "record slow searches to this directory.")
+	slowQueryThreshold := flag.Duration("slow_query_threshold", time.Second, "if using --slow_query_log_dir, record searches that take at least this long.")
 
 	listen := flag.String("listen", ":6070", "listen on this address.")
 	index := flag.String("index", build.DefaultDir, "set index directory to use")
+	shardMemoryBudget := flag.Int64("shard_memory_budget_mb", 0, "if set, close the least recently searched shards when the open index files exceed this many megabytes.")
+	loadInBackground := flag.Bool("load_in_background", true, "serve searches while the shards are loading, highest ranked first. Results cover the loaded shards only until loading finishes.")
+	manifest := flag.String("manifest", "", "serve only the shards of --index listed in this file, as written by zoekt-placement. Update it by renaming a new file over it; an empty manifest, or one without a final newline, is ignored.")
+	federate := flag.String("federate", "", "search these zoekt-webservers, which must run with --rpc, instead of --index. Backends are separated by ',', and addresses serving the same shards by '|', eg. 'http://a1:6070|http://a2:6070,http://b:6070'.")
+	hedgeDelay := flag.Duration("hedge_delay", 0, "if using --federate, send a backup request if a backend takes longer than this.")
+	maxSearchMemory := flag.Int64("max_search_memory_mb", 0, "if set, stop searches once their results take about this many megabytes.")
 	html := flag.Bool("html", true, "enable HTML interface")
+	enableRPC := flag.Bool("rpc", false, "enable the /api/search endpoint")
 	print := flag.Bool("print", false, "enable local result URLs")
 	enablePprof := flag.Bool("pprof", false, "set to enable remote profiling.")
 	sslCert := flag.String("ssl_cert", "", "set path to SSL .pem holding certificate.")
@@ -146,11 +162,26 @@ func main() {
 	// Tune GOMAXPROCS to match Linux container CPU quota.
 	maxprocs.Set()
 
-	if err := os.MkdirAll(*index, 0o755); err != nil {
-		log.Fatal(err)
+	var searcher zoekt.Searcher
+	var err error
+	if *federate != "" {
+		var backends []shards.Backend
+		for _, b := range strings.Split(*federate, ",") {
+			backends = append(backends, shards.Backend{Addrs: strings.Split(b, "|")})
+		}
+		searcher, err = shards.NewFederatedSearcher(backends, shards.FederatedOptions{
+			HedgeDelay: *hedgeDelay,
+		})
+	} else {
+		if err := os.MkdirAll(*index, 0o755); err != nil {
+			log.Fatal(err)
+		}
+		searcher, err = shards.NewDirectorySearcherWithOptions(*index, shards.DirectorySearcherOptions{
+			MemoryBudget:     *shardMemoryBudget << 20,
+			LoadInBackground: *loadInBackground,
+			Manifest:         *manifest,
+		})
 	}
-
-	searcher, err := shards.NewDirectorySearcher(*index)
 	if err != nil {
 		log.Fatal(err)
 	}
@@ -169,6 +200,15 @@ func main() {
 
 	s.Print = *print
 	s.HTML = *html
+	s.RPC = *enableRPC
+	s.MaxMemoryBytes = *maxSearchMemory << 20
+
+	if *slowQueryDir != "" {
+		s.SlowQueries, err = web.NewSlowQueryLog(*slowQueryDir, *slowQueryThreshold, slowQueryLogSize, slowQueryLogFiles)
+		if err != nil {
+			log.Fatal(err)
+		}
+	}
 
 	if *hostCustomization != "" {
 		s.HostCustomQueries = map[string]string{}
@@ -191,6 +231,7 @@ func main() {
 	}
 
 	handler.Handle("/metrics", promhttp.Handler())
+	handler.Handle("/debug/residency", shards.ResidencyHandler(searcher))
 
 	if *enablePprof {
 		handler.HandleFunc("/debug/pprof/", pprof.Index)
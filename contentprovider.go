@@ -29,6 +29,10 @@ type contentProvider struct {
 	id    *indexData
 	stats *Stats
 
+	// done is closed when the search is canceled. Loops that can
+	// run long on a single document poll it with canceled.
+	done <-chan struct{}
+
 	// mutable
 	err      error
 	idx      uint32
@@ -38,6 +42,38 @@ type contentProvider struct {
 	_sects   []DocumentSection
 	_sectBuf []DocumentSection
 	fileSize uint32
+
+	// The last rune offset that findOffset mapped, for the content
+	// and the file name.
+	_runeCursors [2]runeCursor
+
+	// The ID of the first symbol of the document, if _firstSymValid,
+	// and the metadata of the sections that matched so far.
+	_firstSym      uint32
+	_firstSymValid bool
+	_symInfo       map[int]*Symbol
+
+	// truncated is set once canceled has returned true.
+	truncated bool
+}
+
+// cancelCheckInterval is how many iterations of a per-document loop
+// run between checks for cancellation.
+const cancelCheckInterval = 256
+
+// canceled returns whether the search was canceled, and if so, marks
+// the result as truncated.
+func (p *contentProvider) canceled() bool {
+	if p.truncated {
+		return true
+	}
+	select {
+	case <-p.done:
+		p.truncated = true
+		return true
+	default:
+		return false
+	}
 }
 
 // setDocument skips to the given document.
@@ -50,6 +86,9 @@ func (p *contentProvider) setDocument(docID uint32) {
 	p._nl = nil
 	p._sects = nil
 	p._data = nil
+	p._runeCursors = [2]runeCursor{}
+	p._firstSymValid = false
+	p._symInfo = nil
 }
 
 func (p *contentProvider) docSections() []DocumentSection {
@@ -78,6 +117,7 @@ func (p *contentProvider) data(fileName bool) []byte {
 	}
 
 	if p._data == nil {
+		p.id.prefetch(p.id.contentSection(p.idx))
 		p._data, p.err = p.id.readContents(p.idx)
 		p.stats.FilesLoaded++
 		p.stats.ContentBytesLoaded += int64(len(p._data))
@@ -85,13 +125,28 @@ func (p *contentProvider) data(fileName bool) []byte {
 	return p._data
 }
 
-// Find offset in bytes (relative to corpus start) for an offset in
+// runeCursor is a known rune offset and its byte offset, both
+// relative to the document start.
+type runeCursor struct {
+	valid bool
+	rune  uint32
+	byte  uint32
+}
+
+// Find offset in bytes (relative to document start) for an offset in
 // runes (relative to document start). If filename is set, the corpus
 // is the set of filenames, with the document being the name itself.
 func (p *contentProvider) findOffset(filename bool, r uint32) uint32 {
 	if p.id.metaData.PlainASCII {
 		return r
 	}
+	flag, c := byte(docContentASCII), &p._runeCursors[0]
+	if filename {
+		flag, c = docNameASCII, &p._runeCursors[1]
+	}
+	if int(p.idx) < len(p.id.asciiFlags) && p.id.asciiFlags[p.idx]&flag != 0 {
+		return r
+	}
 
 	sample := p.id.runeOffsets
 	runeEnds := p.id.fileEndRunes
@@ -102,36 +157,49 @@ func (p *contentProvider) findOffset(filename bool, r uint32) uint32 {
 		fileStartByte = p.id.fileNameIndex[p.idx]
 	}
 
-	absR := r
+	var fileStartRune uint32
 	if p.idx > 0 {
-		absR += runeEnds[p.idx-1]
+		fileStartRune = runeEnds[p.idx-1]
 	}
-
-	byteOff := sample[absR/runeOffsetFrequency]
-	left := absR % runeOffsetFrequency
-
-	var data []byte
-
-	if filename {
-		data = p.id.fileNameContent[byteOff:]
-	} else {
-		data, p.err = p.id.readContentSlice(byteOff, 3*runeOffsetFrequency)
-		if p.err != nil {
-			return 0
-		}
+	absR := fileStartRune + r
+
+	// Walk from the closest known offset: the document start, the
+	// sample, or the previous lookup, as candidates usually come
+	// in increasing order.
+	var startRune, startByte uint32
+	if s := absR / runeOffsetFrequency; s*runeOffsetFrequency >= fileStartRune {
+		startRune = s*runeOffsetFrequency - fileStartRune
+		startByte = sample[s] - fileStartByte
 	}
-	for left > 0 {
-		_, sz := utf8.DecodeRune(data)
-		byteOff += uint32(sz)
-		data = data[sz:]
-		left--
+	if c.valid && c.rune <= r && c.rune > startRune {
+		startRune, startByte = c.rune, c.byte
 	}
 
-	byteOff -= fileStartByte
+	data := p.data(filename)
+	if p.err != nil {
+		return 0
+	}
+	byteOff := startByte + skipRunes(data[startByte:], r-startRune)
+	*c = runeCursor{valid: true, rune: r, byte: byteOff}
 	return byteOff
 }
 
-func (p *contentProvider) fillMatches(ms []*candidateMatch) []LineMatch {
+// skipRunes returns the number of bytes taken by the first n runes
+// of data.
+func skipRunes(data []byte, n uint32) uint32 {
+	off := 0
+	for ; n > 0 && off < len(data); n-- {
+		if data[off] < utf8.RuneSelf {
+			off++
+			continue
+		}
+		_, sz := utf8.DecodeRune(data[off:])
+		off += sz
+	}
+	return uint32(off)
+}
+
+func (p *contentProvider) fillMatches(ms []*candidateMatch, numContextLines int) []LineMatch {
 	var result []LineMatch
 	if ms[0].fileName {
 		// There is only "line" in a filename.
@@ -151,20 +219,23 @@ func (p *contentProvider) fillMatches(ms []*candidateMatch) []LineMatch {
 		}
 	} else {
 		ms = breakMatchesOnNewlines(ms, p.data(false))
-		result = p.fillContentMatches(ms)
+		result = p.fillContentMatches(ms, numContextLines)
 	}
 
 	sects := p.docSections()
 	for i, m := range result {
-		result[i].Score = matchScore(sects, &m)
+		result[i].Score = p.matchScore(sects, &m)
 	}
 
 	return result
 }
 
-func (p *contentProvider) fillContentMatches(ms []*candidateMatch) []LineMatch {
+func (p *contentProvider) fillContentMatches(ms []*candidateMatch, numContextLines int) []LineMatch {
 	var result []LineMatch
-	for len(ms) > 0 {
+	for n := 0; len(ms) > 0; n++ {
+		if n%cancelCheckInterval == cancelCheckInterval-1 && p.canceled() {
+			break
+		}
 		m := ms[0]
 		num, lineStart, lineEnd := m.line(p.newlines(), p.fileSize)
 
@@ -223,9 +294,62 @@ func (p *contentProvider) fillContentMatches(ms []*candidateMatch) []LineMatch {
 		}
 		result = append(result, finalMatch)
 	}
+
+	if numContextLines > 0 {
+		p.fillContext(result, numContextLines)
+	}
 	return result
 }
 
+// fillContext sets Before and After to up to n lines around each
+// match. The windows are cut where they would overlap a neighboring
+// match or its context, so every content byte is returned at most
+// once. ms must be sorted by offset.
+func (p *contentProvider) fillContext(ms []LineMatch, n int) {
+	newlines := p.newlines()
+	data := p.data(false)
+
+	// prevEnd is the first byte not yet covered by the
+	// previous match or its context.
+	prevEnd := 0
+	for i := range ms {
+		m := &ms[i]
+
+		// Lines are 1-based; line k starts after newline k-2.
+		start := 0
+		if first := m.LineNumber - n; first > 1 {
+			start = int(newlines[first-2]) + 1
+		}
+		if start < prevEnd {
+			start = prevEnd
+		}
+		if start < m.LineStart {
+			m.Before = data[start:m.LineStart]
+		}
+
+		if m.LineEnd >= len(data) {
+			prevEnd = len(data)
+			continue
+		}
+
+		// LineEnd is at a newline; the context starts after it.
+		j := sort.Search(len(newlines), func(k int) bool {
+			return int(newlines[k]) >= m.LineEnd
+		})
+		end := len(data)
+		if j+n < len(newlines) {
+			end = int(newlines[j+n]) + 1
+		}
+		if i+1 < len(ms) && end > ms[i+1].LineStart {
+			end = ms[i+1].LineStart
+		}
+		if m.LineEnd+1 < end {
+			m.After = data[m.LineEnd+1 : end]
+		}
+		prevEnd = end
+	}
+}
+
 const (
 	// TODO - how to scale this relative to rank?
 	scorePartialWordMatch   = 50.0
@@ -233,30 +357,68 @@ const (
 	scoreImportantThreshold = 2000.0
 	scorePartialSymbol      = 4000.0
 	scoreSymbol             = 7000.0
+	scoreKindDefinition     = 1000.0
 	scoreFactorAtomMatch    = 400.0
 	scoreShardRankFactor    = 20.0
 	scoreFileOrderFactor    = 10.0
 	scoreLineOrderFactor    = 1.0
 )
 
-func findSection(secs []DocumentSection, off, sz uint32) *DocumentSection {
+// findSection returns the index of the section holding the range, or
+// -1 if there is none.
+func findSection(secs []DocumentSection, off, sz uint32) int {
 	j := sort.Search(len(secs), func(i int) bool {
 		return secs[i].End >= off+sz
 	})
 
 	if j == len(secs) {
-		return nil
+		return -1
 	}
 
 	if secs[j].Start <= off && off+sz <= secs[j].End {
-		return &secs[j]
+		return j
+	}
+	return -1
+}
+
+// scoreKind returns the bonus for a match in a symbol of the given
+// ctags kind. Types and callables are more often the target of a
+// search than variables or fields.
+func scoreKind(kind string) float64 {
+	switch kind {
+	case "class", "struct", "interface", "type", "typedef", "enum", "trait", "union",
+		"function", "func", "method":
+		return scoreKindDefinition
 	}
-	return nil
+	return 0
 }
 
-func matchScore(secs []DocumentSection, m *LineMatch) float64 {
+// symbolInfo returns the metadata of section j of the document, or
+// nil if it has none. Matches in the same section share it.
+func (p *contentProvider) symbolInfo(secs []DocumentSection, j int) *Symbol {
+	if len(p.id.symbolKinds) <= 1 {
+		return nil
+	}
+	if si, ok := p._symInfo[j]; ok {
+		return si
+	}
+	if !p._firstSymValid {
+		p._firstSym = p.id.firstSymbol(p.idx)
+		p._firstSymValid = true
+	}
+
+	sec := secs[j]
+	si := p.id.symbolInfo(p._firstSym+uint32(j), p.data(false)[sec.Start:sec.End])
+	if p._symInfo == nil {
+		p._symInfo = map[int]*Symbol{}
+	}
+	p._symInfo[j] = si
+	return si
+}
+
+func (p *contentProvider) matchScore(secs []DocumentSection, m *LineMatch) float64 {
 	var maxScore float64
-	for _, f := range m.LineFragments {
+	for k, f := range m.LineFragments {
 		startBoundary := f.LineOffset < len(m.Line) && (f.LineOffset == 0 || byteClass(m.Line[f.LineOffset-1]) != byteClass(m.Line[f.LineOffset]))
 
 		end := int(f.LineOffset) + f.MatchLength
@@ -269,8 +431,8 @@ func matchScore(secs []DocumentSection, m *LineMatch) float64 {
 			score = scorePartialWordMatch
 		}
 
-		sec := findSection(secs, f.Offset, uint32(f.MatchLength))
-		if sec != nil {
+		if j := findSection(secs, f.Offset, uint32(f.MatchLength)); j >= 0 {
+			sec := secs[j]
 			startMatch := sec.Start == f.Offset
 			endMatch := sec.End == f.Offset+uint32(f.MatchLength)
 			if startMatch && endMatch {
@@ -280,6 +442,13 @@ func matchScore(secs []DocumentSection, m *LineMatch) float64 {
 			} else {
 				score += scorePartialSymbol
 			}
+			// Sections are offsets in the content.
+			if !m.FileName {
+				if si := p.symbolInfo(secs, j); si != nil {
+					m.LineFragments[k].SymbolInfo = si
+					score += scoreKind(si.Kind)
+				}
+			}
 		}
 		if score > maxScore {
 			maxScore = score
@@ -18,9 +18,12 @@ import (
 	"context"
 	"fmt"
 	"log"
+	"math/rand"
+	"path"
 	"regexp/syntax"
 	"sort"
 	"strings"
+	"time"
 
 	"golang.org/x/net/trace"
 
@@ -40,6 +43,58 @@ func (m *FileMatch) addScore(what string, s float64) {
 	m.Score += s
 }
 
+// phaseSampleRate is the fraction of documents (1 in phaseSampleRate)
+// for which Search times its phases. Clock reads are cheap, but not
+// free compared to evaluating a small document.
+const phaseSampleRate = 8
+
+// phaseTimer attributes the time between laps to search phases, for
+// one in phaseSampleRate documents.
+type phaseTimer struct {
+	on   bool
+	last time.Time
+
+	// next is the number of documents to skip before the next
+	// sampled one. It starts at a random offset, so the first,
+	// slower, document of a shard is not always sampled.
+	next                int
+	iterations, sampled int
+}
+
+func newPhaseTimer() phaseTimer {
+	return phaseTimer{next: rand.Intn(phaseSampleRate)}
+}
+
+// start starts timing a document, if it is sampled.
+func (t *phaseTimer) start() {
+	t.iterations++
+	t.on = t.next == 0
+	if t.on {
+		t.sampled++
+		t.next = phaseSampleRate
+		t.last = time.Now()
+	}
+	t.next--
+}
+
+// scale extrapolates d, the time spent on the sampled documents, to
+// all documents.
+func (t *phaseTimer) scale(d *time.Duration) {
+	if t.sampled > 0 {
+		*d = *d * time.Duration(t.iterations) / time.Duration(t.sampled)
+	}
+}
+
+// lap adds the time since the previous lap to dst.
+func (t *phaseTimer) lap(dst *time.Duration) {
+	if !t.on {
+		return
+	}
+	now := time.Now()
+	*dst += now.Sub(t.last)
+	t.last = now
+}
+
 func (d *indexData) simplify(in query.Q) query.Q {
 	eval := query.Map(in, func(q query.Q) query.Q {
 		if r, ok := q.(*query.Repo); ok {
@@ -77,6 +132,11 @@ func (d *indexData) Search(ctx context.Context, q query.Q, opts *SearchOptions)
 	copyOpts := *opts
 	opts = &copyOpts
 	opts.SetDefaults()
+	if opts.Paginate {
+		// Pages follow document order, so finding high
+		// scoring matches is no reason to stop early.
+		opts.ShardMaxImportantMatch = 0
+	}
 	importantMatchCount := 0
 
 	var res SearchResult
@@ -87,6 +147,10 @@ func (d *indexData) Search(ctx context.Context, q query.Q, opts *SearchOptions)
 	select {
 	case <-ctx.Done():
 		res.Stats.ShardsSkipped++
+		res.Stats.Truncated = true
+		if opts.Paginate {
+			res.ResumeDocs = []uint32{opts.StartDoc}
+		}
 		return &res, nil
 	default:
 	}
@@ -116,12 +180,20 @@ func (d *indexData) Search(ctx context.Context, q query.Q, opts *SearchOptions)
 		return &res, nil
 	}
 
+	if opts.LimitPolicy != nil {
+		// When searched directly, this shard is the whole corpus.
+		opts.LimitPolicy(len(d.fileBranchMasks), opts)
+		opts.LimitPolicy = nil
+	}
+
 	q = query.Map(q, query.ExpandFileContent)
 
+	treeStart := time.Now()
 	mt, err := d.newMatchTree(q)
 	if err != nil {
 		return nil, err
 	}
+	res.Stats.MatchTreeDuration = time.Since(treeStart)
 
 	totalAtomCount := 0
 	visitMatchTree(mt, func(t matchTree) {
@@ -131,13 +203,37 @@ func (d *indexData) Search(ctx context.Context, q query.Q, opts *SearchOptions)
 	cp := &contentProvider{
 		id:    d,
 		stats: &res.Stats,
+		done:  ctx.Done(),
 	}
 
 	docCount := uint32(len(d.fileBranchMasks))
 	lastDoc := int(-1)
+	if opts.Paginate {
+		lastDoc = int(opts.StartDoc) - 1
+	}
+
+	var prefetcher *candidatePrefetcher
+	if opts.PrefetchCandidates > 0 {
+		prefetcher, err = d.newCandidatePrefetcher(q, opts.PrefetchCandidates, lastDoc)
+		if err != nil {
+			return nil, err
+		}
+	}
+
+	budget := memoryBudgetFromContext(ctx)
+	if budget == nil && opts.MaxMemoryBytes > 0 {
+		budget = &memoryBudget{limit: opts.MaxMemoryBytes}
+	}
+
+	// The first document we did not evaluate, if we stopped early.
+	stoppedAt := -1
+
+	timer := newPhaseTimer()
 
 nextFileMatch:
 	for {
+		timer.start()
+
 		canceled := false
 		select {
 		case <-ctx.Done():
@@ -154,20 +250,44 @@ nextFileMatch:
 		}
 		lastDoc = int(nextDoc)
 
-		if canceled || (res.Stats.MatchCount >= opts.ShardMaxMatchCount && opts.ShardMaxMatchCount > 0) ||
-			(opts.ShardMaxImportantMatch > 0 && importantMatchCount >= opts.ShardMaxImportantMatch) {
+		if canceled || budget.exhausted() ||
+			(res.Stats.MatchCount >= opts.ShardMaxMatchCount && opts.ShardMaxMatchCount > 0) ||
+			(opts.ShardMaxImportantMatch > 0 && importantMatchCount >= opts.ShardMaxImportantMatch) ||
+			(opts.Paginate && opts.MaxDocDisplayCount > 0 && len(res.Files) >= opts.MaxDocDisplayCount) {
 			res.Stats.FilesSkipped += d.repoListEntry.Stats.Documents - lastDoc
+			res.Stats.Truncated = res.Stats.Truncated || canceled
+			res.Stats.MemoryBudgetExceeded = res.Stats.MemoryBudgetExceeded || budget.exhausted()
+			stoppedAt = lastDoc
 			break
 		}
 
 		res.Stats.FilesConsidered++
+		if prefetcher != nil {
+			prefetcher.advance(nextDoc)
+		}
 		mt.prepare(nextDoc)
 
 		cp.setDocument(nextDoc)
+		timer.lap(&res.Stats.IterateDuration)
 
 		known := make(map[matchTree]bool)
 		for cost := costMin; cost <= costMax; cost++ {
 			v, ok := mt.matches(cp, cost, known)
+			switch cost {
+			case costContent:
+				timer.lap(&res.Stats.VerifyDuration)
+			case costRegexp:
+				timer.lap(&res.Stats.RegexpDuration)
+			default:
+				timer.lap(&res.Stats.IterateDuration)
+			}
+			if cp.truncated {
+				// Canceled halfway; we don't know whether
+				// the document matches.
+				res.Stats.FilesSkipped += d.repoListEntry.Stats.Documents - lastDoc
+				stoppedAt = lastDoc
+				break nextFileMatch
+			}
 			if ok && !v {
 				continue nextFileMatch
 			}
@@ -178,6 +298,32 @@ nextFileMatch:
 			}
 		}
 
+		finalCands := gatherMatches(mt, known)
+		if !budget.charge(&res.Stats, int64(len(finalCands))*candidateMatchBytes) {
+			res.Stats.FilesSkipped += d.repoListEntry.Stats.Documents - lastDoc
+			stoppedAt = lastDoc
+			break
+		}
+
+		if opts.CountOnly {
+			// Each candidate is a non-overlapping match; a
+			// document matching on other atoms alone
+			// counts once, like its filename match below.
+			n := len(finalCands)
+			if n == 0 {
+				n = 1
+			}
+			if res.Facets == nil {
+				res.Facets = &Facets{}
+			}
+			res.Facets.add(d.repoMetaData.Name,
+				d.languageMap[d.languages[nextDoc]],
+				path.Ext(string(d.fileName(nextDoc))), n)
+			res.Stats.MatchCount += n
+			res.Stats.FileCount++
+			continue
+		}
+
 		fileMatch := FileMatch{
 			Repository: d.repoMetaData.Name,
 			FileName:   string(d.fileName(nextDoc)),
@@ -207,8 +353,6 @@ nextFileMatch:
 		visitMatches(mt, known, func(mt matchTree) {
 			atomMatchCount++
 		})
-		finalCands := gatherMatches(mt, known)
-
 		if len(finalCands) == 0 {
 			nm := d.fileName(nextDoc)
 			finalCands = append(finalCands,
@@ -223,7 +367,15 @@ nextFileMatch:
 					byteMatchSz:   uint32(len(nm)),
 				})
 		}
-		fileMatch.LineMatches = cp.fillMatches(finalCands)
+		fileMatch.LineMatches = cp.fillMatches(finalCands, opts.NumContextLines)
+		timer.lap(&res.Stats.FillDuration)
+		if cp.truncated && opts.Paginate {
+			// Resume with this document rather than return
+			// part of its matches.
+			res.Stats.FilesSkipped += d.repoListEntry.Stats.Documents - lastDoc
+			stoppedAt = lastDoc
+			break
+		}
 
 		maxFileScore := 0.0
 		for i := range fileMatch.LineMatches {
@@ -254,11 +406,37 @@ nextFileMatch:
 			fileMatch.Content = cp.data(false)
 		}
 
+		if !budget.charge(&res.Stats, fileMatchSize(&fileMatch)) {
+			res.Stats.FilesSkipped += d.repoListEntry.Stats.Documents - lastDoc
+			stoppedAt = lastDoc
+			break
+		}
+
 		res.Files = append(res.Files, fileMatch)
+		if opts.Paginate {
+			res.ResumeDocs = append(res.ResumeDocs, nextDoc+1)
+		}
 		res.Stats.MatchCount += len(fileMatch.LineMatches)
 		res.Stats.FileCount++
+		timer.lap(&res.Stats.ScoreDuration)
+	}
+	res.Stats.Truncated = res.Stats.Truncated || cp.truncated
+
+	timer.scale(&res.Stats.IterateDuration)
+	timer.scale(&res.Stats.VerifyDuration)
+	timer.scale(&res.Stats.RegexpDuration)
+	timer.scale(&res.Stats.FillDuration)
+	timer.scale(&res.Stats.ScoreDuration)
+
+	if opts.Paginate {
+		if stoppedAt >= 0 {
+			res.ResumeDocs = append(res.ResumeDocs, uint32(stoppedAt))
+		}
+	} else {
+		sortStart := time.Now()
+		SortFilesByScore(res.Files)
+		res.Stats.ScoreDuration += time.Since(sortStart)
 	}
-	SortFilesByScore(res.Files)
 
 	addRepo(&res, &d.repoMetaData)
 	for _, v := range d.repoMetaData.SubRepoMap {
@@ -273,6 +451,17 @@ nextFileMatch:
 	return &res, nil
 }
 
+// MatchTreeString describes the match tree that Search evaluates
+// for q. It is meant for debugging slow queries.
+func (d *indexData) MatchTreeString(q query.Q) string {
+	q = query.Map(d.simplify(q), query.ExpandFileContent)
+	mt, err := d.newMatchTree(q)
+	if err != nil {
+		return fmt.Sprintf("error: %v", err)
+	}
+	return fmt.Sprintf("%v", mt)
+}
+
 func addRepo(res *SearchResult, repo *Repository) {
 	if res.RepoURLs == nil {
 		res.RepoURLs = map[string]string{}
@@ -306,6 +495,9 @@ func gatherMatches(mt matchTree, known map[matchTree]bool) []*candidateMatch {
 		if rmt, ok := mt.(*regexpMatchTree); ok {
 			cands = append(cands, rmt.found...)
 		}
+		if smt, ok := mt.(*symbolMatchTree); ok {
+			cands = append(cands, smt.current...)
+		}
 	})
 
 	foundContentMatch := false
@@ -499,3 +691,31 @@ func (d *indexData) regexpToMatchTreeRecursive(r *syntax.Regexp, minTextSize int
 	}
 	return &bruteForceMatchTree{}, false, false, nil
 }
+
+// lineLocal returns whether r can only match within a line, and does
+// not depend on the start or end of the text. Such a regexp finds the
+// same matches when it runs on each line separately.
+func lineLocal(r *syntax.Regexp) bool {
+	switch r.Op {
+	case syntax.OpAnyChar, syntax.OpBeginText, syntax.OpEndText:
+		return false
+	case syntax.OpLiteral:
+		for _, c := range r.Rune {
+			if c == '\n' {
+				return false
+			}
+		}
+	case syntax.OpCharClass:
+		for i := 0; i+1 < len(r.Rune); i += 2 {
+			if r.Rune[i] <= '\n' && '\n' <= r.Rune[i+1] {
+				return false
+			}
+		}
+	}
+	for _, sub := range r.Sub {
+		if !lineLocal(sub) {
+			return false
+		}
+	}
+	return true
+}
@@ -89,6 +89,63 @@ func (i *distanceHitIterator) next(limit uint32) {
 	i.findNext()
 }
 
+// nearHitIterator returns the hits of i1 that have a hit of i2 at most
+// window away, in either direction.
+type nearHitIterator struct {
+	started bool
+	window  uint32
+	i1      hitIterator
+	i2      hitIterator
+}
+
+func (i *nearHitIterator) String() string {
+	return fmt.Sprintf("near(%d, %v, %v)", i.window, i.i1, i.i2)
+}
+
+func (i *nearHitIterator) findNext() {
+	for {
+		p1 := i.i1.first()
+		p2 := i.i2.first()
+		if p1 == maxUInt32 || p2 == maxUInt32 {
+			i.i1.next(maxUInt32)
+			break
+		}
+
+		if uint64(p2)+uint64(i.window) < uint64(p1) {
+			i.i2.next(p1 - i.window - 1)
+		} else if uint64(p1)+uint64(i.window) < uint64(p2) {
+			i.i1.next(p2 - i.window - 1)
+		} else {
+			break
+		}
+	}
+}
+
+func (i *nearHitIterator) first() uint32 {
+	if !i.started {
+		i.findNext()
+		i.started = true
+	}
+	return i.i1.first()
+}
+
+func (i *nearHitIterator) updateStats(s *Stats) {
+	i.i1.updateStats(s)
+	i.i2.updateStats(s)
+}
+
+func (i *nearHitIterator) next(limit uint32) {
+	i.i1.next(limit)
+	// Hits of i2 before the window of the next hit of i1 are
+	// not needed anymore.
+	if limit == maxUInt32 {
+		i.i2.next(maxUInt32)
+	} else if limit > i.window {
+		i.i2.next(limit - i.window)
+	}
+	i.findNext()
+}
+
 func (d *indexData) newDistanceTrigramIter(ng1, ng2 ngram, dist uint32, caseSensitive, fileName bool) (hitIterator, error) {
 	if dist == 0 {
 		return nil, fmt.Errorf("d == 0")
@@ -133,6 +190,7 @@ func (d *indexData) trigramHitIterator(ng ngram, caseSensitive, fileName bool) (
 		if err != nil {
 			return nil, err
 		}
+		d.prefetch(sec)
 		if len(blob) > 0 {
 			iters = append(iters, newCompressedPostingIterator(blob, v))
 		}
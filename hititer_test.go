@@ -49,6 +49,48 @@ func TestCompressedPostingIterator_limit(t *testing.T) {
 	}
 }
 
+func TestNearHitIterator(t *testing.T) {
+	f := func(as, bs []uint16, window uint8) bool {
+		var a, b []uint32
+		for _, x := range as {
+			a = append(a, uint32(x%1024))
+		}
+		for _, x := range bs {
+			b = append(b, uint32(x%1024))
+		}
+		a, b = sortedUnique(a), sortedUnique(b)
+
+		var want []uint32
+		for _, p := range a {
+			for _, q := range b {
+				if p <= q+uint32(window) && q <= p+uint32(window) {
+					want = append(want, p)
+					break
+				}
+			}
+		}
+
+		it := &nearHitIterator{
+			i1:     &inMemoryIterator{postings: a},
+			i2:     &inMemoryIterator{postings: b},
+			window: uint32(window),
+		}
+		var got []uint32
+		for p := it.first(); p != maxUInt32; p = it.first() {
+			got = append(got, p)
+			it.next(p)
+		}
+		if !reflect.DeepEqual(want, got) {
+			t.Log(cmp.Diff(want, got))
+			return false
+		}
+		return true
+	}
+	if err := quick.Check(f, nil); err != nil {
+		t.Error(err)
+	}
+}
+
 func doHitIterator(it hitIterator, limits []uint32) []uint32 {
 	var nums []uint32
 	for _, limit := range limits {
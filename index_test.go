@@ -20,8 +20,10 @@ import (
 	"fmt"
 	"reflect"
 	"regexp/syntax"
+	"sort"
 	"strings"
 	"testing"
+	"time"
 
 	"github.com/kylelemons/godebug/pretty"
 
@@ -37,6 +39,14 @@ func clearScores(r *SearchResult) {
 		r.Files[i].Checksum = nil
 		r.Files[i].Debug = ""
 	}
+
+	// Phase timings differ between runs.
+	r.Stats.MatchTreeDuration = 0
+	r.Stats.IterateDuration = 0
+	r.Stats.VerifyDuration = 0
+	r.Stats.RegexpDuration = 0
+	r.Stats.FillDuration = 0
+	r.Stats.ScoreDuration = 0
 }
 
 func testIndexBuilder(t *testing.T, repo *Repository, docs ...Document) *IndexBuilder {
@@ -310,6 +320,8 @@ func TestAndSearch(t *testing.T) {
 		FileCount:          1,
 		FilesConsidered:    2,
 	}
+	// The accounted memory depends on the size of structs.
+	sres.Stats.MemoryBytes = 0
 	if diff := pretty.Compare(wantStats, sres.Stats); diff != "" {
 		t.Errorf("got stats diff %s", diff)
 	}
@@ -1393,6 +1405,40 @@ func TestLongFileUTF8(t *testing.T) {
 	}
 }
 
+func TestMixedASCIIOffsets(t *testing.T) {
+	line := "wörld needle 世界 needle\n"
+	b := testIndexBuilder(t, nil,
+		Document{Name: "f1", Content: []byte("ascii needle")},
+		Document{Name: "f2/wörld", Content: []byte(strings.Repeat(line, 200))},
+		Document{Name: "f3", Content: []byte("needle ascii")},
+	)
+
+	s := searcherForTest(t, b).(*indexData)
+	want := []byte{docContentASCII | docNameASCII, 0, docContentASCII | docNameASCII}
+	if !bytes.Equal(s.asciiFlags, want) {
+		t.Errorf("got flags %v, want %v", s.asciiFlags, want)
+	}
+
+	res := searchForTest(t, b, &query.Substring{Pattern: "needle", Content: true}, SearchOptions{
+		ShardMaxMatchCount: 1000,
+		TotalMaxMatchCount: 1000,
+	})
+	count := 0
+	for _, f := range res.Files {
+		for _, l := range f.LineMatches {
+			for _, fr := range l.LineFragments {
+				count++
+				if got := string(l.Line[fr.LineOffset : fr.LineOffset+fr.MatchLength]); got != "needle" {
+					t.Errorf("%s:%d: got %q at offset %d", f.FileName, l.LineNumber, got, fr.Offset)
+				}
+			}
+		}
+	}
+	if count != 402 {
+		t.Errorf("got %d matches, want 402", count)
+	}
+}
+
 func TestEstimateDocCount(t *testing.T) {
 	content := []byte("bla needle bla")
 	b := testIndexBuilder(t, &Repository{Name: "reponame"},
@@ -1478,6 +1524,64 @@ func TestIOStats(t *testing.T) {
 	}
 }
 
+func TestPhaseDurations(t *testing.T) {
+	var docs []Document
+	for i := 0; i < 100*phaseSampleRate; i++ {
+		docs = append(docs, Document{
+			Name:    fmt.Sprintf("f%d", i),
+			Content: []byte(strings.Repeat("a needle in a haystack\n", 10)),
+		})
+	}
+	s := searcherForTest(t, testIndexBuilder(t, nil, docs...))
+
+	res, err := s.Search(context.Background(), &query.Substring{Pattern: "needle"}, &SearchOptions{})
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	st := res.Stats
+	for name, d := range map[string]time.Duration{
+		"match tree": st.MatchTreeDuration,
+		"iterate":    st.IterateDuration,
+		"verify":     st.VerifyDuration,
+		"fill":       st.FillDuration,
+		"score":      st.ScoreDuration,
+	} {
+		if d <= 0 {
+			t.Errorf("got %s duration %v, want > 0", name, d)
+		}
+	}
+}
+
+func TestPhaseTimer(t *testing.T) {
+	const n = 100 * phaseSampleRate
+	firsts := map[int]bool{}
+	for run := 0; run < 100; run++ {
+		timer := newPhaseTimer()
+		first := -1
+		for i := 0; i < n; i++ {
+			timer.start()
+			if timer.on && first < 0 {
+				first = i
+			}
+		}
+		if timer.iterations != n || timer.sampled != n/phaseSampleRate {
+			t.Fatalf("sampled %d of %d documents, want %d of %d", timer.sampled, timer.iterations, n/phaseSampleRate, n)
+		}
+		firsts[first] = true
+
+		d := time.Duration(timer.sampled)
+		timer.scale(&d)
+		if d != n {
+			t.Errorf("scaled %d sampled documents to %d, want %d", timer.sampled, d, n)
+		}
+	}
+	// The first sampled document varies.
+	if len(firsts) < 2 {
+		t.Errorf("first sampled documents %v, want different ones", firsts)
+	}
+}
+
 func TestStartLineAnchor(t *testing.T) {
 	b := testIndexBuilder(t, nil,
 		Document{
@@ -1660,7 +1764,7 @@ func TestSymbolBoundaryStart(t *testing.T) {
 		},
 	)
 	q := &query.Symbol{
-		Atom: &query.Substring{Pattern: "start"},
+		Expr: &query.Substring{Pattern: "start"},
 	}
 	res := searchForTest(t, b, q)
 	if len(res.Files) != 1 || len(res.Files[0].LineMatches) != 1 {
@@ -1684,7 +1788,7 @@ func TestSymbolBoundaryEnd(t *testing.T) {
 		},
 	)
 	q := &query.Symbol{
-		Atom: &query.Substring{Pattern: "end"},
+		Expr: &query.Substring{Pattern: "end"},
 	}
 	res := searchForTest(t, b, q)
 	if len(res.Files) != 1 || len(res.Files[0].LineMatches) != 1 {
@@ -1708,7 +1812,7 @@ func TestSymbolAtom(t *testing.T) {
 		},
 	)
 	q := &query.Symbol{
-		Atom: &query.Substring{Pattern: "bla"},
+		Expr: &query.Substring{Pattern: "bla"},
 	}
 	res := searchForTest(t, b, q)
 	if len(res.Files) != 1 || len(res.Files[0].LineMatches) != 1 {
@@ -1732,7 +1836,7 @@ func TestSymbolAtomExact(t *testing.T) {
 		},
 	)
 	q := &query.Symbol{
-		Atom: &query.Substring{Pattern: "sym"},
+		Expr: &query.Substring{Pattern: "sym"},
 	}
 	res := searchForTest(t, b, q)
 	if len(res.Files) != 1 || len(res.Files[0].LineMatches) != 1 {
@@ -1744,6 +1848,258 @@ func TestSymbolAtomExact(t *testing.T) {
 	}
 }
 
+func TestSymbolIndex(t *testing.T) {
+	// Lots of uses, a few definitions.
+	uses := strings.Repeat("needle() haystack\n", 100)
+	b := testIndexBuilder(t, &Repository{Name: "reponame"},
+		Document{
+			Name:    "f1",
+			Content: []byte("func needleFunc()\n" + uses),
+			Symbols: []DocumentSection{{5, 15}},
+		},
+		Document{Name: "f2", Content: []byte(uses)},
+		Document{
+			Name:    "f3",
+			Content: []byte(uses + "type NeedleNeedle\nvar héllo"),
+			Symbols: []DocumentSection{
+				{uint32(len(uses)) + 5, uint32(len(uses)) + 17},
+				{uint32(len(uses)) + 22, uint32(len(uses)) + 28},
+			},
+		},
+	)
+
+	for _, tc := range []struct {
+		pattern       string
+		caseSensitive bool
+		want          []string
+		fragments     int
+	}{
+		{"needle", false, []string{"f1", "f3"}, 2},
+		{"Needle", true, []string{"f3"}, 1},
+		{"dleFu", true, []string{"f1"}, 1},
+		{"HÉLL", false, []string{"f3"}, 1},
+		{"haystack", false, nil, 0},
+	} {
+		q := &query.Symbol{
+			Expr: &query.Substring{Pattern: tc.pattern, CaseSensitive: tc.caseSensitive},
+		}
+		res := searchForTest(t, b, q)
+
+		var got []string
+		fragments := 0
+		for _, f := range res.Files {
+			got = append(got, f.FileName)
+			for _, l := range f.LineMatches {
+				fragments += len(l.LineFragments)
+			}
+		}
+		sort.Strings(got)
+		if !reflect.DeepEqual(got, tc.want) {
+			t.Errorf("%s: got files %v, want %v", q, got, tc.want)
+		}
+		if fragments != tc.fragments {
+			t.Errorf("%s: got %d fragments, want %d", q, fragments, tc.fragments)
+		}
+		// Only definitions are considered, not the uses.
+		if res.Stats.NgramMatches > 2 {
+			t.Errorf("%s: got %d ngram matches, want at most 2", q, res.Stats.NgramMatches)
+		}
+	}
+}
+
+func TestSymbolRegexpAndShort(t *testing.T) {
+	uses := strings.Repeat("needle() haystack\n", 100)
+	b := testIndexBuilder(t, &Repository{Name: "reponame"},
+		Document{
+			Name:    "f1",
+			Content: []byte("func needleFunc()\n" + uses),
+			Symbols: []DocumentSection{{5, 15}},
+		},
+		Document{Name: "f2", Content: []byte(uses)},
+		Document{
+			Name:    "f3",
+			Content: []byte(uses + "type NeedleNeedle\nvar héllo"),
+			Symbols: []DocumentSection{
+				{uint32(len(uses)) + 5, uint32(len(uses)) + 17},
+				{uint32(len(uses)) + 22, uint32(len(uses)) + 28},
+			},
+		},
+	)
+
+	for _, tc := range []struct {
+		query string
+		want  []string
+	}{
+		// Regexps with a literal use the ngram index.
+		{"sym:^needle", []string{"f1", "f3"}},
+		{"sym:Needle$", []string{"f3"}},
+		{"sym:^needle$", nil},
+		// Others, and short patterns, scan the name table.
+		{"sym:^n.*c$", []string{"f1"}},
+		{"case:yes sym:^[a-z]+$", nil},
+		{"sym:ll", []string{"f3"}},
+		{"sym:Ne", []string{"f3"}},
+		// Two distinct names match.
+		{"sym:ee", []string{"f1", "f3"}},
+		{"sym:ha", nil},
+	} {
+		q, err := query.Parse(tc.query)
+		if err != nil {
+			t.Fatalf("Parse(%q): %v", tc.query, err)
+		}
+		res := searchForTest(t, b, q)
+
+		var got []string
+		for _, f := range res.Files {
+			got = append(got, f.FileName)
+			for _, l := range f.LineMatches {
+				if !strings.HasPrefix(string(l.Line), "func") && !strings.HasPrefix(string(l.Line), "type") && !strings.HasPrefix(string(l.Line), "var") {
+					t.Errorf("%s: match outside a symbol: %q", q, l.Line)
+				}
+			}
+		}
+		sort.Strings(got)
+		if !reflect.DeepEqual(got, tc.want) {
+			t.Errorf("%s: got files %v, want %v", q, got, tc.want)
+		}
+	}
+}
+
+func TestSymbolKind(t *testing.T) {
+	b := testIndexBuilder(t, &Repository{Name: "reponame"},
+		Document{
+			Name:    "f1",
+			Content: []byte("func needleFunc()\nvar needleVar\n"),
+			Symbols: []DocumentSection{{22, 31}, {5, 15}},
+			SymbolsMetaData: []*Symbol{
+				{Sym: "needleVar", Kind: "variable"},
+				{Sym: "needleFunc", Kind: "function", Parent: "main", ParentKind: "package"},
+			},
+		},
+		Document{
+			Name:    "f2",
+			Content: []byte("type Needle struct{}\n"),
+			Symbols: []DocumentSection{{5, 11}},
+			SymbolsMetaData: []*Symbol{
+				{Sym: "Needle", Kind: "struct"},
+			},
+		},
+		Document{
+			Name:    "f3",
+			Content: []byte("func needle()\n"),
+			Symbols: []DocumentSection{{5, 11}},
+		},
+	)
+
+	for _, tc := range []struct {
+		query string
+		want  []string
+	}{
+		{"kind:func", []string{"f1:needleFunc"}},
+		{"kind:Struct", []string{"f2:Needle"}},
+		{"sym:needle kind:var", []string{"f1:needle"}},
+		{"sym:^n kind:func", []string{"f1:n"}},
+		{"sym:needle kind:class", nil},
+		{"kind:label", nil},
+	} {
+		q, err := query.Parse(tc.query)
+		if err != nil {
+			t.Fatalf("Parse(%q): %v", tc.query, err)
+		}
+		res := searchForTest(t, b, q)
+
+		var got []string
+		for _, f := range res.Files {
+			for _, l := range f.LineMatches {
+				for _, fr := range l.LineFragments {
+					got = append(got, f.FileName+":"+string(l.Line[fr.LineOffset:fr.LineOffset+fr.MatchLength]))
+				}
+			}
+		}
+		sort.Strings(got)
+		if !reflect.DeepEqual(got, tc.want) {
+			t.Errorf("%s: got %v, want %v", q, got, tc.want)
+		}
+	}
+
+	res, err := searcherForTest(t, b).Search(context.Background(), &query.Substring{Pattern: "needle"}, &SearchOptions{})
+	if err != nil {
+		t.Fatalf("Search: %v", err)
+	}
+	var f1 *FileMatch
+	for i := range res.Files {
+		if res.Files[i].FileName == "f1" {
+			f1 = &res.Files[i]
+		}
+	}
+	if f1 == nil || len(f1.LineMatches) != 2 {
+		t.Fatalf("got %v, want 2 line matches in f1", f1)
+	}
+	// The function definition ranks above the variable.
+	fn := f1.LineMatches[0].LineFragments[0].SymbolInfo
+	want := &Symbol{Sym: "needleFunc", Kind: "function", Parent: "main", ParentKind: "package"}
+	if !reflect.DeepEqual(fn, want) {
+		t.Errorf("got symbol %+v, want %+v", fn, want)
+	}
+	if f1.LineMatches[0].Score <= f1.LineMatches[1].Score {
+		t.Errorf("got scores %v, %v; want the function first", f1.LineMatches[0].Score, f1.LineMatches[1].Score)
+	}
+}
+
+func TestNear(t *testing.T) {
+	filler := strings.Repeat("filler text\n", 20)
+	b := testIndexBuilder(t, nil,
+		Document{Name: "close", Content: []byte("needle and haystack\n")},
+		Document{Name: "reverse", Content: []byte("haystack, then needle\n")},
+		Document{Name: "far", Content: []byte("needle\n" + filler + "haystack\n")},
+		Document{Name: "lines", Content: []byte("needle\nfiller\nhaystack\n")},
+		Document{Name: "wide", Content: []byte("needle 世界世界世界 haystack\n")},
+		Document{Name: "mixed", Content: []byte("needle\n" + filler + "needle haystack\n")},
+	)
+
+	for _, tc := range []struct {
+		query string
+		want  []string
+	}{
+		{"needle near:5 haystack", []string{"close", "mixed"}},
+		{"needle near:10 haystack", []string{"close", "lines", "mixed", "reverse", "wide"}},
+		{"needle near:1000 haystack", []string{"close", "far", "lines", "mixed", "reverse", "wide"}},
+		{"needle near:0l haystack", []string{"close", "mixed", "reverse", "wide"}},
+		{"needle near:2l haystack", []string{"close", "lines", "mixed", "reverse", "wide"}},
+		{"hay near:0l needle", []string{"close", "mixed", "reverse", "wide"}},
+		{"needle near:5 nothere", nil},
+	} {
+		q, err := query.Parse(tc.query)
+		if err != nil {
+			t.Fatalf("Parse(%q): %v", tc.query, err)
+		}
+		res := searchForTest(t, b, q)
+
+		var got []string
+		for _, f := range res.Files {
+			got = append(got, f.FileName)
+			if f.FileName != "mixed" {
+				continue
+			}
+			// Only the matches near each other are kept.
+			for _, l := range f.LineMatches {
+				if l.LineNumber == 1 && !strings.Contains(tc.query, "1000") {
+					t.Errorf("%s: got match on line 1 of %q", q, f.FileName)
+				}
+			}
+		}
+		sort.Strings(got)
+		if !reflect.DeepEqual(got, tc.want) {
+			t.Errorf("%s: got %v, want %v", q, got, tc.want)
+		}
+	}
+
+	q, _ := query.Parse("needle near:2l haystack")
+	if s := searcherForTest(t, b).(*indexData).MatchTreeString(q); !strings.HasPrefix(s, "near2l[") {
+		t.Errorf("got match tree %s, want near2l[...]", s)
+	}
+}
+
 func TestHitIterTerminate(t *testing.T) {
 	// contrived input: trigram frequencies forces selecting abc +
 	// def for the distance iteration. There is no match, so this
@@ -1936,3 +2292,180 @@ func TestMultiLineRegex(t *testing.T) {
 		t.Errorf("got %v, want 1 result", res.Files)
 	}
 }
+
+func TestNumContextLines(t *testing.T) {
+	b := testIndexBuilder(t, nil,
+		Document{Name: "f1", Content: []byte("l1\nl2\nmatch a\nl4\nl5\nmatch b\nl7\nl8\nl9\n")},
+		Document{Name: "f2", Content: []byte("x\nmatch c")},
+	)
+
+	res := searchForTest(t, b, &query.Substring{Pattern: "match", Content: true},
+		SearchOptions{NumContextLines: 2})
+	if len(res.Files) != 2 {
+		t.Fatalf("got %v, want 2 files", res.Files)
+	}
+
+	type context struct {
+		before, after string
+	}
+	got := map[string]context{}
+	for _, f := range res.Files {
+		for _, m := range f.LineMatches {
+			got[string(m.Line)] = context{string(m.Before), string(m.After)}
+		}
+	}
+	want := map[string]context{
+		// "l4\nl5\n" is only returned once.
+		"match a": {"l1\nl2\n", "l4\nl5\n"},
+		"match b": {"", "l7\nl8\n"},
+		"match c": {"x\n", ""},
+	}
+	if !reflect.DeepEqual(got, want) {
+		t.Errorf("got %q, want %q", got, want)
+	}
+}
+
+func TestCountOnly(t *testing.T) {
+	b := testIndexBuilder(t, &Repository{Name: "reponame"},
+		Document{Name: "a.go", Content: []byte("needle needle\nneedle"), Language: "Go"},
+		Document{Name: "b.go", Content: []byte("needle"), Language: "Go"},
+		Document{Name: "README", Content: []byte("haystack needle")},
+		Document{Name: "c.go", Content: []byte("haystack"), Language: "Go"},
+	)
+
+	res := searchForTest(t, b, &query.Substring{Pattern: "needle"}, SearchOptions{CountOnly: true})
+	if len(res.Files) != 0 {
+		t.Errorf("got files %v, want none", res.Files)
+	}
+	if res.FileCount != 3 || res.MatchCount != 5 {
+		t.Errorf("got FileCount %d, MatchCount %d, want 3, 5", res.FileCount, res.MatchCount)
+	}
+
+	want := &Facets{
+		Repository: map[string]FacetCount{"reponame": {3, 5}},
+		Language:   map[string]FacetCount{"Go": {2, 4}, "": {1, 1}},
+		Extension:  map[string]FacetCount{".go": {2, 4}, "": {1, 1}},
+	}
+	if !reflect.DeepEqual(res.Facets, want) {
+		t.Errorf("got facets %+v, want %+v", res.Facets, want)
+	}
+}
+
+// mustParseQueryRE parses s like the query parser does.
+func mustParseQueryRE(s string) *syntax.Regexp {
+	r, err := syntax.Parse(s, syntax.ClassNL|syntax.PerlX|syntax.UnicodeGroups)
+	if err != nil {
+		panic(err)
+	}
+	return r
+}
+
+func TestRegexpChunks(t *testing.T) {
+	line := "xx foo9 bar\n"
+	lines := 3 * regexpChunkSize / len(line)
+	content := []byte(strings.Repeat(line, lines))
+	b := testIndexBuilder(t, nil, Document{Name: "big", Content: content})
+
+	for re, want := range map[string]int{
+		"fo+9":    lines,
+		"r$":      lines,
+		"^x":      lines,
+		`\Axx fo`: 1,
+		`r\nxx`:   lines - 1,
+	} {
+		res := searchForTest(t, b, &query.Regexp{Regexp: mustParseQueryRE(re), CaseSensitive: true},
+			SearchOptions{CountOnly: true})
+		if res.MatchCount != want {
+			t.Errorf("%q: got %d matches, want %d", re, res.MatchCount, want)
+		}
+	}
+}
+
+func TestLineLocal(t *testing.T) {
+	for re, want := range map[string]bool{
+		"foo":    true,
+		"fo+.*x": true,
+		"^a$":    true,
+		`[^a]`:   false,
+		`a\nb`:   false,
+		`\Aa`:    false,
+		`(?s)a.`: false,
+	} {
+		if got := lineLocal(mustParseQueryRE(re)); got != want {
+			t.Errorf("lineLocal(%q) = %v, want %v", re, got, want)
+		}
+	}
+}
+
+func TestCancelWithinDocument(t *testing.T) {
+	line := "xx foo9 bar\n"
+	lines := 3 * regexpChunkSize / len(line)
+	b := testIndexBuilder(t, nil,
+		Document{Name: "big", Content: []byte(strings.Repeat(line, lines))})
+	d := searcherForTest(t, b).(*indexData)
+
+	ctx, cancel := context.WithCancel(context.Background())
+	cancel()
+	res, err := d.Search(ctx, &query.Substring{Pattern: "foo"}, &SearchOptions{})
+	if err != nil {
+		t.Fatalf("Search: %v", err)
+	}
+	if !res.Stats.Truncated || res.Stats.ShardsSkipped != 1 {
+		t.Errorf("got stats %+v, want a truncated, skipped shard", res.Stats)
+	}
+
+	mt, err := d.newMatchTree(&query.Regexp{Regexp: mustParseRE("fo+9"), CaseSensitive: true})
+	if err != nil {
+		t.Fatalf("newMatchTree: %v", err)
+	}
+	cp := &contentProvider{id: d, stats: &Stats{}, done: ctx.Done()}
+	mt.prepare(0)
+	cp.setDocument(0)
+	known := map[matchTree]bool{}
+	for cost := costMin; cost <= costMax; cost++ {
+		mt.matches(cp, cost, known)
+	}
+	cands := gatherMatches(mt, known)
+	if !cp.truncated {
+		t.Errorf("regexp scan was not truncated")
+	}
+	if len(cands) == 0 || len(cands) >= lines {
+		t.Fatalf("got %d matches, want those of the first chunk", len(cands))
+	}
+
+	if got := cp.fillMatches(cands, 0); len(got) != cancelCheckInterval-1 {
+		t.Errorf("filled %d lines, want %d", len(got), cancelCheckInterval-1)
+	}
+}
+
+func TestMaxMemoryBytes(t *testing.T) {
+	var docs []Document
+	for i := 0; i < 100; i++ {
+		docs = append(docs, Document{
+			Name:    fmt.Sprintf("f%d", i),
+			Content: []byte(strings.Repeat("needle in a haystack\n", 10)),
+		})
+	}
+	b := testIndexBuilder(t, nil, docs...)
+	q := &query.Substring{Pattern: "needle"}
+
+	res := searchForTest(t, b, q)
+	if res.MemoryBudgetExceeded || len(res.Files) != len(docs) {
+		t.Fatalf("got %d files, exceeded %v, want all files", len(res.Files), res.MemoryBudgetExceeded)
+	}
+	perFile := res.MemoryBytes / int64(len(docs))
+	if perFile < 10*int64(len("needle in a haystack")) {
+		t.Errorf("accounted %d bytes per file, want at least its lines", perFile)
+	}
+
+	res = searchForTest(t, b, q, SearchOptions{MaxMemoryBytes: 10 * perFile})
+	if !res.MemoryBudgetExceeded {
+		t.Errorf("budget not exceeded")
+	}
+	if len(res.Files) == 0 || len(res.Files) > 10 {
+		t.Errorf("got %d files, want at most 10", len(res.Files))
+	}
+	if res.FilesSkipped == 0 {
+		t.Errorf("got no skipped files")
+	}
+}
@@ -32,6 +32,10 @@ const ngramSize = 3
 
 type searchableString struct {
 	data []byte
+
+	// plainASCII is set if rune offsets in data equal byte
+	// offsets.
+	plainASCII bool
 }
 
 // Filled by the linker (see build-deploy.sh)
@@ -40,6 +44,13 @@ var Version string
 // Store character (unicode codepoint) offset (in bytes) this often.
 const runeOffsetFrequency = 100
 
+// Flags of the asciiFlags section, which mark documents whose rune
+// offsets equal their byte offsets.
+const (
+	docContentASCII = 1 << iota
+	docNameASCII
+)
+
 type postingsBuilder struct {
 	postings    map[ngram][]byte
 	lastOffsets map[ngram]uint32
@@ -70,7 +81,8 @@ func newPostingsBuilder() *postingsBuilder {
 // data.
 func (s *postingsBuilder) newSearchableString(data []byte, byteSections []DocumentSection) (*searchableString, []DocumentSection, error) {
 	dest := searchableString{
-		data: data,
+		data:       data,
+		plainASCII: true,
 	}
 	var buf [8]byte
 	var runeGram [3]rune
@@ -90,6 +102,7 @@ func (s *postingsBuilder) newSearchableString(data []byte, byteSections []Docume
 		c, sz := utf8.DecodeRune(data)
 		if sz > 1 {
 			s.isPlainASCII = false
+			dest.plainASCII = false
 		}
 		data = data[sz:]
 
@@ -159,6 +172,7 @@ type IndexBuilder struct {
 
 	contentPostings *postingsBuilder
 	namePostings    *postingsBuilder
+	symbols         *symbolIndexBuilder
 
 	// root repository
 	repo Repository
@@ -171,6 +185,9 @@ type IndexBuilder struct {
 
 	// languages codes
 	languages []byte
+
+	// per document, docContentASCII and docNameASCII flags
+	asciiFlags []byte
 }
 
 func (d *Repository) verify() error {
@@ -195,6 +212,7 @@ func NewIndexBuilder(r *Repository) (*IndexBuilder, error) {
 	b := &IndexBuilder{
 		contentPostings: newPostingsBuilder(),
 		namePostings:    newPostingsBuilder(),
+		symbols:         newSymbolIndexBuilder(),
 		languageMap:     map[string]byte{},
 	}
 
@@ -245,6 +263,14 @@ type DocumentSection struct {
 	Start, End uint32
 }
 
+// Symbol holds the ctags metadata of a symbol definition.
+type Symbol struct {
+	Sym        string
+	Kind       string
+	Parent     string
+	ParentKind string
+}
+
 // Document holds a document (file) to index.
 type Document struct {
 	Name              string
@@ -259,6 +285,9 @@ type Document struct {
 
 	// Document sections for symbols. Offsets should use bytes.
 	Symbols []DocumentSection
+
+	// If set, the metadata of the Symbols, in the same order.
+	SymbolsMetaData []*Symbol
 }
 
 type docSectionSlice []DocumentSection
@@ -267,6 +296,19 @@ func (m docSectionSlice) Len() int           { return len(m) }
 func (m docSectionSlice) Swap(i, j int)      { m[i], m[j] = m[j], m[i] }
 func (m docSectionSlice) Less(i, j int) bool { return m[i].Start < m[j].Start }
 
+// symbolSlice sorts symbol sections along with their metadata.
+type symbolSlice struct {
+	secs []DocumentSection
+	meta []*Symbol
+}
+
+func (m symbolSlice) Len() int           { return len(m.secs) }
+func (m symbolSlice) Less(i, j int) bool { return m.secs[i].Start < m.secs[j].Start }
+func (m symbolSlice) Swap(i, j int) {
+	m.secs[i], m.secs[j] = m.secs[j], m.secs[i]
+	m.meta[i], m.meta[j] = m.meta[j], m.meta[i]
+}
+
 // AddFile is a convenience wrapper for Add
 func (b *IndexBuilder) AddFile(name string, content []byte) error {
 	return b.Add(Document{Name: name, Content: content})
@@ -339,12 +381,20 @@ func (b *IndexBuilder) Add(doc Document) error {
 	if doc.SkipReason != "" {
 		doc.Content = []byte(notIndexedMarker + doc.SkipReason)
 		doc.Symbols = nil
+		doc.SymbolsMetaData = nil
 		if doc.Language == "" {
 			doc.Language = "skipped"
 		}
 	}
 
-	sort.Sort(docSectionSlice(doc.Symbols))
+	if doc.SymbolsMetaData != nil {
+		if len(doc.SymbolsMetaData) != len(doc.Symbols) {
+			return fmt.Errorf("got %d symbol metadata entries for %d symbols", len(doc.SymbolsMetaData), len(doc.Symbols))
+		}
+		sort.Sort(symbolSlice{doc.Symbols, doc.SymbolsMetaData})
+	} else {
+		sort.Sort(docSectionSlice(doc.Symbols))
+	}
 	var last DocumentSection
 	for i, s := range doc.Symbols {
 		if i > 0 {
@@ -392,6 +442,13 @@ func (b *IndexBuilder) Add(doc Document) error {
 	hasher.Write(doc.Content)
 
 	b.contentStrings = append(b.contentStrings, docStr)
+	for i, sec := range doc.Symbols {
+		var meta *Symbol
+		if doc.SymbolsMetaData != nil {
+			meta = doc.SymbolsMetaData[i]
+		}
+		b.symbols.add(uint32(len(b.runeDocSections)+i), doc.Content[sec.Start:sec.End], meta)
+	}
 	b.runeDocSections = append(b.runeDocSections, runeSecs...)
 
 	b.nameStrings = append(b.nameStrings, nameStr)
@@ -409,6 +466,15 @@ func (b *IndexBuilder) Add(doc Document) error {
 	}
 	b.languages = append(b.languages, langCode)
 
+	var flags byte
+	if docStr.plainASCII {
+		flags |= docContentASCII
+	}
+	if nameStr.plainASCII {
+		flags |= docNameASCII
+	}
+	b.asciiFlags = append(b.asciiFlags, flags)
+
 	return nil
 }
 
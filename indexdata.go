@@ -38,6 +38,29 @@ type indexData struct {
 
 	runeDocSections []DocumentSection
 
+	// symbol name ngram => postings of symbol IDs, which index
+	// runeDocSections.
+	symbolNgrams map[ngram]simpleSection
+
+	// distinct symbol names, sorted, and the postings of the
+	// symbols carrying each name.
+	symbolNames        []byte
+	symbolNameIndex    []uint32
+	symbolNameIDsStart uint32
+	symbolNameIDsIndex []uint32
+
+	// symbol kinds, indexed by kind ID, and the scopes blob.
+	symbolKinds       []string
+	symbolScopes      []byte
+	symbolScopesIndex []uint32
+
+	// per symbol ID, the kind, parent kind and scope IDs.
+	symbolMeta []byte
+
+	// postings of the symbols of each kind.
+	symbolKindPostingsStart uint32
+	symbolKindPostingsIndex []uint32
+
 	// rune offset=>byte offset mapping, relative to the start of the content corpus
 	runeOffsets []uint32
 
@@ -78,10 +101,80 @@ type indexData struct {
 	// languages for all the files.
 	languages []byte
 
+	// docContentASCII and docNameASCII flags for all the files.
+	asciiFlags []byte
+
 	// inverse of LanguageMap in metaData
 	languageMap map[byte]string
 
 	repoListEntry RepoListEntry
+
+	// The sections of the file, grouped by data kind.
+	regions []indexRegion
+}
+
+// residencyReporter is implemented by index files that can tell
+// which parts of them are in memory.
+type residencyReporter interface {
+	residentBytes(off, sz uint32) (uint32, error)
+}
+
+// accessPattern describes how a range of the index file is read.
+type accessPattern int
+
+const (
+	accessRandom accessPattern = iota
+	accessSequential
+	accessWillNeed
+)
+
+// accessAdvisor is implemented by index files that can pass access
+// hints on to the kernel.
+type accessAdvisor interface {
+	advise(off, sz uint32, p accessPattern)
+}
+
+// minPrefetchSize is the smallest range that we prefetch. For smaller
+// ranges, faulting in a page or two costs less than the extra system
+// call when the data is already in memory.
+const minPrefetchSize = 16 << 10
+
+func (d *indexData) advise(sec simpleSection, p accessPattern) {
+	if a, ok := d.file.(accessAdvisor); ok {
+		a.advise(sec.off, sec.sz, p)
+	}
+}
+
+// prefetch asks for sec to be read in the background, as it is about
+// to be used.
+func (d *indexData) prefetch(sec simpleSection) {
+	if sec.sz >= minPrefetchSize {
+		d.advise(sec, accessWillNeed)
+	}
+}
+
+// Residency reports how much of each kind of index data is in the page
+// cache.
+func (d *indexData) Residency() ([]SectionResidency, error) {
+	rr, ok := d.file.(residencyReporter)
+	if !ok {
+		return nil, fmt.Errorf("%s: residency not supported", d.file.Name())
+	}
+
+	res := make([]SectionResidency, 0, len(d.regions))
+	for _, r := range d.regions {
+		sr := SectionResidency{Section: r.name}
+		for _, s := range r.sections {
+			n, err := rr.residentBytes(s.off, s.sz)
+			if err != nil {
+				return nil, err
+			}
+			sr.Bytes += int64(s.sz)
+			sr.Resident += int64(n)
+		}
+		res = append(res, sr)
+	}
+	return res, nil
 }
 
 func (d *indexData) getChecksum(idx uint32) []byte {
@@ -124,12 +217,14 @@ func (d *indexData) memoryUse() int {
 		d.boundaries, d.fileNameIndex,
 		d.runeOffsets, d.fileNameRuneOffsets,
 		d.fileEndRunes, d.fileNameEndRunes,
+		d.symbolNameIndex, d.symbolNameIDsIndex,
+		d.symbolScopesIndex, d.symbolKindPostingsIndex,
 	} {
 		sz += 4 * len(a)
 	}
 	sz += 8 * len(d.runeDocSections)
 	sz += 8 * len(d.fileBranchMasks)
-	sz += 12 * len(d.ngrams)
+	sz += 12 * (len(d.ngrams) + len(d.symbolNgrams))
 	for _, v := range d.fileNameNgrams {
 		sz += 4*len(v) + 4
 	}
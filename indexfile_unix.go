@@ -20,6 +20,7 @@ import (
 	"fmt"
 	"os"
 	"syscall"
+	"unsafe"
 )
 
 type mmapedIndexFile struct {
@@ -29,7 +30,7 @@ type mmapedIndexFile struct {
 }
 
 func (f *mmapedIndexFile) Read(off, sz uint32) ([]byte, error) {
-	if off+sz > uint32(len(f.data)) {
+	if uint64(off)+uint64(sz) > uint64(len(f.data)) {
 		return nil, fmt.Errorf("out of bounds: %d, len %d", off+sz, len(f.data))
 	}
 	return f.data[off : off+sz], nil
@@ -43,6 +44,69 @@ func (f *mmapedIndexFile) Size() (uint32, error) {
 	return f.size, nil
 }
 
+// advise passes an access hint for [off, off+sz) to madvise(2).
+// Errors are ignored, as the hint is not needed for correctness.
+func (f *mmapedIndexFile) advise(off, sz uint32, p accessPattern) {
+	if sz == 0 || uint64(off)+uint64(sz) > uint64(len(f.data)) {
+		return
+	}
+
+	var advice uintptr
+	switch p {
+	case accessRandom:
+		advice = syscall.MADV_RANDOM
+	case accessSequential:
+		advice = syscall.MADV_SEQUENTIAL
+	case accessWillNeed:
+		advice = syscall.MADV_WILLNEED
+	default:
+		return
+	}
+
+	start := off &^ uint32(os.Getpagesize()-1)
+	syscall.Syscall(syscall.SYS_MADVISE,
+		uintptr(unsafe.Pointer(&f.data[start])), uintptr(off+sz-start), advice)
+}
+
+// residentBytes returns how many bytes of [off, off+sz) are in the
+// page cache, according to mincore(2).
+func (f *mmapedIndexFile) residentBytes(off, sz uint32) (uint32, error) {
+	if sz == 0 {
+		return 0, nil
+	}
+	if uint64(off)+uint64(sz) > uint64(len(f.data)) {
+		return 0, fmt.Errorf("out of bounds: %d, len %d", off+sz, len(f.data))
+	}
+
+	pageSize := uint32(os.Getpagesize())
+	start := off &^ (pageSize - 1)
+	end := off + sz
+	vec := make([]byte, (end-start+pageSize-1)/pageSize)
+	_, _, errno := syscall.Syscall(syscall.SYS_MINCORE,
+		uintptr(unsafe.Pointer(&f.data[start])), uintptr(end-start),
+		uintptr(unsafe.Pointer(&vec[0])))
+	if errno != 0 {
+		return 0, errno
+	}
+
+	var n uint32
+	for i, v := range vec {
+		if v&1 == 0 {
+			continue
+		}
+		pageStart := start + uint32(i)*pageSize
+		pageEnd := pageStart + pageSize
+		if pageStart < off {
+			pageStart = off
+		}
+		if pageEnd > end {
+			pageEnd = end
+		}
+		n += pageEnd - pageStart
+	}
+	return n, nil
+}
+
 func (f *mmapedIndexFile) Close() {
 	syscall.Munmap(f.data)
 }
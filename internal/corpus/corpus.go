@@ -0,0 +1,253 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Package corpus generates deterministic synthetic source trees for
+// benchmarks.
+package corpus
+
+import (
+	"bytes"
+	"fmt"
+	"math"
+	"math/rand"
+	"sort"
+	"strings"
+
+	"github.com/google/zoekt"
+)
+
+// Options configures the generated corpus.
+type Options struct {
+	// Seed for the random generator; the same options always
+	// produce the same corpus.
+	Seed int64
+
+	// Number of files.
+	Files int
+
+	// Languages maps language names (Go, Java, Python or C) to
+	// their relative frequency.
+	Languages map[string]int
+
+	// File sizes follow a log-normal distribution with this mean,
+	// capped at MaxFileSize bytes.
+	MeanFileSize int
+	MaxFileSize  int
+
+	// Number of distinct identifiers. Their use follows a Zipf
+	// distribution, so a few are very common.
+	Vocabulary int
+
+	// Fraction of identifiers that contain non-ASCII letters.
+	NonASCII float64
+
+	// Branches to index. Every file is on the first branch, and on
+	// each other branch with probability 1/2.
+	Branches []string
+}
+
+// DefaultOptions returns options for a corpus of about 10 MB.
+func DefaultOptions() Options {
+	return Options{
+		Seed:         1,
+		Files:        2000,
+		Languages:    map[string]int{"Go": 4, "Java": 3, "Python": 2, "C": 1},
+		MeanFileSize: 5000,
+		MaxFileSize:  200000,
+		Vocabulary:   20000,
+		NonASCII:     0.02,
+		Branches:     []string{"main", "dev"},
+	}
+}
+
+// Repository returns the repository to index the corpus in.
+func (o *Options) Repository(name string) *zoekt.Repository {
+	repo := &zoekt.Repository{Name: name}
+	for _, b := range o.Branches {
+		repo.Branches = append(repo.Branches, zoekt.RepositoryBranch{Name: b, Version: "v1"})
+	}
+	return repo
+}
+
+// Corpus is a generated set of documents.
+type Corpus struct {
+	Docs []zoekt.Document
+
+	// Words is the identifier vocabulary, most frequent first.
+	Words []string
+}
+
+type language struct {
+	ext string
+
+	// decl formats a declaration of an identifier. The
+	// identifier is indexed as a symbol.
+	decl string
+
+	// stmts format statements using one or two identifiers.
+	stmts []string
+	end   string
+}
+
+// languages holds the languages that the generator knows.
+var languages = map[string]language{
+	"Go": {
+		ext:  ".go",
+		decl: "func %s(ctx context.Context) error {\n",
+		stmts: []string{
+			"\t%s := %s()\n",
+			"\tif err := %s.Close(); err != nil {\n\t\treturn %s\n\t}\n",
+			"\t// TODO: handle %s in %s\n",
+		},
+		end: "}\n\n",
+	},
+	"Java": {
+		ext:  ".java",
+		decl: "  public void %s() throws Exception {\n",
+		stmts: []string{
+			"    %s = new %s();\n",
+			"    if (%s == null) { throw new IllegalStateException(\"%s\"); }\n",
+			"    // %s depends on %s\n",
+		},
+		end: "  }\n\n",
+	},
+	"Python": {
+		ext:  ".py",
+		decl: "def %s(self):\n",
+		stmts: []string{
+			"    %s = %s()\n",
+			"    if not %s:\n        raise ValueError('%s')\n",
+			"    # %s is used by %s\n",
+		},
+		end: "\n",
+	},
+	"C": {
+		ext:  ".c",
+		decl: "int %s(void) {\n",
+		stmts: []string{
+			"  int %s = %s();\n",
+			"  if (%s < 0) return %s;\n",
+			"  /* %s before %s */\n",
+		},
+		end: "}\n\n",
+	},
+}
+
+var syllables = []string{
+	"ba", "co", "de", "fi", "gu", "ha", "ki", "lo", "me", "nu",
+	"pa", "qui", "ro", "sa", "te", "vi", "wo", "xe", "yo", "zu",
+	"ar", "en", "in", "or", "us",
+}
+
+var nonASCII = []string{"é", "ü", "ß", "ж", "λ", "名", "ø", "ñ"}
+
+func newWord(r *rand.Rand, nonASCIIRatio float64) string {
+	var b strings.Builder
+	for i, n := 0, 2+r.Intn(3); i < n; i++ {
+		s := syllables[r.Intn(len(syllables))]
+		if i > 0 && r.Intn(2) == 0 {
+			s = strings.ToUpper(s[:1]) + s[1:]
+		}
+		b.WriteString(s)
+	}
+	if r.Float64() < nonASCIIRatio {
+		b.WriteString(nonASCII[r.Intn(len(nonASCII))])
+	}
+	return b.String()
+}
+
+// Generate returns the corpus described by opts.
+func Generate(opts Options) *Corpus {
+	r := rand.New(rand.NewSource(opts.Seed))
+
+	seen := map[string]bool{}
+	words := make([]string, 0, opts.Vocabulary)
+	for len(words) < opts.Vocabulary {
+		w := newWord(r, opts.NonASCII)
+		if !seen[w] {
+			seen[w] = true
+			words = append(words, w)
+		}
+	}
+	zipf := rand.NewZipf(r, 1.1, 1, uint64(len(words)-1))
+	word := func() string { return words[zipf.Uint64()] }
+
+	var langs []string
+	total := 0
+	for l, w := range opts.Languages {
+		if _, ok := languages[l]; !ok {
+			panic(fmt.Sprintf("unknown language %q", l))
+		}
+		langs = append(langs, l)
+		total += w
+	}
+	// Map iteration is random; keep the output deterministic.
+	sort.Strings(langs)
+	pickLang := func() string {
+		n := r.Intn(total)
+		for _, l := range langs {
+			if n -= opts.Languages[l]; n < 0 {
+				return l
+			}
+		}
+		return langs[len(langs)-1]
+	}
+
+	// Log-normal with the requested mean: mean = exp(mu + sigma^2/2).
+	const sigma = 1.0
+	mu := math.Log(float64(opts.MeanFileSize)) - sigma*sigma/2
+
+	c := &Corpus{Words: words}
+	for i := 0; i < opts.Files; i++ {
+		langName := pickLang()
+		lang := languages[langName]
+
+		size := int(math.Exp(r.NormFloat64()*sigma + mu))
+		if size > opts.MaxFileSize {
+			size = opts.MaxFileSize
+		}
+
+		var buf bytes.Buffer
+		var syms []zoekt.DocumentSection
+		for buf.Len() < size {
+			name := word()
+			prefix := lang.decl[:strings.Index(lang.decl, "%s")]
+			start := uint32(buf.Len() + len(prefix))
+			syms = append(syms, zoekt.DocumentSection{Start: start, End: start + uint32(len(name))})
+			fmt.Fprintf(&buf, lang.decl, name)
+
+			for j, n := 0, 1+r.Intn(8); j < n; j++ {
+				stmt := lang.stmts[r.Intn(len(lang.stmts))]
+				fmt.Fprintf(&buf, stmt, word(), word())
+			}
+			buf.WriteString(lang.end)
+		}
+
+		branches := []string{}
+		for j, b := range opts.Branches {
+			if j == 0 || r.Intn(2) == 0 {
+				branches = append(branches, b)
+			}
+		}
+
+		c.Docs = append(c.Docs, zoekt.Document{
+			Name:     fmt.Sprintf("%s/%s%d%s", word(), word(), i, lang.ext),
+			Content:  buf.Bytes(),
+			Language: langName,
+			Branches: branches,
+			Symbols:  syms,
+		})
+	}
+	return c
+}
@@ -0,0 +1,52 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package corpus
+
+import (
+	"reflect"
+	"testing"
+)
+
+func TestGenerate(t *testing.T) {
+	opts := DefaultOptions()
+	opts.Files = 50
+	a := Generate(opts)
+	b := Generate(opts)
+	if !reflect.DeepEqual(a, b) {
+		t.Fatal("corpus is not deterministic")
+	}
+
+	if len(a.Docs) != opts.Files {
+		t.Errorf("got %d files, want %d", len(a.Docs), opts.Files)
+	}
+	words := map[string]bool{}
+	for _, w := range a.Words {
+		words[w] = true
+	}
+	for _, d := range a.Docs {
+		if len(d.Content) > opts.MaxFileSize+1000 {
+			t.Errorf("%s: size %d exceeds maximum", d.Name, len(d.Content))
+		}
+		if len(d.Branches) == 0 || d.Branches[0] != opts.Branches[0] {
+			t.Errorf("%s: got branches %v", d.Name, d.Branches)
+		}
+		for _, s := range d.Symbols {
+			sym := string(d.Content[s.Start:s.End])
+			if !words[sym] {
+				t.Errorf("%s: symbol %q is not in the vocabulary", d.Name, sym)
+			}
+		}
+	}
+}
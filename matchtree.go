@@ -15,6 +15,7 @@
 package zoekt
 
 import (
+	"bytes"
 	"fmt"
 	"log"
 	"regexp"
@@ -108,6 +109,17 @@ type andLineMatchTree struct {
 	andMatchTree
 }
 
+// nearMatchTree matches if its two children, which are substrMatchTree
+// or regexpMatchTree, have matches at most distance runes apart, or
+// distance lines apart if lines is set. Matches that are not near a
+// match of the other child are dropped.
+type nearMatchTree struct {
+	andMatchTree
+
+	distance uint32
+	lines    bool
+}
+
 type andMatchTree struct {
 	children []matchTree
 }
@@ -125,11 +137,20 @@ type noVisitMatchTree struct {
 	matchTree
 }
 
+// regexpChunkSize is how many bytes of a large document a line local
+// regexp scans between checks for cancellation.
+const regexpChunkSize = 1 << 20
+
 type regexpMatchTree struct {
 	regexp *regexp.Regexp
 
 	fileName bool
 
+	// lineLocal is set if matches never span lines, so large files
+	// can be scanned a chunk of lines at a time, checking for
+	// cancellation in between.
+	lineLocal bool
+
 	// mutable
 	reEvaluated bool
 	found       []*candidateMatch
@@ -280,6 +301,14 @@ func (t *andMatchTree) String() string {
 	return fmt.Sprintf("and%v", t.children)
 }
 
+func (t *nearMatchTree) String() string {
+	unit := ""
+	if t.lines {
+		unit = "l"
+	}
+	return fmt.Sprintf("near%d%s%v", t.distance, unit, t.children)
+}
+
 func (t *regexpMatchTree) String() string {
 	return fmt.Sprintf("re(%s)", t.regexp)
 }
@@ -319,6 +348,8 @@ func visitMatchTree(t matchTree, f func(matchTree)) {
 		}
 	case *andLineMatchTree:
 		visitMatchTree(&s.andMatchTree, f)
+	case *nearMatchTree:
+		visitMatchTree(&s.andMatchTree, f)
 	case *noVisitMatchTree:
 		visitMatchTree(s.matchTree, f)
 	case *notMatchTree:
@@ -340,6 +371,8 @@ func visitMatches(t matchTree, known map[matchTree]bool, f func(matchTree)) {
 		}
 	case *andLineMatchTree:
 		visitMatches(&s.andMatchTree, known, f)
+	case *nearMatchTree:
+		visitMatches(&s.andMatchTree, known, f)
 	case *orMatchTree:
 		for _, ch := range s.children {
 			if known[ch] {
@@ -446,6 +479,105 @@ nextLine:
 	return false, true
 }
 
+// candidatesOf returns the candidate list of a child of a
+// nearMatchTree.
+func candidatesOf(t matchTree) *[]*candidateMatch {
+	switch s := t.(type) {
+	case *substrMatchTree:
+		return &s.current
+	case *regexpMatchTree:
+		return &s.found
+	}
+	return nil
+}
+
+func (t *nearMatchTree) matches(cp *contentProvider, cost int, known map[matchTree]bool) (bool, bool) {
+	matches, sure := t.andMatchTree.matches(cp, cost, known)
+	if !(sure && matches) {
+		return matches, sure
+	}
+
+	as, bs := candidatesOf(t.children[0]), candidatesOf(t.children[1])
+	if as == nil || bs == nil {
+		return false, true
+	}
+	a, b := *as, *bs
+
+	// pos returns the position of a match for comparing against
+	// the distance, and maxGap bounds the difference of the
+	// positions of matches that can be near each other.
+	var pos func(m *candidateMatch) (uint32, uint32)
+	var maxGap uint32
+	if t.lines {
+		nls := cp.newlines()
+		pos = func(m *candidateMatch) (uint32, uint32) {
+			line, _, _ := m.line(nls, cp.fileSize)
+			return uint32(line), uint32(line)
+		}
+		maxGap = t.distance
+	} else {
+		pos = func(m *candidateMatch) (uint32, uint32) {
+			return m.byteOffset, m.byteOffset + m.byteMatchSz
+		}
+		// A rune takes at most utf8.UTFMax bytes.
+		maxGap = t.distance * utf8.UTFMax
+	}
+
+	nearA := make([]bool, len(a))
+	nearB := make([]bool, len(b))
+	lo := 0
+	for i, ma := range a {
+		if i%cancelCheckInterval == cancelCheckInterval-1 && cp.canceled() {
+			break
+		}
+		aStart, aEnd := pos(ma)
+		for lo < len(b) {
+			_, bEnd := pos(b[lo])
+			if bEnd+maxGap >= aStart {
+				break
+			}
+			lo++
+		}
+		for j := lo; j < len(b); j++ {
+			bStart, bEnd := pos(b[j])
+			if bStart > aEnd+maxGap {
+				break
+			}
+			if t.lines || t.runeGap(cp, aStart, aEnd, bStart, bEnd) <= t.distance {
+				nearA[i] = true
+				nearB[j] = true
+			}
+		}
+	}
+
+	*as = pruneCandidates(a, nearA)
+	*bs = pruneCandidates(b, nearB)
+	return len(*as) > 0, true
+}
+
+// runeGap returns the number of runes between two byte ranges of the
+// document, or 0 if they overlap.
+func (t *nearMatchTree) runeGap(cp *contentProvider, aStart, aEnd, bStart, bEnd uint32) uint32 {
+	start, end := aEnd, bStart
+	if bStart < aStart {
+		start, end = bEnd, aStart
+	}
+	if end <= start {
+		return 0
+	}
+	return uint32(utf8.RuneCount(cp.data(false)[start:end]))
+}
+
+func pruneCandidates(ms []*candidateMatch, keep []bool) []*candidateMatch {
+	res := ms[:0]
+	for i, m := range ms {
+		if keep[i] {
+			res = append(res, m)
+		}
+	}
+	return res
+}
+
 func (t *andMatchTree) matches(cp *contentProvider, cost int, known map[matchTree]bool) (bool, bool) {
 	sure := true
 
@@ -493,16 +625,34 @@ func (t *regexpMatchTree) matches(cp *contentProvider, cost int, known map[match
 	}
 
 	cp.stats.RegexpsConsidered++
-	idxs := t.regexp.FindAllIndex(cp.data(t.fileName), -1)
+	data := cp.data(t.fileName)
 	found := t.found[:0]
-	for _, idx := range idxs {
-		cm := &candidateMatch{
-			byteOffset:  uint32(idx[0]),
-			byteMatchSz: uint32(idx[1] - idx[0]),
-			fileName:    t.fileName,
+	for start := 0; start < len(data); {
+		end := len(data)
+		if t.lineLocal && end-start > regexpChunkSize {
+			end = start + regexpChunkSize
+			if nl := bytes.IndexByte(data[end:], '\n'); nl >= 0 {
+				end += nl
+			} else {
+				end = len(data)
+			}
 		}
 
-		found = append(found, cm)
+		for _, idx := range t.regexp.FindAllIndex(data[start:end], -1) {
+			cm := &candidateMatch{
+				byteOffset:  uint32(start + idx[0]),
+				byteMatchSz: uint32(idx[1] - idx[0]),
+				fileName:    t.fileName,
+			}
+
+			found = append(found, cm)
+		}
+
+		// Skip the newline, which no match can contain.
+		start = end + 1
+		if start < len(data) && cp.canceled() {
+			break
+		}
 	}
 	t.found = found
 	t.reEvaluated = true
@@ -581,7 +731,10 @@ func (t *substrMatchTree) matches(cp *contentProvider, cost int, known map[match
 	}
 
 	pruned := t.current[:0]
-	for _, m := range t.current {
+	for i, m := range t.current {
+		if i%cancelCheckInterval == cancelCheckInterval-1 && cp.canceled() {
+			break
+		}
 		if m.byteOffset == 0 && m.runeOffset > 0 {
 			m.byteOffset = cp.findOffset(m.fileName, m.runeOffset)
 		}
@@ -622,8 +775,9 @@ func (d *indexData) newMatchTree(q query.Q) (matchTree, error) {
 		}
 
 		tr := &regexpMatchTree{
-			regexp:   regexp.MustCompile(prefix + s.Regexp.String()),
-			fileName: s.FileName,
+			regexp:    regexp.MustCompile(prefix + s.Regexp.String()),
+			fileName:  s.FileName,
+			lineLocal: lineLocal(s.Regexp),
 		}
 
 		return &andMatchTree{
@@ -695,21 +849,9 @@ func (d *indexData) newMatchTree(q query.Q) (matchTree, error) {
 		}, nil
 
 	case *query.Symbol:
-		mt, err := d.newSubstringMatchTree(s.Atom)
-		if err != nil {
-			return nil, err
-		}
-
-		if _, ok := mt.(*regexpMatchTree); ok {
-			return nil, fmt.Errorf("regexps and short queries not implemented for symbol search")
-		}
-		subMT, ok := mt.(*substrMatchTree)
-		if !ok {
-			return nil, fmt.Errorf("found %T inside query.Symbol", mt)
-		}
-
-		subMT.matchIterator = d.newTrimByDocSectionIter(s.Atom, subMT.matchIterator)
-		return subMT, nil
+		return d.newSymbolMatchTree(s)
+	case *query.Near:
+		return d.newNearMatchTree(s)
 	}
 	log.Panicf("type %T", q)
 	return nil, nil
@@ -728,8 +870,9 @@ func (d *indexData) newSubstringMatchTree(s *query.Substring) (matchTree, error)
 			prefix = "(?i)"
 		}
 		t := &regexpMatchTree{
-			regexp:   regexp.MustCompile(prefix + regexp.QuoteMeta(s.Pattern)),
-			fileName: s.FileName,
+			regexp:    regexp.MustCompile(prefix + regexp.QuoteMeta(s.Pattern)),
+			fileName:  s.FileName,
+			lineLocal: !strings.Contains(s.Pattern, "\n"),
 		}
 		return t, nil
 	}
@@ -741,3 +884,76 @@ func (d *indexData) newSubstringMatchTree(s *query.Substring) (matchTree, error)
 	st.matchIterator = result
 	return st, nil
 }
+
+func (d *indexData) newNearMatchTree(q *query.Near) (matchTree, error) {
+	if len(q.Children) != 2 {
+		return nil, fmt.Errorf("near: wants 2 operands, got %d", len(q.Children))
+	}
+	var subs [2]*query.Substring
+	for i, ch := range q.Children {
+		s, ok := ch.(*query.Substring)
+		if !ok || s.FileName {
+			return nil, fmt.Errorf("near: operands must be content substrings, got %s", ch)
+		}
+		subs[i] = s
+	}
+
+	t := &nearMatchTree{
+		distance: uint32(q.Distance),
+		lines:    q.Lines,
+	}
+	for i, s := range subs {
+		ct, err := d.newNearOperand(s, subs[1-i], q)
+		if err != nil {
+			return nil, err
+		}
+		t.children = append(t.children, ct)
+	}
+	return t, nil
+}
+
+// newNearOperand returns the match tree for s, an operand of q. For
+// a character distance, the ngram hits of s are merged with those of
+// the other operand, so only candidates that lie in a window around a
+// hit of the other operand are verified.
+func (d *indexData) newNearOperand(s, other *query.Substring, q *query.Near) (matchTree, error) {
+	mt, err := d.newSubstringMatchTree(s)
+	if err != nil {
+		return nil, err
+	}
+	st, ok := mt.(*substrMatchTree)
+	if !ok || q.Lines || utf8.RuneCountInString(other.Pattern) < ngramSize {
+		return mt, nil
+	}
+	iter, ok := st.matchIterator.(*ngramDocIterator)
+	if !ok {
+		return mt, nil
+	}
+
+	res, err := d.iterateNgrams(other)
+	if err != nil {
+		return nil, err
+	}
+	otherIter, ok := res.matchIterator.(*ngramDocIterator)
+	if !ok {
+		return &noMatchTree{"near"}, nil
+	}
+
+	// The hits are at the offset of an ngram within the patterns,
+	// so widen the window by the pattern length and the
+	// difference of the offsets.
+	maxLen := utf8.RuneCountInString(s.Pattern)
+	if l := utf8.RuneCountInString(other.Pattern); l > maxLen {
+		maxLen = l
+	}
+	padDiff := iter.leftPad - otherIter.leftPad
+	if otherIter.leftPad > iter.leftPad {
+		padDiff = otherIter.leftPad - iter.leftPad
+	}
+	iter.iter = &nearHitIterator{
+		i1:     iter.iter,
+		i2:     otherIter.iter,
+		window: uint32(q.Distance) + uint32(maxLen) + padDiff,
+	}
+	return st, nil
+}
@@ -0,0 +1,166 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package zoekt
+
+import (
+	"unicode"
+	"unicode/utf8"
+
+	"github.com/google/zoekt/query"
+)
+
+const (
+	// ngramFilterBits is the number of filter bits per ngram.
+	// With ngramFilterHashes probes, about 2.5% of the absent
+	// ngrams are reported as present.
+	ngramFilterBits   = 8
+	ngramFilterHashes = 4
+)
+
+// NgramFilter is a Bloom filter over the case folded content and file
+// name ngrams of a shard. It is much smaller than the shard, and tells
+// whether a query may match it without reading the index.
+type NgramFilter struct {
+	bits []uint64
+	mask uint64
+}
+
+func newNgramFilter(n int) *NgramFilter {
+	size := uint64(64)
+	for size < uint64(n)*ngramFilterBits {
+		size *= 2
+	}
+	return &NgramFilter{
+		bits: make([]uint64, size/64),
+		mask: size - 1,
+	}
+}
+
+// foldRune maps all runes that are equal under simple case folding to
+// the same rune.
+func foldRune(r rune) rune {
+	if r < utf8.RuneSelf {
+		if 'a' <= r && r <= 'z' {
+			r -= 'a' - 'A'
+		}
+		return r
+	}
+	min := r
+	for f := unicode.SimpleFold(r); f != r; f = unicode.SimpleFold(f) {
+		if f < min {
+			min = f
+		}
+	}
+	return min
+}
+
+func foldNgram(ng ngram) ngram {
+	rs := ngramToRunes(ng)
+	for i, r := range rs {
+		rs[i] = foldRune(r)
+	}
+	return runesToNGram(rs)
+}
+
+// probes returns the two hashes from which the filter positions of ng
+// are derived.
+func probes(ng ngram) (uint64, uint64) {
+	h := uint64(ng)
+	h ^= h >> 33
+	h *= 0xff51afd7ed558ccd
+	h ^= h >> 33
+	h *= 0xc4ceb9fe1a85ec53
+	h ^= h >> 33
+	return h, h>>32 | 1
+}
+
+func (f *NgramFilter) add(ng ngram) {
+	h1, h2 := probes(foldNgram(ng))
+	for i := uint64(0); i < ngramFilterHashes; i++ {
+		b := (h1 + i*h2) & f.mask
+		f.bits[b/64] |= 1 << (b % 64)
+	}
+}
+
+func (f *NgramFilter) has(ng ngram) bool {
+	h1, h2 := probes(foldNgram(ng))
+	for i := uint64(0); i < ngramFilterHashes; i++ {
+		b := (h1 + i*h2) & f.mask
+		if f.bits[b/64]&(1<<(b%64)) == 0 {
+			return false
+		}
+	}
+	return true
+}
+
+// SizeBytes returns the memory used by the filter.
+func (f *NgramFilter) SizeBytes() int64 {
+	return 8 * int64(len(f.bits))
+}
+
+// MayMatch returns false if q cannot match any document of the shard,
+// because it needs a substring that contains an ngram the shard does
+// not have. Regular expressions and the other atoms are assumed to
+// match.
+func (f *NgramFilter) MayMatch(q query.Q) bool {
+	switch q := q.(type) {
+	case *query.Const:
+		return q.Value
+	case *query.Substring:
+		for _, o := range splitNGrams([]byte(q.Pattern)) {
+			if !f.has(o.ngram) {
+				return false
+			}
+		}
+		return true
+	case *query.Symbol:
+		return q.Expr == nil || f.MayMatch(q.Expr)
+	case *query.And:
+		for _, ch := range q.Children {
+			if !f.MayMatch(ch) {
+				return false
+			}
+		}
+		return true
+	case *query.Near:
+		for _, ch := range q.Children {
+			if !f.MayMatch(ch) {
+				return false
+			}
+		}
+		return true
+	case *query.Or:
+		for _, ch := range q.Children {
+			if f.MayMatch(ch) {
+				return true
+			}
+		}
+		return false
+	}
+	return true
+}
+
+// NgramFilter returns a filter over the ngrams of the shard, for
+// deciding whether to load it again after it has been closed.
+func (d *indexData) NgramFilter() *NgramFilter {
+	f := newNgramFilter(len(d.ngrams) + len(d.fileNameNgrams))
+	for ng := range d.ngrams {
+		f.add(ng)
+	}
+	for ng := range d.fileNameNgrams {
+		f.add(ng)
+	}
+	return f
+}
@@ -0,0 +1,51 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package zoekt
+
+import (
+	"testing"
+
+	"github.com/google/zoekt/query"
+)
+
+func TestNgramFilter(t *testing.T) {
+	b := testIndexBuilder(t, nil,
+		Document{Name: "main.go", Content: []byte("func Hello() {}\n// Straße\n")})
+	f := searcherForTest(t, b).(*indexData).NgramFilter()
+
+	for _, tc := range []struct {
+		q    query.Q
+		want bool
+	}{
+		{&query.Substring{Pattern: "Hello"}, true},
+		{&query.Substring{Pattern: "hello"}, true},
+		{&query.Substring{Pattern: "HELLO", CaseSensitive: true}, true},
+		{&query.Substring{Pattern: "STRASSE"}, false},
+		{&query.Substring{Pattern: "STRAßE"}, true},
+		{&query.Substring{Pattern: "main.go", FileName: true}, true},
+		{&query.Substring{Pattern: "goodbye"}, false},
+		{&query.Substring{Pattern: "xy"}, true},
+		{query.NewAnd(&query.Substring{Pattern: "hello"}, &query.Substring{Pattern: "goodbye"}), false},
+		{query.NewOr(&query.Substring{Pattern: "hello"}, &query.Substring{Pattern: "goodbye"}), true},
+		{&query.Not{Child: &query.Substring{Pattern: "hello"}}, true},
+		{&query.Not{Child: &query.Substring{Pattern: "goodbye"}}, true},
+		{&query.Symbol{Expr: &query.Substring{Pattern: "goodbye"}}, false},
+		{&query.Regexp{}, true},
+	} {
+		if got := f.MayMatch(tc.q); got != tc.want {
+			t.Errorf("MayMatch(%s) = %v, want %v", tc.q, got, tc.want)
+		}
+	}
+}
@@ -0,0 +1,268 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Package placement assigns index shards to serving nodes.
+//
+// Shards are placed by rendezvous (highest random weight) hashing with
+// bounded loads: each shard goes to the nodes that rank it highest,
+// skipping nodes that are already full. Adding or removing a node
+// only moves the shards that rank it highest, plus a few that
+// overflow, so most shards stay where they are.
+package placement
+
+import (
+	"bufio"
+	"fmt"
+	"hash/fnv"
+	"io"
+	"math"
+	"sort"
+	"strings"
+)
+
+// Shard is an index shard to place.
+type Shard struct {
+	// Name identifies the shard, usually its file name.
+	Name string
+
+	// Bytes is the memory needed to serve the shard.
+	Bytes int64
+
+	// Load is the relative query load of the shard, in any unit.
+	Load float64
+}
+
+// Node is a serving node.
+type Node struct {
+	Name string
+
+	// Weight is the relative capacity of the node. If zero, it is
+	// 1.
+	Weight float64
+}
+
+// Options configures Place.
+type Options struct {
+	// Replicas is the number of nodes that serve each shard. If
+	// zero, it is 1.
+	Replicas int
+
+	// LoadWeight, between 0 and 1, is how much the query load
+	// counts for the cost of a shard, as opposed to its size.
+	LoadWeight float64
+
+	// Slack is how much a node may exceed its fair share of the
+	// total cost, eg. 0.1 for 10%. Less slack balances better, but
+	// moves more shards when nodes change. If zero, it is 0.1.
+	Slack float64
+}
+
+// Plan maps node names to the names of the shards they serve, in
+// sorted order.
+type Plan map[string][]string
+
+// Place assigns each shard to opts.Replicas distinct nodes.
+func Place(shards []Shard, nodes []Node, opts Options) (Plan, error) {
+	if opts.Replicas == 0 {
+		opts.Replicas = 1
+	}
+	if opts.Slack == 0 {
+		opts.Slack = 0.1
+	}
+	if opts.LoadWeight < 0 || opts.LoadWeight > 1 {
+		return nil, fmt.Errorf("LoadWeight %g not between 0 and 1", opts.LoadWeight)
+	}
+	if opts.Replicas > len(nodes) {
+		return nil, fmt.Errorf("%d replicas need at least as many nodes, got %d", opts.Replicas, len(nodes))
+	}
+
+	seen := map[string]bool{}
+	var totalWeight float64
+	for _, n := range nodes {
+		if seen[n.Name] {
+			return nil, fmt.Errorf("duplicate node %q", n.Name)
+		}
+		seen[n.Name] = true
+		totalWeight += nodeWeight(n)
+	}
+
+	costs := shardCosts(shards, opts.LoadWeight)
+	var totalCost float64
+	for _, c := range costs {
+		totalCost += c
+	}
+	totalCost *= float64(opts.Replicas)
+
+	capacity := make([]float64, len(nodes))
+	for i, n := range nodes {
+		capacity[i] = (1 + opts.Slack) * totalCost * nodeWeight(n) / totalWeight
+	}
+
+	// Placing big shards first packs better.
+	order := make([]int, len(shards))
+	for i := range order {
+		order[i] = i
+	}
+	sort.Slice(order, func(i, j int) bool {
+		a, b := order[i], order[j]
+		if costs[a] != costs[b] {
+			return costs[a] > costs[b]
+		}
+		return shards[a].Name < shards[b].Name
+	})
+
+	load := make([]float64, len(nodes))
+	plan := Plan{}
+	for _, n := range nodes {
+		plan[n.Name] = []string{}
+	}
+	for _, si := range order {
+		s, cost := shards[si], costs[si]
+		ranked := rankNodes(s.Name, nodes)
+
+		var chosen []int
+		taken := make([]bool, len(nodes))
+		for _, ni := range ranked {
+			if len(chosen) == opts.Replicas {
+				break
+			}
+			if load[ni]+cost <= capacity[ni] {
+				chosen = append(chosen, ni)
+				taken[ni] = true
+			}
+		}
+		// If the shard fits nowhere, use the least full nodes.
+		for len(chosen) < opts.Replicas {
+			best := -1
+			for ni := range nodes {
+				if !taken[ni] && (best < 0 || load[ni]/capacity[ni] < load[best]/capacity[best]) {
+					best = ni
+				}
+			}
+			chosen = append(chosen, best)
+			taken[best] = true
+		}
+
+		for _, ni := range chosen {
+			load[ni] += cost
+			plan[nodes[ni].Name] = append(plan[nodes[ni].Name], s.Name)
+		}
+	}
+
+	for _, names := range plan {
+		sort.Strings(names)
+	}
+	return plan, nil
+}
+
+func nodeWeight(n Node) float64 {
+	if n.Weight == 0 {
+		return 1
+	}
+	return n.Weight
+}
+
+// shardCosts blends the size and the query load of the shards,
+// scaling the load so both add up to the same total.
+func shardCosts(shards []Shard, loadWeight float64) []float64 {
+	var totalBytes, totalLoad float64
+	for _, s := range shards {
+		totalBytes += float64(s.Bytes)
+		totalLoad += s.Load
+	}
+
+	costs := make([]float64, len(shards))
+	for i, s := range shards {
+		c := (1 - loadWeight) * float64(s.Bytes)
+		if totalLoad > 0 {
+			c += loadWeight * s.Load * totalBytes / totalLoad
+		}
+		costs[i] = c
+	}
+	return costs
+}
+
+// rankNodes returns the node indices ordered by their weighted
+// rendezvous score for the shard.
+func rankNodes(shard string, nodes []Node) []int {
+	scores := make([]float64, len(nodes))
+	idx := make([]int, len(nodes))
+	for i, n := range nodes {
+		h := fnv.New64a()
+		io.WriteString(h, n.Name)
+		h.Write([]byte{0})
+		io.WriteString(h, shard)
+
+		// Map the hash to (0, 1), and weigh it as in "Weighted
+		// distributed hash tables" (Schindelhauer, Schomaker).
+		u := (float64(h.Sum64()>>11) + 0.5) / (1 << 53)
+		scores[i] = -nodeWeight(n) / math.Log(u)
+		idx[i] = i
+	}
+	sort.Slice(idx, func(i, j int) bool {
+		if scores[idx[i]] != scores[idx[j]] {
+			return scores[idx[i]] > scores[idx[j]]
+		}
+		return nodes[idx[i]].Name < nodes[idx[j]].Name
+	})
+	return idx
+}
+
+// Moves returns the number of shard copies that a node in plan to
+// does not have in plan from, ie. the copies to transfer.
+func Moves(from, to Plan) int {
+	n := 0
+	for node, shards := range to {
+		had := map[string]bool{}
+		for _, s := range from[node] {
+			had[s] = true
+		}
+		for _, s := range shards {
+			if !had[s] {
+				n++
+			}
+		}
+	}
+	return n
+}
+
+// manifestHeader starts every manifest, so that the manifest of a node
+// without shards is not empty.
+const manifestHeader = "# zoekt-placement"
+
+// WriteManifest writes the manifest of a node: a header comment, then
+// the shards it serves, one per line.
+func WriteManifest(w io.Writer, shards []string) error {
+	bw := bufio.NewWriter(w)
+	fmt.Fprintln(bw, manifestHeader)
+	for _, s := range shards {
+		fmt.Fprintln(bw, s)
+	}
+	return bw.Flush()
+}
+
+// ReadManifest reads a manifest written by WriteManifest. Empty lines
+// and lines starting with '#' are ignored.
+func ReadManifest(r io.Reader) (map[string]bool, error) {
+	shards := map[string]bool{}
+	scanner := bufio.NewScanner(r)
+	for scanner.Scan() {
+		line := strings.TrimSpace(scanner.Text())
+		if line == "" || strings.HasPrefix(line, "#") {
+			continue
+		}
+		shards[line] = true
+	}
+	return shards, scanner.Err()
+}
@@ -0,0 +1,192 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package placement
+
+import (
+	"bytes"
+	"fmt"
+	"math/rand"
+	"reflect"
+	"testing"
+)
+
+func testShards(n int) []Shard {
+	r := rand.New(rand.NewSource(1))
+	var shards []Shard
+	for i := 0; i < n; i++ {
+		shards = append(shards, Shard{
+			Name:  fmt.Sprintf("repo%d_v16.00000.zoekt", i),
+			Bytes: 1000 + r.Int63n(100000),
+			Load:  r.Float64(),
+		})
+	}
+	return shards
+}
+
+func testNodes(n int) []Node {
+	var nodes []Node
+	for i := 0; i < n; i++ {
+		nodes = append(nodes, Node{Name: fmt.Sprintf("node%d", i)})
+	}
+	return nodes
+}
+
+func TestPlaceReplicas(t *testing.T) {
+	shards := testShards(500)
+	plan, err := Place(shards, testNodes(5), Options{Replicas: 3})
+	if err != nil {
+		t.Fatalf("Place: %v", err)
+	}
+
+	copies := map[string]int{}
+	for _, names := range plan {
+		for _, s := range names {
+			copies[s]++
+		}
+	}
+	for _, s := range shards {
+		if copies[s.Name] != 3 {
+			t.Errorf("shard %s has %d copies, want 3", s.Name, copies[s.Name])
+		}
+	}
+
+	if _, err := Place(shards, testNodes(2), Options{Replicas: 3}); err == nil {
+		t.Errorf("Place with more replicas than nodes succeeded")
+	}
+}
+
+func TestPlaceBalance(t *testing.T) {
+	shards := testShards(1000)
+	nodes := testNodes(10)
+	nodes[0].Weight = 2
+
+	const slack = 0.1
+	plan, err := Place(shards, nodes, Options{Replicas: 2, Slack: slack})
+	if err != nil {
+		t.Fatalf("Place: %v", err)
+	}
+
+	size := map[string]int64{}
+	var total, largest int64
+	for _, s := range shards {
+		size[s.Name] = s.Bytes
+		total += s.Bytes
+		if s.Bytes > largest {
+			largest = s.Bytes
+		}
+	}
+	for _, n := range nodes {
+		var got int64
+		for _, s := range plan[n.Name] {
+			got += size[s]
+		}
+		fair := float64(2*total) * nodeWeight(n) / 11
+		if float64(got) > (1+slack)*fair {
+			t.Errorf("node %s has %d bytes, fair share %.0f", n.Name, got, fair)
+		}
+		if float64(got) < (1-2*slack)*fair-float64(largest) {
+			t.Errorf("node %s has %d bytes, fair share %.0f", n.Name, got, fair)
+		}
+	}
+}
+
+func TestPlaceMoves(t *testing.T) {
+	shards := testShards(2000)
+	opts := Options{Replicas: 2}
+	before, err := Place(shards, testNodes(10), opts)
+	if err != nil {
+		t.Fatalf("Place: %v", err)
+	}
+
+	again, err := Place(shards, testNodes(10), opts)
+	if err != nil {
+		t.Fatalf("Place: %v", err)
+	}
+	if !reflect.DeepEqual(before, again) {
+		t.Errorf("Place is not deterministic")
+	}
+
+	copies := 2 * len(shards)
+	for _, tc := range []struct {
+		name  string
+		nodes []Node
+		// ideal is the fraction of copies that must move.
+		ideal float64
+	}{
+		{"join", testNodes(11), 1.0 / 11},
+		{"leave", testNodes(9), 1.0 / 10},
+	} {
+		after, err := Place(shards, tc.nodes, opts)
+		if err != nil {
+			t.Fatalf("Place: %v", err)
+		}
+		moved := float64(Moves(before, after)) / float64(copies)
+		if moved > 2*tc.ideal {
+			t.Errorf("%s: moved %.1f%% of copies, want about %.1f%%", tc.name, 100*moved, 100*tc.ideal)
+		}
+	}
+}
+
+func TestPlaceLoad(t *testing.T) {
+	shards := []Shard{
+		{Name: "hot", Bytes: 10, Load: 100},
+		{Name: "cold1", Bytes: 10},
+		{Name: "cold2", Bytes: 10},
+		{Name: "cold3", Bytes: 10},
+	}
+	plan, err := Place(shards, testNodes(2), Options{LoadWeight: 0.9})
+	if err != nil {
+		t.Fatalf("Place: %v", err)
+	}
+	for _, names := range plan {
+		if len(names) != 1 && len(names) != 3 {
+			t.Errorf("got %v, want the hot shard alone", plan)
+		}
+	}
+}
+
+func TestManifest(t *testing.T) {
+	var buf bytes.Buffer
+	if err := WriteManifest(&buf, []string{"a.zoekt", "b.zoekt"}); err != nil {
+		t.Fatalf("WriteManifest: %v", err)
+	}
+	buf.WriteString("# comment\n\n")
+
+	got, err := ReadManifest(&buf)
+	if err != nil {
+		t.Fatalf("ReadManifest: %v", err)
+	}
+	if want := map[string]bool{"a.zoekt": true, "b.zoekt": true}; !reflect.DeepEqual(got, want) {
+		t.Errorf("got %v, want %v", got, want)
+	}
+}
+
+func TestManifestEmpty(t *testing.T) {
+	var buf bytes.Buffer
+	if err := WriteManifest(&buf, nil); err != nil {
+		t.Fatalf("WriteManifest: %v", err)
+	}
+	if buf.Len() == 0 {
+		t.Fatal("manifest without shards is empty")
+	}
+
+	got, err := ReadManifest(&buf)
+	if err != nil {
+		t.Fatalf("ReadManifest: %v", err)
+	}
+	if len(got) != 0 {
+		t.Errorf("got %v, want no shards", got)
+	}
+}
@@ -0,0 +1,119 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package zoekt
+
+import (
+	"github.com/google/zoekt/query"
+)
+
+// maxPrefetchGap is the largest gap between two ranges that are
+// prefetched with a single hint. Reading the gap is cheaper than
+// another system call.
+const maxPrefetchGap = 64 << 10
+
+// candidatePrefetcher walks a copy of the match tree ahead of the
+// search loop, and prefetches the contents and newlines of the
+// candidates it finds. The copy visits the same documents as the
+// search, as the candidates only depend on the posting lists.
+type candidatePrefetcher struct {
+	d     *indexData
+	mt    matchTree
+	batch int
+
+	// lastDoc is the last candidate prefetched, and batchStart the
+	// first candidate of the last batch.
+	lastDoc    int
+	batchStart int
+	done       bool
+}
+
+// newCandidatePrefetcher returns a prefetcher for q that starts after
+// lastDoc, or nil if the index file does not take access hints.
+func (d *indexData) newCandidatePrefetcher(q query.Q, batch int, lastDoc int) (*candidatePrefetcher, error) {
+	if _, ok := d.file.(accessAdvisor); !ok {
+		return nil, nil
+	}
+	mt, err := d.newMatchTree(q)
+	if err != nil {
+		return nil, err
+	}
+	return &candidatePrefetcher{
+		d:          d,
+		mt:         mt,
+		batch:      batch,
+		lastDoc:    lastDoc,
+		batchStart: lastDoc,
+	}, nil
+}
+
+// advance is called before doc is evaluated. Once the search reaches
+// the last batch, the next one is prefetched, so there is always about
+// a batch of candidates in flight.
+func (p *candidatePrefetcher) advance(doc uint32) {
+	for !p.done && int(doc) >= p.batchStart {
+		p.prefetchBatch()
+	}
+}
+
+func (p *candidatePrefetcher) prefetchBatch() {
+	d := p.d
+	docCount := uint32(len(d.fileBranchMasks))
+
+	var contents, newlines []simpleSection
+	for i := 0; i < p.batch; i++ {
+		next := p.mt.nextDoc()
+		if int(next) <= p.lastDoc {
+			next = uint32(p.lastDoc + 1)
+		}
+		if next >= docCount {
+			p.done = true
+			break
+		}
+		p.mt.prepare(next)
+		p.lastDoc = int(next)
+		if i == 0 {
+			p.batchStart = p.lastDoc
+		}
+
+		contents = appendPrefetch(contents, d.contentSection(next))
+		newlines = appendPrefetch(newlines, simpleSection{
+			off: d.newlinesStart + d.newlinesIndex[next],
+			sz:  d.newlinesIndex[next+1] - d.newlinesIndex[next],
+		})
+	}
+
+	for _, sec := range contents {
+		d.advise(sec, accessWillNeed)
+	}
+	for _, sec := range newlines {
+		d.advise(sec, accessWillNeed)
+	}
+}
+
+// appendPrefetch adds sec to secs, which are in increasing order,
+// merging it with the last one if they are close.
+func appendPrefetch(secs []simpleSection, sec simpleSection) []simpleSection {
+	if sec.sz == 0 {
+		return secs
+	}
+	if n := len(secs); n > 0 {
+		last := &secs[n-1]
+		if end := last.off + last.sz; sec.off >= end && sec.off-end <= maxPrefetchGap {
+			last.sz = sec.off + sec.sz - last.off
+			return secs
+		}
+	}
+	return append(secs, sec)
+}
@@ -0,0 +1,75 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package query
+
+import (
+	"bytes"
+	"encoding/gob"
+	"regexp/syntax"
+)
+
+func init() {
+	// Register the query types, so a Q can be sent in a gob.
+	gob.Register(&And{})
+	gob.Register(&Or{})
+	gob.Register(&Not{})
+	gob.Register(&Const{})
+	gob.Register(&Substring{})
+	gob.Register(&Regexp{})
+	gob.Register(&Symbol{})
+	gob.Register(&Near{})
+	gob.Register(&Repo{})
+	gob.Register(&Branch{})
+	gob.Register(&Language{})
+}
+
+// regexpGob is the gob form of Regexp. syntax.Regexp has arrays with
+// nil pointers, which gob can't encode, so the regexp is sent as a
+// string.
+type regexpGob struct {
+	Regexp        string
+	FileName      bool
+	Content       bool
+	CaseSensitive bool
+}
+
+func (q *Regexp) GobEncode() ([]byte, error) {
+	var buf bytes.Buffer
+	err := gob.NewEncoder(&buf).Encode(&regexpGob{
+		Regexp:        q.Regexp.String(),
+		FileName:      q.FileName,
+		Content:       q.Content,
+		CaseSensitive: q.CaseSensitive,
+	})
+	return buf.Bytes(), err
+}
+
+func (q *Regexp) GobDecode(data []byte) error {
+	var g regexpGob
+	if err := gob.NewDecoder(bytes.NewReader(data)).Decode(&g); err != nil {
+		return err
+	}
+	r, err := syntax.Parse(g.Regexp, syntax.ClassNL|syntax.PerlX|syntax.UnicodeGroups)
+	if err != nil {
+		return err
+	}
+	*q = Regexp{
+		Regexp:        r,
+		FileName:      g.FileName,
+		Content:       g.Content,
+		CaseSensitive: g.CaseSensitive,
+	}
+	return nil
+}
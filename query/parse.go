@@ -19,6 +19,8 @@ import (
 	"fmt"
 	"log"
 	"regexp/syntax"
+	"strconv"
+	"strings"
 )
 
 var _ = log.Printf
@@ -73,6 +75,17 @@ func (o *orOperator) String() string {
 	return "orOp"
 }
 
+// nearOperator is a placeholder intermediate so we can represent [A,
+// near, B] before we convert it to Near{A, B}.
+type nearOperator struct {
+	Distance int
+	Lines    bool
+}
+
+func (o *nearOperator) String() string {
+	return "nearOp"
+}
+
 func isSpace(c byte) bool {
 	return c == ' ' || c == '\t'
 }
@@ -153,7 +166,28 @@ func parseExpr(in []byte) (Q, int, error) {
 		if text == "" {
 			return nil, 0, fmt.Errorf("the sym: atom must have an argument")
 		}
-		expr = &Symbol{&Substring{Pattern: text}}
+		q, err := regexpQuery(text, false, false)
+		if err != nil {
+			return nil, 0, err
+		}
+		expr = &Symbol{Expr: q}
+	case tokNear:
+		op := &nearOperator{}
+		if strings.HasSuffix(text, "l") {
+			op.Lines = true
+			text = strings.TrimSuffix(text, "l")
+		}
+		d, err := strconv.Atoi(text)
+		if err != nil || d < 0 {
+			return nil, 0, fmt.Errorf("query: near: wants a distance like 20 (characters) or 2l (lines), got %q", tok.Text)
+		}
+		op.Distance = d
+		expr = op
+	case tokKind:
+		if text == "" {
+			return nil, 0, fmt.Errorf("the kind: atom must have an argument")
+		}
+		expr = &kindQ{text}
 
 	case tokParenClose:
 		// Caller must consume paren.
@@ -187,6 +221,12 @@ func parseExpr(in []byte) (Q, int, error) {
 		if subQ == nil {
 			return nil, 0, fmt.Errorf("query: '-' operator needs an argument")
 		}
+		if _, ok := subQ.(*kindQ); ok {
+			return nil, 0, fmt.Errorf("query: kind: cannot be negated")
+		}
+		if _, ok := subQ.(*nearOperator); ok {
+			return nil, 0, fmt.Errorf("query: near: cannot be negated")
+		}
 		b = b[n:]
 		expr = &Not{subQ}
 
@@ -288,15 +328,97 @@ func parseExprList(in []byte) ([]Q, int, error) {
 			newQS = append(newQS, q)
 		}
 	}
+
 	qs = mapQueryList(newQS, func(q Q) Q {
 		if sc, ok := q.(setCaser); ok {
 			sc.setCase(setCase)
 		}
 		return q
 	})
+	qs = parseKinds(qs)
+
+	qs, err := parseNear(qs)
+	if err != nil {
+		return nil, 0, err
+	}
 	return qs, len(in) - len(b), nil
 }
 
+// parseKinds interprets the kindQ in a list of queries. kind:
+// restricts the sym: atoms next to it, up to the surrounding OR
+// operators. Without any, it finds all symbols of the kind.
+func parseKinds(qs []Q) []Q {
+	var res []Q
+	for len(qs) > 0 {
+		end := 0
+		for end < len(qs) {
+			if _, ok := qs[end].(*orOperator); ok {
+				break
+			}
+			end++
+		}
+
+		kind := ""
+		var and []Q
+		for _, q := range qs[:end] {
+			if k, ok := q.(*kindQ); ok {
+				kind = k.Kind
+			} else {
+				and = append(and, q)
+			}
+		}
+		if kind != "" {
+			hasSym := false
+			and = mapQueryList(and, func(q Q) Q {
+				if s, ok := q.(*Symbol); ok {
+					s.Kind = kind
+					hasSym = true
+				}
+				return q
+			})
+			if !hasSym {
+				and = append(and, &Symbol{Kind: kind})
+			}
+		}
+		res = append(res, and...)
+
+		if end < len(qs) {
+			res = append(res, qs[end])
+			end++
+		}
+		qs = qs[end:]
+	}
+	return res
+}
+
+// parseNear interprets the nearOperator in a list of queries. It binds
+// tighter than the implicit AND, and its operands must be strings.
+func parseNear(qs []Q) ([]Q, error) {
+	var res []Q
+	for i := 0; i < len(qs); i++ {
+		op, ok := qs[i].(*nearOperator)
+		if !ok {
+			res = append(res, qs[i])
+			continue
+		}
+		if len(res) == 0 || i+1 == len(qs) {
+			return nil, fmt.Errorf("query: near: operator should have two operands")
+		}
+
+		children := []Q{res[len(res)-1], qs[i+1]}
+		for _, ch := range children {
+			s, ok := ch.(*Substring)
+			if !ok || s.FileName {
+				return nil, fmt.Errorf("query: near: operands should be strings, got %s", ch)
+			}
+			s.Content = true
+		}
+		res[len(res)-1] = &Near{Children: children, Distance: op.Distance, Lines: op.Lines}
+		i++
+	}
+	return res, nil
+}
+
 type token struct {
 	Type int
 	// The value of the token
@@ -326,6 +448,8 @@ const (
 	tokContent    = 11
 	tokLang       = 12
 	tokSym        = 13
+	tokKind       = 14
+	tokNear       = 15
 )
 
 var tokNames = map[int]string{
@@ -342,6 +466,8 @@ var tokNames = map[int]string{
 	tokText:       "Text",
 	tokLang:       "Language",
 	tokSym:        "Symbol",
+	tokKind:       "Kind",
+	tokNear:       "Near",
 }
 
 var prefixes = map[string]int{
@@ -357,6 +483,8 @@ var prefixes = map[string]int{
 	"repo:":    tokRepo,
 	"lang:":    tokLang,
 	"sym:":     tokSym,
+	"kind:":    tokKind,
+	"near:":    tokNear,
 }
 
 var reservedWords = map[string]int{
@@ -84,8 +84,35 @@ func TestParseQuery(t *testing.T) {
 		{"content:abc", &Substring{Pattern: "abc", Content: true}},
 
 		{"lang:c++", &Language{"c++"}},
-		{"sym:pqr", &Symbol{&Substring{Pattern: "pqr"}}},
-		{"sym:Pqr", &Symbol{&Substring{Pattern: "Pqr", CaseSensitive: true}}},
+		{"sym:pqr", &Symbol{Expr: &Substring{Pattern: "pqr"}}},
+		{"sym:Pqr", &Symbol{Expr: &Substring{Pattern: "Pqr", CaseSensitive: true}}},
+		{"sym:^p.r$", &Symbol{Expr: &Regexp{Regexp: mustParseRE("^p.r$")}}},
+		{"sym:pqr kind:func", &Symbol{Expr: &Substring{Pattern: "pqr"}, Kind: "func"}},
+		{"kind:class", &Symbol{Kind: "class"}},
+		{"abc near:5 def", &Near{
+			Children: []Q{&Substring{Pattern: "abc", Content: true}, &Substring{Pattern: "def", Content: true}},
+			Distance: 5,
+		}},
+		{"xyz abc near:2l Def", NewAnd(
+			&Substring{Pattern: "xyz"},
+			&Near{
+				Children: []Q{&Substring{Pattern: "abc", Content: true}, &Substring{Pattern: "Def", Content: true, CaseSensitive: true}},
+				Distance: 2,
+				Lines:    true,
+			},
+		)},
+		{"abc kind:class", NewAnd(
+			&Substring{Pattern: "abc"},
+			&Symbol{Kind: "class"},
+		)},
+		{"kind:func or kind:type", NewOr(
+			&Symbol{Kind: "func"},
+			&Symbol{Kind: "type"},
+		)},
+		{"sym:abc kind:func or sym:def", NewOr(
+			&Symbol{Expr: &Substring{Pattern: "abc"}, Kind: "func"},
+			&Symbol{Expr: &Substring{Pattern: "def"}},
+		)},
 
 		// case
 		{"abc case:yes", &Substring{Pattern: "abc", CaseSensitive: true}},
@@ -104,6 +131,14 @@ func TestParseQuery(t *testing.T) {
 		{"case:foo", nil},
 
 		{"sym:", nil},
+		{"kind:", nil},
+		{"-kind:func sym:foo", nil},
+		{"abc near:x def", nil},
+		{"abc near:3", nil},
+		{"near:3 abc", nil},
+		{"f:abc near:3 def", nil},
+		{"a.*c near:3 def", nil},
+		{"foo -near:2 bar", nil},
 		{"abc or", nil},
 		{"or abc", nil},
 		{"def or or abc", nil},
@@ -37,13 +37,23 @@ type Regexp struct {
 	CaseSensitive bool
 }
 
-// Symbol finds a string that is a symbol.
+// Symbol finds a symbol whose name matches Expr, which is either a
+// *Substring or a *Regexp. If Kind is set, only symbols whose ctags
+// kind starts with it match; Expr may then be nil to find all
+// symbols of the kind.
 type Symbol struct {
-	Atom *Substring
+	Expr Q
+	Kind string
 }
 
 func (s *Symbol) String() string {
-	return fmt.Sprintf("sym:%s", s.Atom)
+	switch {
+	case s.Kind == "":
+		return fmt.Sprintf("sym:%s", s.Expr)
+	case s.Expr == nil:
+		return fmt.Sprintf("sym:kind:%s", s.Kind)
+	}
+	return fmt.Sprintf("sym:kind:%s:%s", s.Kind, s.Expr)
 }
 
 func (q *Regexp) String() string {
@@ -65,6 +75,14 @@ func (c *caseQ) String() string {
 	return "case:" + c.Flavor
 }
 
+type kindQ struct {
+	Kind string
+}
+
+func (k *kindQ) String() string {
+	return "kind:" + k.Kind
+}
+
 type Language struct {
 	Language string
 }
@@ -138,7 +156,9 @@ func (q *Substring) setCase(k string) {
 }
 
 func (q *Symbol) setCase(k string) {
-	q.Atom.setCase(k)
+	if sc, ok := q.Expr.(setCaser); ok {
+		sc.setCase(k)
+	}
 }
 
 func (q *Regexp) setCase(k string) {
@@ -165,6 +185,23 @@ func (q *Or) String() string {
 	return fmt.Sprintf("(or %s)", strings.Join(sub, " "))
 }
 
+// Near is matched when its two children, which are content
+// *Substring queries, match at most Distance characters apart, or
+// Distance lines apart if Lines is set.
+type Near struct {
+	Children []Q
+	Distance int
+	Lines    bool
+}
+
+func (q *Near) String() string {
+	unit := ""
+	if q.Lines {
+		unit = "l"
+	}
+	return fmt.Sprintf("(near:%d%s %s %s)", q.Distance, unit, q.Children[0], q.Children[1])
+}
+
 // Not inverts the meaning of its child.
 type Not struct {
 	Child Q
@@ -351,6 +388,8 @@ func Map(q Q, f func(q Q) Q) Q {
 		q = &Or{Children: mapQueryList(s.Children, f)}
 	case *Not:
 		q = &Not{Child: Map(s.Child, f)}
+	case *Near:
+		q = &Near{Children: mapQueryList(s.Children, f), Distance: s.Distance, Lines: s.Lines}
 	}
 	return f(q)
 }
@@ -386,6 +425,7 @@ func VisitAtoms(q Q, v func(q Q)) {
 		case *And:
 		case *Or:
 		case *Not:
+		case *Near:
 		default:
 			v(iQ)
 		}
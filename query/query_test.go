@@ -15,6 +15,8 @@
 package query
 
 import (
+	"bytes"
+	"encoding/gob"
 	"log"
 	"reflect"
 	"testing"
@@ -100,12 +102,44 @@ func TestMap(t *testing.T) {
 }
 
 func TestVisitAtoms(t *testing.T) {
-	in := NewAnd(&Substring{}, &Repo{}, &Not{&Const{}})
+	in := NewAnd(&Substring{}, &Repo{}, &Not{&Const{}}, &Near{Children: []Q{&Substring{}, &Substring{}}})
 	count := 0
 	VisitAtoms(in, func(q Q) {
 		count++
 	})
-	if count != 3 {
-		t.Errorf("got %d, want 3", count)
+	if count != 5 {
+		t.Errorf("got %d, want 5", count)
+	}
+}
+
+func TestGobRoundTrip(t *testing.T) {
+	for _, in := range []string{
+		"foo -bar",
+		"(foo or bar) file:baz",
+		"case:yes regex:a.*b[0-9]+ sym:main",
+		"r:repo b:master lang:go",
+		`case:no f:\.go$ content:x`,
+		`sym:^Open\w+$`,
+		"sym:open kind:method",
+		"kind:class",
+		"foo near:10 bar",
+		"foo near:2l bar",
+	} {
+		q, err := Parse(in)
+		if err != nil {
+			t.Fatalf("Parse(%q): %v", in, err)
+		}
+
+		var buf bytes.Buffer
+		if err := gob.NewEncoder(&buf).Encode(&q); err != nil {
+			t.Fatalf("Encode(%s): %v", q, err)
+		}
+		var got Q
+		if err := gob.NewDecoder(&buf).Decode(&got); err != nil {
+			t.Fatalf("Decode(%s): %v", q, err)
+		}
+		if got.String() != q.String() {
+			t.Errorf("got %s, want %s", got, q)
+		}
 	}
 }
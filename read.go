@@ -166,6 +166,20 @@ func (r *reader) readIndexData(toc *indexTOC) (*indexData, error) {
 		return nil, err
 	}
 
+	d.regions = toc.regions()
+
+	// Contents, postings, newlines and symbol sections are read per
+	// document or ngram, so readahead around a fault mostly brings in
+	// data that we don't need. Larger ranges are prefetched
+	// explicitly instead.
+	for _, sec := range []simpleSection{toc.fileContents.data, toc.postings.data, toc.newlines.data, toc.fileSections.data, toc.symbolPostings.data, toc.symbolNameIDs.data, toc.symbolMeta, toc.symbolKindPostings.data} {
+		d.advise(sec, accessRandom)
+	}
+	// The ngram tables are decoded in full below, and not read again.
+	for _, sec := range []simpleSection{toc.ngramText, toc.nameNgramText, toc.namePostings.data, toc.symbolNgramText} {
+		d.advise(sec, accessSequential)
+	}
+
 	d.boundariesStart = toc.fileContents.data.off
 	d.boundaries = toc.fileContents.relativeIndex()
 	d.newlinesStart = toc.newlines.data.off
@@ -183,10 +197,48 @@ func (r *reader) readIndexData(toc *indexTOC) (*indexData, error) {
 		return nil, err
 	}
 
-	d.ngrams, err = d.readNgrams(toc)
+	d.asciiFlags, err = d.readSectionBlob(toc.asciiFlags)
+	if err != nil {
+		return nil, err
+	}
+
+	d.ngrams, err = d.readNgrams(toc.ngramText, toc.postings)
+	if err != nil {
+		return nil, err
+	}
+
+	d.symbolNgrams, err = d.readNgrams(toc.symbolNgramText, toc.symbolPostings)
+	if err != nil {
+		return nil, err
+	}
+
+	d.symbolNames, err = d.readSectionBlob(toc.symbolNames.data)
 	if err != nil {
 		return nil, err
 	}
+	d.symbolNameIndex = toc.symbolNames.relativeIndex()
+	d.symbolNameIDsStart = toc.symbolNameIDs.data.off
+	d.symbolNameIDsIndex = toc.symbolNameIDs.relativeIndex()
+
+	blob, err = d.readSectionBlob(toc.symbolKinds.data)
+	if err != nil {
+		return nil, err
+	}
+	kindIndex := toc.symbolKinds.relativeIndex()
+	for i := 0; i+1 < len(kindIndex); i++ {
+		d.symbolKinds = append(d.symbolKinds, string(blob[kindIndex[i]:kindIndex[i+1]]))
+	}
+	d.symbolScopes, err = d.readSectionBlob(toc.symbolScopes.data)
+	if err != nil {
+		return nil, err
+	}
+	d.symbolScopesIndex = toc.symbolScopes.relativeIndex()
+	d.symbolMeta, err = d.readSectionBlob(toc.symbolMeta)
+	if err != nil {
+		return nil, err
+	}
+	d.symbolKindPostingsStart = toc.symbolKindPostings.data.off
+	d.symbolKindPostingsIndex = toc.symbolKindPostings.relativeIndex()
 
 	d.fileBranchMasks, err = readSectionU64(d.file, toc.branchMasks)
 	if err != nil {
@@ -253,19 +305,21 @@ func (r *reader) readIndexData(toc *indexTOC) (*indexData, error) {
 
 const ngramEncoding = 8
 
-func (d *indexData) readNgrams(toc *indexTOC) (map[ngram]simpleSection, error) {
-	textContent, err := d.readSectionBlob(toc.ngramText)
+// readNgrams reads an ngram table, and returns where the postings of
+// each ngram are.
+func (d *indexData) readNgrams(ngramText simpleSection, postings compoundSection) (map[ngram]simpleSection, error) {
+	textContent, err := d.readSectionBlob(ngramText)
 	if err != nil {
 		return nil, err
 	}
-	postingsIndex := toc.postings.relativeIndex()
+	postingsIndex := postings.relativeIndex()
 
 	ngrams := make(map[ngram]simpleSection, len(textContent)/ngramEncoding)
 	for i := 0; i < len(textContent); i += ngramEncoding {
 		j := i / ngramEncoding
 		ng := ngram(binary.BigEndian.Uint64(textContent[i : i+ngramEncoding]))
 		ngrams[ng] = simpleSection{
-			toc.postings.data.off + postingsIndex[j],
+			postings.data.off + postingsIndex[j],
 			postingsIndex[j+1] - postingsIndex[j],
 		}
 	}
@@ -321,20 +375,15 @@ func (d *indexData) verify() error {
 	return nil
 }
 
-func (d *indexData) readContents(i uint32) ([]byte, error) {
-	return d.readSectionBlob(simpleSection{
+func (d *indexData) contentSection(i uint32) simpleSection {
+	return simpleSection{
 		off: d.boundariesStart + d.boundaries[i],
 		sz:  d.boundaries[i+1] - d.boundaries[i],
-	})
+	}
 }
 
-func (d *indexData) readContentSlice(off uint32, sz uint32) ([]byte, error) {
-	// TODO(hanwen): cap result if it is at the end of the content
-	// section.
-	return d.readSectionBlob(simpleSection{
-		off: d.boundariesStart + off,
-		sz:  sz,
-	})
+func (d *indexData) readContents(i uint32) ([]byte, error) {
+	return d.readSectionBlob(d.contentSection(i))
 }
 
 func (d *indexData) readNewlines(i uint32, buf []uint32) ([]uint32, uint32, error) {
@@ -16,8 +16,12 @@ package zoekt
 
 import (
 	"bytes"
+	"context"
+	"fmt"
 	"reflect"
 	"testing"
+
+	"github.com/google/zoekt/query"
 )
 
 func TestReadWrite(t *testing.T) {
@@ -98,3 +102,129 @@ func TestReadWriteNames(t *testing.T) {
 		t.Errorf("got trigram bcd at bits %v, want sz 2", data.fileNameNgrams)
 	}
 }
+
+type adviceCall struct {
+	off, sz uint32
+	p       accessPattern
+}
+
+type adviseSeeker struct {
+	memSeeker
+	calls []adviceCall
+}
+
+func (s *adviseSeeker) advise(off, sz uint32, p accessPattern) {
+	s.calls = append(s.calls, adviceCall{off, sz, p})
+}
+
+func TestAccessAdvice(t *testing.T) {
+	b, err := NewIndexBuilder(nil)
+	if err != nil {
+		t.Fatalf("NewIndexBuilder: %v", err)
+	}
+	big := bytes.Repeat([]byte("needle haystack "), minPrefetchSize/8)
+	if err := b.AddFile("big", big); err != nil {
+		t.Fatalf("AddFile: %v", err)
+	}
+	if err := b.AddFile("small", []byte("needle")); err != nil {
+		t.Fatalf("AddFile: %v", err)
+	}
+
+	var buf bytes.Buffer
+	b.Write(&buf)
+	f := &adviseSeeker{memSeeker: memSeeker{buf.Bytes()}}
+	s, err := NewSearcher(f)
+	if err != nil {
+		t.Fatalf("NewSearcher: %v", err)
+	}
+	d := s.(*indexData)
+
+	content := d.contentSection(0)
+	var random bool
+	for _, c := range f.calls {
+		if c.p == accessRandom && c.off <= content.off && content.off+content.sz <= c.off+c.sz {
+			random = true
+		}
+	}
+	if !random {
+		t.Errorf("contents not advised random: %v", f.calls)
+	}
+
+	f.calls = nil
+	if _, err := s.Search(context.Background(), &query.Substring{Pattern: "needle", Content: true}, &SearchOptions{}); err != nil {
+		t.Fatal(err)
+	}
+	want := adviceCall{content.off, content.sz, accessWillNeed}
+	var found bool
+	for _, c := range f.calls {
+		if c == want {
+			found = true
+		}
+		if c.sz < minPrefetchSize {
+			t.Errorf("prefetched small range %v", c)
+		}
+	}
+	if !found {
+		t.Errorf("got %v, want prefetch of %v", f.calls, want)
+	}
+}
+
+func TestPrefetchCandidates(t *testing.T) {
+	b, err := NewIndexBuilder(nil)
+	if err != nil {
+		t.Fatalf("NewIndexBuilder: %v", err)
+	}
+	for i, c := range []string{"needle", "hay", "needle", "hay", "needle", "needle"} {
+		if err := b.AddFile(fmt.Sprintf("f%d", i), []byte(c)); err != nil {
+			t.Fatalf("AddFile: %v", err)
+		}
+	}
+	var buf bytes.Buffer
+	b.Write(&buf)
+	f := &adviseSeeker{memSeeker: memSeeker{buf.Bytes()}}
+	s, err := NewSearcher(f)
+	if err != nil {
+		t.Fatalf("NewSearcher: %v", err)
+	}
+	d := s.(*indexData)
+
+	q := &query.Substring{Pattern: "needle", Content: true}
+	want, err := s.Search(context.Background(), q, &SearchOptions{})
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	f.calls = nil
+	got, err := s.Search(context.Background(), q, &SearchOptions{PrefetchCandidates: 2})
+	if err != nil {
+		t.Fatal(err)
+	}
+	if len(got.Files) != len(want.Files) {
+		t.Errorf("got %d files, want %d", len(got.Files), len(want.Files))
+	}
+
+	prefetched := func(sec simpleSection) bool {
+		for _, c := range f.calls {
+			if c.p == accessWillNeed && c.off <= sec.off && sec.off+sec.sz <= c.off+c.sz {
+				return true
+			}
+		}
+		return false
+	}
+	for _, doc := range []uint32{0, 2, 4, 5} {
+		if !prefetched(d.contentSection(doc)) {
+			t.Errorf("content of doc %d not prefetched: %v", doc, f.calls)
+		}
+	}
+}
+
+func TestAppendPrefetch(t *testing.T) {
+	var secs []simpleSection
+	for _, s := range []simpleSection{{0, 10}, {10, 5}, {20, 0}, {20, 5}, {20 + maxPrefetchGap + 10, 1}} {
+		secs = appendPrefetch(secs, s)
+	}
+	want := []simpleSection{{0, 25}, {20 + maxPrefetchGap + 10, 1}}
+	if !reflect.DeepEqual(secs, want) {
+		t.Errorf("got %v, want %v", secs, want)
+	}
+}
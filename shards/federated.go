@@ -0,0 +1,287 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package shards
+
+import (
+	"bytes"
+	"context"
+	"encoding/gob"
+	"fmt"
+	"io"
+	"io/ioutil"
+	"log"
+	"net/http"
+	"strings"
+	"sync/atomic"
+	"time"
+
+	"github.com/google/zoekt"
+	"github.com/google/zoekt/query"
+	"github.com/google/zoekt/web"
+	"github.com/prometheus/client_golang/prometheus"
+	"github.com/prometheus/client_golang/prometheus/promauto"
+)
+
+var (
+	metricBackendRequestsTotal = promauto.NewCounterVec(prometheus.CounterOpts{
+		Name: "zoekt_backend_requests_total",
+		Help: "The total number of requests to remote backends, by outcome",
+	}, []string{"outcome"})
+	metricBackendHedgedRequestsTotal = promauto.NewCounter(prometheus.CounterOpts{
+		Name: "zoekt_backend_hedged_requests_total",
+		Help: "The total number of backup requests sent because a backend was slow or failed",
+	})
+	metricBackendRequestDuration = promauto.NewHistogram(prometheus.HistogramOpts{
+		Name:    "zoekt_backend_request_duration_seconds",
+		Help:    "The duration of requests to remote backends",
+		Buckets: prometheus.DefBuckets,
+	})
+)
+
+// Backend is a zoekt-webserver serving the RPC API (--rpc). All its
+// addresses serve the same shards, eg. "http://host1:6070" and
+// "http://host2:6070".
+type Backend struct {
+	Addrs []string
+}
+
+// FederatedOptions configures NewFederatedSearcher.
+type FederatedOptions struct {
+	// Client sends the requests. If nil, http.DefaultClient is
+	// used.
+	Client *http.Client
+
+	// If a request takes longer than HedgeDelay, a backup request
+	// is sent to the next address of the backend, or to the same
+	// address if it has only one. Zero disables backup requests.
+	HedgeDelay time.Duration
+
+	// MaxConcurrentSearches limits the searches that run at the
+	// same time. If zero, it is 64.
+	MaxConcurrentSearches int
+}
+
+// NewFederatedSearcher returns a searcher that sends each search to all
+// backends, and merges their results like a searcher over local shards:
+// files are sorted by score and cut off at MaxDocDisplayCount, and
+// Stats are added up. Cancellation and MaxWallTime carry over to the
+// backends. A backend that fails is counted in Stats.Crashes.
+//
+// A LimitPolicy is not called, since estimating the document count
+// would take another request to each backend. Instead, the backends
+// derive the adaptive limits of the web UI from their own documents.
+func NewFederatedSearcher(backends []Backend, opts FederatedOptions) (zoekt.Searcher, error) {
+	if opts.Client == nil {
+		opts.Client = http.DefaultClient
+	}
+	if opts.MaxConcurrentSearches == 0 {
+		opts.MaxConcurrentSearches = 64
+	}
+
+	ss := newShardedSearcher(int64(opts.MaxConcurrentSearches))
+	ss.workers = len(backends)
+	ss.remoteLimits = true
+	for _, b := range backends {
+		if len(b.Addrs) == 0 {
+			return nil, fmt.Errorf("backend without addresses")
+		}
+		name := strings.Join(b.Addrs, ",")
+		ss.shards[name] = rankedShard{
+			Searcher: &remoteSearcher{
+				addrs:      b.Addrs,
+				client:     opts.Client,
+				hedgeDelay: opts.HedgeDelay,
+			},
+			name: name,
+		}
+	}
+	return ss, nil
+}
+
+// remoteSearcher searches a backend over HTTP.
+type remoteSearcher struct {
+	addrs      []string
+	client     *http.Client
+	hedgeDelay time.Duration
+
+	// next is the address to try first, for round robin.
+	// Accessed atomically.
+	next uint32
+}
+
+func (r *remoteSearcher) String() string {
+	return strings.Join(r.addrs, ",")
+}
+
+func (r *remoteSearcher) Close() {}
+
+func (r *remoteSearcher) Search(ctx context.Context, q query.Q, opts *zoekt.SearchOptions) (*zoekt.SearchResult, error) {
+	o := *opts
+	o.LimitPolicy = nil
+	if deadline, ok := ctx.Deadline(); ok {
+		// Leave the backend time to send its partial results
+		// before our own deadline.
+		o.MaxWallTime = time.Until(deadline) * 9 / 10
+		if o.MaxWallTime <= 0 {
+			return &zoekt.SearchResult{Stats: zoekt.Stats{ShardsSkipped: 1, Truncated: true}}, nil
+		}
+	}
+
+	req := &web.SearchRequest{Q: q, Opts: o}
+	if opts.LimitPolicy != nil {
+		// The backend applies its default limits.
+		req.Num = opts.MaxDocDisplayCount
+	}
+	v, err := r.hedged(ctx, "/api/search", req, func() interface{} {
+		return &zoekt.SearchResult{}
+	})
+	if err != nil {
+		var res zoekt.SearchResult
+		if ctx.Err() != nil {
+			res.Stats.ShardsSkipped = 1
+			res.Stats.Truncated = true
+		} else {
+			log.Printf("search %s: %v", r, err)
+			res.Stats.Crashes = 1
+		}
+		return &res, nil
+	}
+	return v.(*zoekt.SearchResult), nil
+}
+
+func (r *remoteSearcher) List(ctx context.Context, q query.Q) (*zoekt.RepoList, error) {
+	v, err := r.hedged(ctx, "/api/list", &web.ListRequest{Q: q}, func() interface{} {
+		return &zoekt.RepoList{}
+	})
+	if err != nil {
+		log.Printf("list %s: %v", r, err)
+		return &zoekt.RepoList{Crashes: 1}, nil
+	}
+	return v.(*zoekt.RepoList), nil
+}
+
+// hedged posts req to path on the backend, and decodes the response
+// into a value returned by newResp. If no response has arrived after
+// hedgeDelay, or a request fails, it sends the request again to the
+// next address. The first response wins.
+func (r *remoteSearcher) hedged(ctx context.Context, path string, req interface{}, newResp func() interface{}) (interface{}, error) {
+	var body bytes.Buffer
+	if err := gob.NewEncoder(&body).Encode(req); err != nil {
+		return nil, err
+	}
+
+	ctx, cancel := context.WithCancel(ctx)
+	defer cancel()
+
+	attempts := 1
+	if r.hedgeDelay > 0 {
+		attempts = len(r.addrs)
+		if attempts == 1 {
+			attempts = 2
+		}
+	}
+
+	type result struct {
+		resp interface{}
+		err  error
+	}
+	results := make(chan result, attempts)
+	first := int(atomic.AddUint32(&r.next, 1))
+	sent := 0
+	send := func() {
+		addr := r.addrs[(first+sent)%len(r.addrs)]
+		if sent > 0 {
+			metricBackendHedgedRequestsTotal.Inc()
+		}
+		sent++
+		go func() {
+			resp := newResp()
+			err := r.post(ctx, addr+path, body.Bytes(), resp)
+			results <- result{resp, err}
+		}()
+	}
+
+	var timer *time.Timer
+	var hedge <-chan time.Time
+	if r.hedgeDelay > 0 {
+		timer = time.NewTimer(r.hedgeDelay)
+		defer timer.Stop()
+		hedge = timer.C
+	}
+
+	send()
+	var lastErr error
+	for failed := 0; ; {
+		select {
+		case res := <-results:
+			if res.err == nil {
+				return res.resp, nil
+			}
+			lastErr = res.err
+			failed++
+			if sent < attempts {
+				send()
+			} else if failed == sent {
+				return nil, lastErr
+			}
+		case <-hedge:
+			if sent < attempts {
+				send()
+			}
+			if sent < attempts {
+				timer.Reset(r.hedgeDelay)
+			} else {
+				hedge = nil
+			}
+		case <-ctx.Done():
+			return nil, ctx.Err()
+		}
+	}
+}
+
+// post sends a gob encoded request, and decodes the gob response.
+func (r *remoteSearcher) post(ctx context.Context, url string, body []byte, resp interface{}) (err error) {
+	start := time.Now()
+	defer func() {
+		outcome := "ok"
+		if err != nil {
+			outcome = "error"
+			if ctx.Err() != nil {
+				outcome = "canceled"
+			}
+		}
+		metricBackendRequestsTotal.WithLabelValues(outcome).Inc()
+		metricBackendRequestDuration.Observe(time.Since(start).Seconds())
+	}()
+
+	req, err := http.NewRequest(http.MethodPost, url, bytes.NewReader(body))
+	if err != nil {
+		return err
+	}
+	req = req.WithContext(ctx)
+	req.Header.Set("Content-Type", web.GobContentType)
+	req.Header.Set("Accept", web.GobContentType)
+
+	res, err := r.client.Do(req)
+	if err != nil {
+		return err
+	}
+	defer res.Body.Close()
+	if res.StatusCode != http.StatusOK {
+		msg, _ := ioutil.ReadAll(io.LimitReader(res.Body, 1024))
+		return fmt.Errorf("%s: %s: %s", url, res.Status, bytes.TrimSpace(msg))
+	}
+	return gob.NewDecoder(res.Body).Decode(resp)
+}
@@ -0,0 +1,345 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package shards
+
+import (
+	"context"
+	"fmt"
+	"os"
+	"sort"
+	"strings"
+	"sync"
+	"sync/atomic"
+	"time"
+
+	"github.com/google/zoekt"
+	"github.com/google/zoekt/query"
+	"github.com/prometheus/client_golang/prometheus"
+	"github.com/prometheus/client_golang/prometheus/promauto"
+)
+
+var (
+	metricShardsOpen = promauto.NewGauge(prometheus.GaugeOpts{
+		Name: "zoekt_shards_open",
+		Help: "The number of shards whose index is open, if a memory budget is set",
+	})
+	metricShardsOpenBytes = promauto.NewGauge(prometheus.GaugeOpts{
+		Name: "zoekt_shards_open_bytes",
+		Help: "The size of the open index files, if a memory budget is set",
+	})
+	metricShardOpenDuration = promauto.NewHistogram(prometheus.HistogramOpts{
+		Name:    "zoekt_shard_open_duration_seconds",
+		Help:    "The time it took to open an evicted shard on its first use",
+		Buckets: prometheus.ExponentialBuckets(0.001, 4, 8), // 1ms to 16s
+	})
+	metricShardEvictionsTotal = promauto.NewCounter(prometheus.CounterOpts{
+		Name: "zoekt_shard_evictions_total",
+		Help: "The total number of shards closed to stay within the memory budget",
+	})
+	metricShardEvictionDuration = promauto.NewHistogram(prometheus.HistogramOpts{
+		Name:    "zoekt_shard_eviction_duration_seconds",
+		Help:    "The time an eviction pass took",
+		Buckets: prometheus.ExponentialBuckets(0.0001, 4, 8), // 100us to 1.6s
+	})
+)
+
+// residencyManager tracks the open shards of a shardedSearcher that
+// has a memory budget.
+type residencyManager struct {
+	// budget is the total size of index files that may stay open.
+	budget int64
+
+	// Accessed atomically.
+	openBytes  int64
+	openShards int64
+	evicting   int32
+
+	mu     sync.Mutex
+	shards map[*lazyShard]struct{}
+}
+
+func newResidencyManager(budget int64) *residencyManager {
+	return &residencyManager{
+		budget: budget,
+		shards: map[*lazyShard]struct{}{},
+	}
+}
+
+func (m *residencyManager) opened(size int64) {
+	metricShardsOpenBytes.Set(float64(atomic.AddInt64(&m.openBytes, size)))
+	metricShardsOpen.Set(float64(atomic.AddInt64(&m.openShards, 1)))
+}
+
+func (m *residencyManager) closed(size int64) {
+	metricShardsOpenBytes.Set(float64(atomic.AddInt64(&m.openBytes, -size)))
+	metricShardsOpen.Set(float64(atomic.AddInt64(&m.openShards, -1)))
+}
+
+func (m *residencyManager) overBudget() bool {
+	return atomic.LoadInt64(&m.openBytes) > m.budget
+}
+
+// ngramFilterer is implemented by index shards.
+type ngramFilterer interface {
+	NgramFilter() *zoekt.NgramFilter
+}
+
+// lazyShard is a shard that may be closed while it is idle, and is
+// opened again when a search needs it. It keeps the repository
+// metadata and an ngram filter, so it can answer List and skip
+// searches for other repositories or for text it does not contain
+// without touching the index.
+type lazyShard struct {
+	fn     string
+	size   int64
+	repo   zoekt.RepoListEntry
+	filter *zoekt.NgramFilter
+	m      *residencyManager
+
+	// refs is the reference count of the rankedShard holding
+	// this shard. The shard is idle if only the shard set holds
+	// it. Accessed atomically.
+	refs int32
+
+	// lastUsed is the UnixNano time of the last search. Accessed
+	// atomically.
+	lastUsed int64
+
+	mu sync.Mutex
+	// s is nil while the shard is evicted.
+	s zoekt.Searcher
+}
+
+// newLazyShard wraps the open shard s, loaded from fn.
+func newLazyShard(fn string, s zoekt.Searcher, m *residencyManager) (*lazyShard, error) {
+	fi, err := os.Stat(fn)
+	if err != nil {
+		return nil, err
+	}
+	rl, err := s.List(context.Background(), &query.Repo{})
+	if err != nil {
+		return nil, err
+	}
+	if len(rl.Repos) != 1 {
+		return nil, fmt.Errorf("%s: got %d repositories, want 1", fn, len(rl.Repos))
+	}
+
+	ls := &lazyShard{
+		fn:   fn,
+		size: fi.Size(),
+		repo: *rl.Repos[0],
+		m:    m,
+		s:    s,
+	}
+	if f, ok := s.(ngramFilterer); ok {
+		ls.filter = f.NgramFilter()
+	}
+	m.opened(ls.size)
+
+	m.mu.Lock()
+	m.shards[ls] = struct{}{}
+	m.mu.Unlock()
+	return ls, nil
+}
+
+func (s *lazyShard) String() string {
+	return s.fn
+}
+
+// simplify resolves the repository atoms of q.
+func (s *lazyShard) simplify(q query.Q) query.Q {
+	return query.Simplify(query.Map(q, func(q query.Q) query.Q {
+		if r, ok := q.(*query.Repo); ok {
+			return &query.Const{Value: strings.Contains(s.repo.Repository.Name, r.Pattern)}
+		}
+		return q
+	}))
+}
+
+// open returns the shard, loading it if it was evicted.
+func (s *lazyShard) open() (zoekt.Searcher, error) {
+	atomic.StoreInt64(&s.lastUsed, time.Now().UnixNano())
+
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	if s.s != nil {
+		return s.s, nil
+	}
+
+	start := time.Now()
+	sh, err := loadShard(s.fn)
+	if err != nil {
+		return nil, err
+	}
+	metricShardOpenDuration.Observe(time.Since(start).Seconds())
+	s.s = sh
+	s.m.opened(s.size)
+	// Make room while the search that needs this shard is still
+	// running, rather than after it.
+	s.m.maybeEvict()
+	return sh, nil
+}
+
+// isOpen returns whether the index of the shard is open.
+func (s *lazyShard) isOpen() bool {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	return s.s != nil
+}
+
+// evictIdle closes the index unless a search or a search result is
+// using the shard. It returns whether it closed the index.
+func (s *lazyShard) evictIdle() bool {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	// Searches pin the shard before opening it, so either we see
+	// the pin, or the search waits for mu and opens the shard
+	// again.
+	if s.s == nil || atomic.LoadInt32(&s.refs) > 1 {
+		return false
+	}
+	s.close()
+	return true
+}
+
+// close closes the index. Must be called with mu held.
+func (s *lazyShard) close() {
+	if s.s == nil {
+		return
+	}
+	s.s.Close()
+	s.s = nil
+	s.m.closed(s.size)
+}
+
+func (s *lazyShard) Close() {
+	s.m.mu.Lock()
+	delete(s.m.shards, s)
+	s.m.mu.Unlock()
+
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	s.close()
+}
+
+func (s *lazyShard) Search(ctx context.Context, q query.Q, opts *zoekt.SearchOptions) (*zoekt.SearchResult, error) {
+	sq := s.simplify(q)
+	if c, ok := sq.(*query.Const); ok && !c.Value {
+		return &zoekt.SearchResult{}, nil
+	}
+	if opts.EstimateDocCount {
+		// Like the shard, count all documents of the repository,
+		// but without loading it. Branch atoms are not resolved,
+		// so the estimate may be high.
+		var res zoekt.SearchResult
+		res.Stats.ShardFilesConsidered = s.repo.Stats.Documents
+		return &res, nil
+	}
+	if s.filter != nil && !s.filter.MayMatch(sq) {
+		return &zoekt.SearchResult{}, nil
+	}
+	if ctx.Err() != nil {
+		// Like the shard, but without loading it.
+		var res zoekt.SearchResult
+		res.Stats.ShardsSkipped = 1
+		res.Stats.Truncated = true
+		if opts.Paginate {
+			res.ResumeDocs = []uint32{opts.StartDoc}
+		}
+		return &res, nil
+	}
+	sh, err := s.open()
+	if err != nil {
+		return nil, err
+	}
+	return sh.Search(ctx, q, opts)
+}
+
+func (s *lazyShard) List(ctx context.Context, q query.Q) (*zoekt.RepoList, error) {
+	if c, ok := s.simplify(q).(*query.Const); ok {
+		l := &zoekt.RepoList{}
+		if c.Value {
+			repo := s.repo
+			l.Repos = append(l.Repos, &repo)
+		}
+		return l, nil
+	}
+	sh, err := s.open()
+	if err != nil {
+		return nil, err
+	}
+	return sh.List(ctx, q)
+}
+
+// MatchTreeString implements matchTreeExplainer. It does not open an
+// evicted shard.
+func (s *lazyShard) MatchTreeString(q query.Q) string {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	if e, ok := s.s.(matchTreeExplainer); ok {
+		return e.MatchTreeString(q)
+	}
+	return ""
+}
+
+// Residency implements residencyReporter. Evicted shards have nothing
+// resident.
+func (s *lazyShard) Residency() ([]zoekt.SectionResidency, error) {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	if rr, ok := s.s.(residencyReporter); ok {
+		return rr.Residency()
+	}
+	return nil, fmt.Errorf("%s: not open", s.fn)
+}
+
+// maybeEvict starts an eviction pass in the background if the open
+// shards exceed the memory budget. m may be nil.
+func (m *residencyManager) maybeEvict() {
+	if m == nil || !m.overBudget() || !atomic.CompareAndSwapInt32(&m.evicting, 0, 1) {
+		return
+	}
+	go func() {
+		defer atomic.StoreInt32(&m.evicting, 0)
+		m.evict()
+	}()
+}
+
+// evict closes the least recently used idle shards until the open
+// shards fit the memory budget. It runs concurrently with searches;
+// shards that they are searching or that their results pin are kept.
+func (m *residencyManager) evict() {
+	start := time.Now()
+
+	m.mu.Lock()
+	open := make([]*lazyShard, 0, len(m.shards))
+	for ls := range m.shards {
+		open = append(open, ls)
+	}
+	m.mu.Unlock()
+	sort.Slice(open, func(i, j int) bool {
+		return atomic.LoadInt64(&open[i].lastUsed) < atomic.LoadInt64(&open[j].lastUsed)
+	})
+
+	for _, ls := range open {
+		if !m.overBudget() {
+			break
+		}
+		if ls.evictIdle() {
+			metricShardEvictionsTotal.Inc()
+		}
+	}
+	metricShardEvictionDuration.Observe(time.Since(start).Seconds())
+}
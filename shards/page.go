@@ -0,0 +1,226 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package shards
+
+import (
+	"context"
+	"encoding/base64"
+	"encoding/json"
+	"fmt"
+	"hash/fnv"
+	"sync"
+
+	"github.com/google/zoekt"
+	"github.com/google/zoekt/query"
+)
+
+// pageCursor is the decoded form of SearchResult.NextCursor. Pages
+// walk the shards in rank order, and each shard in document order, so
+// at most one shard is partially done at any time.
+type pageCursor struct {
+	// Generation is the rankedVersion of the shard set.
+	Generation uint64
+
+	// Query is a hash of the query the cursor belongs to.
+	Query uint64
+
+	// Shard is the name of the shard to continue with, starting
+	// at document Doc.
+	Shard string
+	Doc   uint32
+}
+
+func queryHash(q query.Q) uint64 {
+	h := fnv.New64a()
+	h.Write([]byte(q.String()))
+	return h.Sum64()
+}
+
+func (c *pageCursor) encode() string {
+	data, _ := json.Marshal(c)
+	return base64.RawURLEncoding.EncodeToString(data)
+}
+
+func decodeCursor(s string) (*pageCursor, error) {
+	data, err := base64.RawURLEncoding.DecodeString(s)
+	if err != nil {
+		return nil, fmt.Errorf("invalid cursor: %v", err)
+	}
+	var c pageCursor
+	if err := json.Unmarshal(data, &c); err != nil {
+		return nil, fmt.Errorf("invalid cursor: %v", err)
+	}
+	return &c, nil
+}
+
+// searchPage fills aggregate with the page of a paginated search that
+// starts at opts.Cursor, and sets its NextCursor. It returns the
+// shards pinned for the result. Must be called under rlock.
+func (ss *shardedSearcher) searchPage(ctx context.Context, shards []rankedShard, q query.Q, opts *zoekt.SearchOptions, aggregate *zoekt.SearchResult) (pinned []rankedShard, err error) {
+	qh := queryHash(q)
+	var startDoc uint32
+	if opts.Cursor != "" {
+		c, err := decodeCursor(opts.Cursor)
+		if err != nil {
+			return nil, err
+		}
+		if c.Query != qh {
+			return nil, fmt.Errorf("cursor belongs to a different query")
+		}
+		if c.Generation != ss.rankedVersion {
+			return nil, fmt.Errorf("cursor expired: the loaded shards changed")
+		}
+
+		first := -1
+		for i, s := range shards {
+			if s.name == c.Shard {
+				first = i
+				break
+			}
+		}
+		if first < 0 {
+			return nil, fmt.Errorf("cursor names unknown shard %q", c.Shard)
+		}
+		shards = shards[first:]
+		startDoc = c.Doc
+	}
+
+	var childCtx context.Context
+	var cancel context.CancelFunc
+	if opts.MaxWallTime == 0 {
+		childCtx, cancel = context.WithCancel(ctx)
+	} else {
+		childCtx, cancel = context.WithTimeout(ctx, opts.MaxWallTime)
+	}
+	defer cancel()
+
+	// Shards are searched in parallel, but their results are
+	// consumed in rank order, so each shard gets its own sink.
+	// Once the page is full, the remaining searches are canceled.
+	sinks := make([]chan shardResult, len(shards))
+	feeder := make(chan int, len(shards))
+	for i := range shards {
+		sinks[i] = make(chan shardResult, 1)
+		feeder <- i
+	}
+	close(feeder)
+
+	shardOpts := *opts
+	shardOpts.Paginate = true
+	shardOpts.Cursor = ""
+	var wg sync.WaitGroup
+	for i := 0; i < ss.searchWorkers(); i++ {
+		wg.Add(1)
+		go func() {
+			defer wg.Done()
+			for i := range feeder {
+				o := shardOpts
+				if i == 0 {
+					o.StartDoc = startDoc
+				}
+				searchOneShard(childCtx, shards[i], q, &o, sinks[i])
+			}
+		}()
+	}
+
+	// The caller releases rlock once we return, after which the
+	// shards may be closed. Skip the shards not started yet, wait
+	// for the running searches, and release the results we did not
+	// receive.
+	received := 0
+	defer func() {
+		cancel()
+		for range feeder {
+		}
+		wg.Wait()
+		for _, sink := range sinks[received:] {
+			select {
+			case r := <-sink:
+				r.release()
+			default:
+			}
+		}
+	}()
+
+	defer func() {
+		if err != nil {
+			for _, s := range pinned {
+				s.unpin()
+			}
+		}
+	}()
+
+	max := opts.MaxDocDisplayCount
+	var next *pageCursor
+	for i, s := range shards {
+		r := <-sinks[i]
+		received++
+		if r.err != nil {
+			r.release()
+			return pinned, r.err
+		}
+		aggregate.Stats.Add(r.sr.Stats)
+
+		files, resume := r.sr.Files, r.sr.ResumeDocs
+		if len(resume) < len(files) {
+			r.release()
+			return pinned, fmt.Errorf("shard %s does not support pagination", s.String())
+		}
+
+		n := len(files)
+		if max > 0 && len(aggregate.Files)+n > max {
+			n = max - len(aggregate.Files)
+		}
+		if n > 0 && s.refs != nil {
+			// Keep the pin for the result.
+			pinned = append(pinned, s)
+		} else {
+			r.release()
+		}
+		if n > 0 {
+			aggregate.Files = append(aggregate.Files, files[:n]...)
+			for k, v := range r.sr.RepoURLs {
+				aggregate.RepoURLs[k] = v
+			}
+			for k, v := range r.sr.LineFragments {
+				aggregate.LineFragments[k] = v
+			}
+		}
+
+		if n < len(files) {
+			// The page filled up within this shard.
+			next = &pageCursor{Shard: s.name, Doc: resume[n-1]}
+			break
+		}
+		if len(resume) > len(files) {
+			// The shard stopped before its end.
+			next = &pageCursor{Shard: s.name, Doc: resume[len(files)]}
+			break
+		}
+		if max > 0 && len(aggregate.Files) == max {
+			if i+1 < len(shards) {
+				next = &pageCursor{Shard: shards[i+1].name}
+			}
+			break
+		}
+	}
+
+	if next != nil {
+		next.Generation = ss.rankedVersion
+		next.Query = qh
+		aggregate.NextCursor = next.encode()
+	}
+	return pinned, nil
+}
@@ -0,0 +1,189 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package shards
+
+import (
+	"context"
+	"fmt"
+	"net/http"
+	"path/filepath"
+	"sort"
+	"text/tabwriter"
+	"time"
+
+	"github.com/google/zoekt"
+	"github.com/prometheus/client_golang/prometheus"
+	"github.com/prometheus/client_golang/prometheus/promauto"
+)
+
+var (
+	metricShardMappedBytes = promauto.NewGaugeVec(prometheus.GaugeOpts{
+		Name: "zoekt_shard_mapped_bytes",
+		Help: "The size of the loaded shards, per kind of index data",
+	}, []string{"section"})
+	metricShardResidentBytes = promauto.NewGaugeVec(prometheus.GaugeOpts{
+		Name: "zoekt_shard_resident_bytes",
+		Help: "The bytes of the loaded shards that are in the page cache, per kind of index data",
+	}, []string{"section"})
+)
+
+// residencyInterval is how often the directory searcher samples the
+// page cache residency of its shards.
+const residencyInterval = time.Minute
+
+// ShardResidency reports how much of a shard is held in memory.
+type ShardResidency struct {
+	Shard    string
+	Sections []zoekt.SectionResidency
+}
+
+// Resident returns the resident bytes over all sections.
+func (r *ShardResidency) Resident() int64 {
+	var n int64
+	for _, s := range r.Sections {
+		n += s.Resident
+	}
+	return n
+}
+
+// Bytes returns the size of the shard.
+func (r *ShardResidency) Bytes() int64 {
+	var n int64
+	for _, s := range r.Sections {
+		n += s.Bytes
+	}
+	return n
+}
+
+type residencyReporter interface {
+	Residency() ([]zoekt.SectionResidency, error)
+}
+
+// Residency samples the page cache residency of the loaded shards,
+// most resident first. Shards that can't report it are skipped.
+func (ss *shardedSearcher) Residency() []ShardResidency {
+	if err := ss.rlock(context.Background()); err != nil {
+		return nil
+	}
+	defer ss.runlock()
+
+	var res []ShardResidency
+	for _, s := range ss.getShards() {
+		rr, ok := s.Searcher.(residencyReporter)
+		if !ok {
+			continue
+		}
+		sections, err := rr.Residency()
+		if err != nil {
+			continue
+		}
+		res = append(res, ShardResidency{Shard: s.name, Sections: sections})
+	}
+	sort.SliceStable(res, func(i, j int) bool {
+		return res[i].Resident() > res[j].Resident()
+	})
+	return res
+}
+
+// observeResidency exports the residency, summed per section. Per shard
+// numbers are only on the debug page, to keep the metric cardinality
+// independent of the number of shards.
+func observeResidency(rs []ShardResidency) {
+	mapped := map[string]int64{}
+	resident := map[string]int64{}
+	for _, r := range rs {
+		for _, s := range r.Sections {
+			mapped[s.Section] += s.Bytes
+			resident[s.Section] += s.Resident
+		}
+	}
+	for section, n := range mapped {
+		metricShardMappedBytes.WithLabelValues(section).Set(float64(n))
+		metricShardResidentBytes.WithLabelValues(section).Set(float64(resident[section]))
+	}
+}
+
+// sampleResidency updates the residency metrics every interval until
+// quit is closed.
+func (ss *shardedSearcher) sampleResidency(interval time.Duration, quit <-chan struct{}) {
+	t := time.NewTicker(interval)
+	defer t.Stop()
+	for {
+		observeResidency(ss.Residency())
+		select {
+		case <-t.C:
+		case <-quit:
+			return
+		}
+	}
+}
+
+// ResidencyHandler serves a plain text table with the page cache
+// residency of each shard of s, which should be returned by
+// NewDirectorySearcher.
+func ResidencyHandler(s zoekt.Searcher) http.Handler {
+	return http.HandlerFunc(func(w http.ResponseWriter, r *http.Request) {
+		rr, ok := s.(interface{ Residency() []ShardResidency })
+		if !ok {
+			http.Error(w, "searcher does not report residency", http.StatusNotImplemented)
+			return
+		}
+		rs := rr.Residency()
+
+		w.Header().Set("Content-Type", "text/plain; charset=utf-8")
+		var sections []string
+		if len(rs) > 0 {
+			for _, s := range rs[0].Sections {
+				sections = append(sections, s.Section)
+			}
+		}
+
+		tw := tabwriter.NewWriter(w, 0, 8, 2, ' ', tabwriter.AlignRight)
+		fmt.Fprint(tw, "resident\tsize\t")
+		for _, s := range sections {
+			fmt.Fprintf(tw, "%s\t", s)
+		}
+		fmt.Fprint(tw, "shard\t\n")
+
+		var total ShardResidency
+		for _, r := range rs {
+			fmt.Fprintf(tw, "%s\t%s\t", formatBytes(r.Resident()), formatBytes(r.Bytes()))
+			for _, s := range r.Sections {
+				fmt.Fprintf(tw, "%s\t", formatBytes(s.Resident))
+			}
+			fmt.Fprintf(tw, "%s\t\n", filepath.Base(r.Shard))
+			total.Sections = append(total.Sections, r.Sections...)
+		}
+		fmt.Fprintf(tw, "%s\t%s\t", formatBytes(total.Resident()), formatBytes(total.Bytes()))
+		for range sections {
+			fmt.Fprint(tw, "\t")
+		}
+		fmt.Fprintf(tw, "total (%d shards)\t\n", len(rs))
+		tw.Flush()
+	})
+}
+
+func formatBytes(n int64) string {
+	const unit = 1024
+	if n < unit {
+		return fmt.Sprintf("%dB", n)
+	}
+	div, exp := int64(unit), 0
+	for m := n / unit; m >= unit; m /= unit {
+		div *= unit
+		exp++
+	}
+	return fmt.Sprintf("%.1f%ciB", float64(n)/float64(div), "KMGTPE"[exp])
+}
@@ -22,6 +22,8 @@ import (
 	"runtime"
 	"runtime/debug"
 	"sort"
+	"sync"
+	"sync/atomic"
 	"time"
 
 	"golang.org/x/net/trace"
@@ -46,6 +48,19 @@ var (
 		Name: "zoekt_shards_load_failed_total",
 		Help: "The total number of shard loads that failed",
 	})
+	metricShardsPending = promauto.NewGauge(prometheus.GaugeOpts{
+		Name: "zoekt_shards_pending",
+		Help: "The number of shards found on disk that are waiting to be loaded",
+	})
+	metricShardLoadDuration = promauto.NewHistogram(prometheus.HistogramOpts{
+		Name:    "zoekt_shard_load_duration_seconds",
+		Help:    "The time it took to load a shard",
+		Buckets: prometheus.ExponentialBuckets(0.001, 4, 8), // 1ms to 16s
+	})
+	metricShardSwapsTotal = promauto.NewCounter(prometheus.CounterOpts{
+		Name: "zoekt_shard_swaps_total",
+		Help: "The total number of times the set of loaded shards changed",
+	})
 
 	metricSearchRunning = promauto.NewGauge(prometheus.GaugeOpts{
 		Name: "zoekt_search_running",
@@ -64,6 +79,20 @@ var (
 		Help:    "The duration a search request took in seconds",
 		Buckets: prometheus.DefBuckets, // DefBuckets good for service timings
 	})
+	metricSearchMemoryBytes = promauto.NewHistogram(prometheus.HistogramOpts{
+		Name:    "zoekt_search_memory_bytes",
+		Help:    "The memory accounted to the matches and results of a search request",
+		Buckets: prometheus.ExponentialBuckets(1024, 4, 10), // 1KB to 256MB
+	})
+	metricSearchMemoryBudgetExceededTotal = promauto.NewCounter(prometheus.CounterOpts{
+		Name: "zoekt_search_memory_budget_exceeded_total",
+		Help: "The total number of search requests that stopped early because they used up their memory budget",
+	})
+	metricSearchPhaseDuration = promauto.NewHistogramVec(prometheus.HistogramOpts{
+		Name:    "zoekt_search_phase_duration_seconds",
+		Help:    "The time a search request spent per phase, summed over shards",
+		Buckets: prometheus.ExponentialBuckets(0.0001, 4, 10), // 100us to 26s
+	}, []string{"phase"})
 
 	// A Counter per Stat. Name should match field in zoekt.Stats.
 	metricSearchContentBytesLoadedTotal = promauto.NewCounter(prometheus.CounterOpts{
@@ -124,6 +153,28 @@ var (
 type rankedShard struct {
 	zoekt.Searcher
 	rank uint16
+
+	// name is the key of the shard in shardedSearcher.shards.
+	name string
+
+	// refs counts the users of the shard: one for the shard set,
+	// plus one for each search running on it or result pinning it.
+	// It may be nil for shards that are never pinned.
+	refs *int32
+}
+
+// pin keeps the shard open until a matching unpin, even if it is
+// replaced in the meantime. Must be called under rlock.
+func (s *rankedShard) pin() {
+	atomic.AddInt32(s.refs, 1)
+}
+
+// unpin drops a reference, and closes the shard once it is no longer
+// part of the shard set nor pinned by a search result.
+func (s *rankedShard) unpin() {
+	if s.refs == nil || atomic.AddInt32(s.refs, -1) == 0 {
+		s.Close()
+	}
 }
 
 type shardedSearcher struct {
@@ -138,6 +189,34 @@ type shardedSearcher struct {
 
 	rankedVersion uint64
 	ranked        []rankedShard
+
+	// docCounts caches the EstimateDocCount result per query
+	// string for the shard set with version docCountsVersion.
+	docCountsMu      sync.Mutex
+	docCountsVersion uint64
+	docCounts        map[string]int
+
+	// residency is set if the shards have a memory budget.
+	residency *residencyManager
+
+	// pending is the number of shards waiting to be loaded.
+	// Accessed atomically.
+	pending int64
+
+	// workers is the number of shards that a search queries in
+	// parallel. If zero, it is GOMAXPROCS.
+	workers int
+
+	// remoteLimits is set if the shards apply the LimitPolicy
+	// themselves, so no document count is estimated for it.
+	remoteLimits bool
+}
+
+func (ss *shardedSearcher) searchWorkers() int {
+	if ss.workers > 0 {
+		return ss.workers
+	}
+	return runtime.GOMAXPROCS(0)
 }
 
 func newShardedSearcher(n int64) *shardedSearcher {
@@ -152,52 +231,203 @@ func newShardedSearcher(n int64) *shardedSearcher {
 // NewDirectorySearcher returns a searcher instance that loads all
 // shards corresponding to a glob into memory.
 func NewDirectorySearcher(dir string) (zoekt.Searcher, error) {
+	return NewDirectorySearcherWithOptions(dir, DirectorySearcherOptions{})
+}
+
+// DirectorySearcherOptions configures NewDirectorySearcherWithOptions.
+type DirectorySearcherOptions struct {
+	// MemoryBudget caps the total size of the index files that are
+	// kept open, in bytes. When it is exceeded, the least recently
+	// searched shards are closed; only their repository metadata
+	// stays in memory, and they are opened again on their next
+	// search. Zero means no limit.
+	MemoryBudget int64
+
+	// LoadInBackground makes NewDirectorySearcherWithOptions
+	// return before the shards are loaded. Until they are,
+	// searches cover the shards loaded so far, and report the
+	// others in Stats.ShardsPending.
+	LoadInBackground bool
+
+	// Manifest, if set, is a file listing the base names of the
+	// shards to serve, one per line, as written by
+	// placement.WriteManifest. Other shards in the directory are
+	// ignored. The manifest is reread when it changes. Replace it
+	// by renaming a new file over it: an empty manifest, or one
+	// without a final newline, is taken for a partial write and
+	// ignored.
+	Manifest string
+}
+
+// NewDirectorySearcherWithOptions is like NewDirectorySearcher, with
+// options.
+func NewDirectorySearcherWithOptions(dir string, opts DirectorySearcherOptions) (zoekt.Searcher, error) {
 	ss := newShardedSearcher(int64(runtime.GOMAXPROCS(0)))
+	if opts.MemoryBudget > 0 {
+		ss.residency = newResidencyManager(opts.MemoryBudget)
+	}
 	tl := &loader{
 		ss: ss,
 	}
-	dw, err := NewDirectoryWatcher(dir, tl)
+	dw, err := newDirectoryWatcher(dir, tl, opts.LoadInBackground, opts.Manifest)
 	if err != nil {
 		return nil, err
 	}
 
+	quit := make(chan struct{})
+	go ss.sampleResidency(residencyInterval, quit)
+
 	return &directorySearcher{
-		Searcher:         ss,
+		shardedSearcher:  ss,
 		directoryWatcher: dw,
+		quitResidency:    quit,
 	}, nil
 }
 
 type directorySearcher struct {
-	zoekt.Searcher
+	*shardedSearcher
 
 	directoryWatcher *DirectoryWatcher
+	quitResidency    chan struct{}
 }
 
 func (s *directorySearcher) Close() {
+	close(s.quitResidency)
+
 	// We need to Stop directoryWatcher first since it calls load/unload on
 	// Searcher.
 	s.directoryWatcher.Stop()
-	s.Searcher.Close()
+	s.shardedSearcher.Close()
 }
 
 type loader struct {
 	ss *shardedSearcher
 }
 
-func (tl *loader) load(key string) {
+const (
+	// Loaded shards are swapped into the shard set in batches of at
+	// most maxLoadBatch, and at least every loadBatchInterval.
+	maxLoadBatch      = 256
+	loadBatchInterval = time.Second
+)
+
+func (tl *loader) addPending(n int) {
+	tl.ss.addPending(n)
+}
+
+// load loads the given shards, in order, GOMAXPROCS at a time. Loaded
+// shards are added to the shard set in batches, so searches are not
+// blocked for every single shard, and can cover the shards loaded so
+// far.
+func (tl *loader) load(keys ...string) {
+	work := make(chan string)
+	go func() {
+		for _, k := range keys {
+			work <- k
+		}
+		close(work)
+	}()
+
+	type loaded struct {
+		key   string
+		shard zoekt.Searcher
+	}
+	results := make(chan loaded)
+	var wg sync.WaitGroup
+	for i := 0; i < runtime.GOMAXPROCS(0); i++ {
+		wg.Add(1)
+		go func() {
+			defer wg.Done()
+			for k := range work {
+				results <- loaded{k, tl.loadOne(k)}
+			}
+		}()
+	}
+	go func() {
+		wg.Wait()
+		close(results)
+	}()
+
+	ticker := time.NewTicker(loadBatchInterval)
+	defer ticker.Stop()
+
+	batch := map[string]zoekt.Searcher{}
+	done := 0
+	flush := func() {
+		if len(batch) > 0 {
+			tl.ss.replaceAll(batch)
+			batch = map[string]zoekt.Searcher{}
+			tl.ss.residency.maybeEvict()
+		}
+		tl.ss.addPending(-done)
+		done = 0
+	}
+
+	lastProgress := time.Now()
+	for left := len(keys); ; {
+		select {
+		case r, ok := <-results:
+			if !ok {
+				flush()
+				return
+			}
+			left--
+			done++
+			if r.shard != nil {
+				batch[r.key] = r.shard
+			}
+			if len(batch) >= maxLoadBatch {
+				flush()
+			}
+			// If taking a while to start-up occasionally give a progress message
+			if time.Since(lastProgress) > 10*time.Second {
+				log.Printf("still need to load %d shards...", left)
+				lastProgress = time.Now()
+			}
+		case <-ticker.C:
+			flush()
+		}
+	}
+}
+
+// loadOne opens a shard, or returns nil if that fails.
+func (tl *loader) loadOne(key string) zoekt.Searcher {
+	start := time.Now()
 	shard, err := loadShard(key)
 	if err != nil {
 		metricShardsLoadFailedTotal.Inc()
 		log.Printf("reloading: %s, err %v ", key, err)
-		return
+		return nil
+	}
+
+	if tl.ss.residency != nil {
+		ls, err := newLazyShard(key, shard, tl.ss.residency)
+		if err != nil {
+			shard.Close()
+			metricShardsLoadFailedTotal.Inc()
+			log.Printf("reloading: %s, err %v ", key, err)
+			return nil
+		}
+		shard = ls
 	}
 
 	metricShardsLoadedTotal.Inc()
-	tl.ss.replace(key, shard)
+	metricShardLoadDuration.Observe(time.Since(start).Seconds())
+	return shard
 }
 
-func (tl *loader) drop(key string) {
-	tl.ss.replace(key, nil)
+func (tl *loader) drop(keys ...string) {
+	batch := map[string]zoekt.Searcher{}
+	for _, k := range keys {
+		batch[k] = nil
+	}
+	tl.ss.replaceAll(batch)
+}
+
+// addPending adjusts the number of shards that are waiting to be
+// loaded.
+func (ss *shardedSearcher) addPending(n int) {
+	metricShardsPending.Set(float64(atomic.AddInt64(&ss.pending, int64(n))))
 }
 
 func (ss *shardedSearcher) String() string {
@@ -209,12 +439,36 @@ func (ss *shardedSearcher) Close() {
 	ss.lock()
 	defer ss.unlock()
 	for _, s := range ss.shards {
-		s.Close()
+		s.unpin()
 	}
 	ss.shards = make(map[string]rankedShard)
+	ss.ranked = nil
+}
+
+func (ss *shardedSearcher) Search(ctx context.Context, q query.Q, opts *zoekt.SearchOptions) (*zoekt.SearchResult, error) {
+	sr, release, err := ss.SearchPinned(ctx, q, opts)
+	if err != nil {
+		return sr, err
+	}
+	defer release()
+
+	for i := range sr.Files {
+		copySlice(&sr.Files[i].Content)
+		copySlice(&sr.Files[i].Checksum)
+		for l := range sr.Files[i].LineMatches {
+			copySlice(&sr.Files[i].LineMatches[l].Line)
+			copySlice(&sr.Files[i].LineMatches[l].Before)
+			copySlice(&sr.Files[i].LineMatches[l].After)
+		}
+	}
+	return sr, nil
 }
 
-func (ss *shardedSearcher) Search(ctx context.Context, q query.Q, opts *zoekt.SearchOptions) (sr *zoekt.SearchResult, err error) {
+// SearchPinned implements zoekt.PinningSearcher. The shards that
+// contributed files to the result stay open until release is called,
+// so the result can refer to their memory without copying it.
+func (ss *shardedSearcher) SearchPinned(ctx context.Context, q query.Q, opts *zoekt.SearchOptions) (sr *zoekt.SearchResult, release func(), err error) {
+	release = func() {}
 	tr := trace.New("shardedSearcher.Search", "")
 	tr.LazyLog(q, true)
 	tr.LazyPrintf("opts: %+v", opts)
@@ -222,6 +476,7 @@ func (ss *shardedSearcher) Search(ctx context.Context, q query.Q, opts *zoekt.Se
 	metricSearchRunning.Inc()
 	defer func() {
 		metricSearchRunning.Dec()
+		ss.residency.maybeEvict()
 		metricSearchDuration.Observe(time.Since(overallStart).Seconds())
 		if sr != nil {
 			metricSearchContentBytesLoadedTotal.Add(float64(sr.Stats.ContentBytesLoaded))
@@ -235,6 +490,11 @@ func (ss *shardedSearcher) Search(ctx context.Context, q query.Q, opts *zoekt.Se
 			metricSearchShardsSkippedTotal.Add(float64(sr.Stats.ShardsSkipped))
 			metricSearchMatchCountTotal.Add(float64(sr.Stats.MatchCount))
 			metricSearchNgramMatchesTotal.Add(float64(sr.Stats.NgramMatches))
+			observePhases(&sr.Stats)
+			metricSearchMemoryBytes.Observe(float64(sr.Stats.MemoryBytes))
+			if sr.Stats.MemoryBudgetExceeded {
+				metricSearchMemoryBudgetExceededTotal.Inc()
+			}
 
 			tr.LazyPrintf("num files: %d", len(sr.Files))
 			tr.LazyPrintf("stats: %+v", sr.Stats)
@@ -258,14 +518,40 @@ func (ss *shardedSearcher) Search(ctx context.Context, q query.Q, opts *zoekt.Se
 	// This critical section is large, but we don't want to deal with
 	// searches on shards that have just been closed.
 	if err := ss.rlock(ctx); err != nil {
-		return aggregate, err
+		return aggregate, release, err
 	}
 	defer ss.runlock()
 	tr.LazyPrintf("acquired lock")
 	aggregate.Wait = time.Since(start)
+	aggregate.Stats.ShardsPending = int(atomic.LoadInt64(&ss.pending))
 	start = time.Now()
 
 	shards := ss.getShards()
+
+	if opts.LimitPolicy != nil && !opts.EstimateDocCount && !ss.remoteLimits {
+		numDocs := ss.estimateDocCount(ctx, shards, q)
+		tr.LazyPrintf("estimated doc count: %d", numDocs)
+
+		copyOpts := *opts
+		copyOpts.LimitPolicy = nil
+		opts.LimitPolicy(numDocs, &copyOpts)
+		opts = &copyOpts
+	}
+
+	if opts.MaxMemoryBytes > 0 {
+		// All shards draw from the same budget.
+		ctx = zoekt.WithMemoryBudget(ctx, opts.MaxMemoryBytes)
+	}
+
+	if opts.Paginate || opts.Cursor != "" {
+		pinned, err := ss.searchPage(ctx, shards, q, opts, aggregate)
+		if err != nil {
+			return nil, release, err
+		}
+		aggregate.Duration = time.Since(start)
+		return aggregate, releasePins(pinned), nil
+	}
+
 	all := make(chan shardResult, len(shards))
 
 	var childCtx context.Context
@@ -283,12 +569,12 @@ func (ss *shardedSearcher) Search(ctx context.Context, q query.Q, opts *zoekt.Se
 	// number of parallel searches. This reduces the peak working
 	// set, which hopefully stops https://cs.bazel.build from crashing
 	// when looking for the string "com".
-	feeder := make(chan zoekt.Searcher, len(shards))
+	feeder := make(chan rankedShard, len(shards))
 	for _, s := range shards {
 		feeder <- s
 	}
 	close(feeder)
-	for i := 0; i < runtime.GOMAXPROCS(0); i++ {
+	for i := 0; i < ss.searchWorkers(); i++ {
 		go func() {
 			for s := range feeder {
 				searchOneShard(childCtx, s, q, opts, all)
@@ -296,13 +582,55 @@ func (ss *shardedSearcher) Search(ctx context.Context, q query.Q, opts *zoekt.Se
 		}()
 	}
 
+	var pinned []rankedShard
+	received := 0
+	stop := cancel
+	defer func() {
+		if err != nil {
+			for _, s := range pinned {
+				s.unpin()
+			}
+		}
+		// On errors, wait for the remaining searches, as their
+		// shards stay pinned until they are received.
+		if received < len(shards) {
+			stop()
+			for ; received < len(shards); received++ {
+				r := <-all
+				r.release()
+			}
+		}
+	}()
+
+	var slowest slowShards
+	var mergeDuration time.Duration
+	// limitTruncated is whether the search was truncated when we
+	// canceled it for reaching TotalMaxMatchCount; shards stopped
+	// by that cancel do not count as truncated.
+	limitTruncated, limitCanceled := false, false
 	for range shards {
 		r := <-all
+		received++
+		mergeStart := time.Now()
 		if r.err != nil {
-			return nil, r.err
+			r.release()
+			return nil, release, r.err
+		}
+		slowest.add(r)
+		if len(r.sr.Files) > 0 && r.shard.refs != nil {
+			// Keep the pin for the result.
+			pinned = append(pinned, r.shard)
+		} else {
+			r.release()
 		}
 		aggregate.Files = append(aggregate.Files, r.sr.Files...)
 		aggregate.Stats.Add(r.sr.Stats)
+		if r.sr.Facets != nil {
+			if aggregate.Facets == nil {
+				aggregate.Facets = &zoekt.Facets{}
+			}
+			aggregate.Facets.Add(r.sr.Facets)
+		}
 
 		if len(r.sr.Files) > 0 {
 			for k, v := range r.sr.RepoURLs {
@@ -314,40 +642,200 @@ func (ss *shardedSearcher) Search(ctx context.Context, q query.Q, opts *zoekt.Se
 		}
 
 		if cancel != nil && opts.TotalMaxMatchCount > 0 && aggregate.Stats.MatchCount > opts.TotalMaxMatchCount {
+			limitTruncated = aggregate.Stats.Truncated || childCtx.Err() != nil
+			limitCanceled = true
 			cancel()
 			cancel = nil
 		}
+		mergeDuration += time.Since(mergeStart)
+	}
+	if limitCanceled {
+		aggregate.Stats.Truncated = limitTruncated || ctx.Err() != nil
 	}
 
+	mergeStart := time.Now()
 	zoekt.SortFilesByScore(aggregate.Files)
 	if max := opts.MaxDocDisplayCount; max > 0 && len(aggregate.Files) > max {
 		aggregate.Files = aggregate.Files[:max]
 	}
-	for i := range aggregate.Files {
-		copySlice(&aggregate.Files[i].Content)
-		copySlice(&aggregate.Files[i].Checksum)
-		for l := range aggregate.Files[i].LineMatches {
-			copySlice(&aggregate.Files[i].LineMatches[l].Line)
+	aggregate.MergeDuration = mergeDuration + time.Since(mergeStart)
+
+	explain := opts.ExplainSlowerThan > 0 && time.Since(overallStart) >= opts.ExplainSlowerThan
+	for _, r := range slowest {
+		tr.LazyPrintf("slow shard %s: %v, stats %+v", r.shard.String(), r.duration, r.sr.Stats)
+
+		timing := zoekt.ShardTiming{
+			Shard:    r.shard.String(),
+			Duration: r.duration,
+			Stats:    r.sr.Stats,
+		}
+		if explain {
+			timing.MatchTree = explainShard(r.shard.Searcher, q)
 		}
+		aggregate.SlowestShards = append(aggregate.SlowestShards, timing)
 	}
 
 	aggregate.Duration = time.Since(start)
-	return aggregate, nil
+	return aggregate, releasePins(pinned), nil
+}
+
+// matchTreeExplainer is implemented by index shards.
+type matchTreeExplainer interface {
+	MatchTreeString(q query.Q) string
+}
+
+func explainShard(s zoekt.Searcher, q query.Q) (desc string) {
+	e, ok := s.(matchTreeExplainer)
+	if !ok {
+		return ""
+	}
+	defer func() {
+		if r := recover(); r != nil {
+			desc = fmt.Sprintf("crashed: %v", r)
+		}
+	}()
+	return e.MatchTreeString(q)
+}
+
+// numSlowShards is the number of slowest shards that a search
+// reports on its trace.
+const numSlowShards = 5
+
+// slowShards keeps the numSlowShards slowest results, slowest first.
+type slowShards []shardResult
+
+func (s *slowShards) add(r shardResult) {
+	i := sort.Search(len(*s), func(i int) bool {
+		return (*s)[i].duration < r.duration
+	})
+	if i >= numSlowShards {
+		return
+	}
+	if len(*s) < numSlowShards {
+		*s = append(*s, shardResult{})
+	}
+	copy((*s)[i+1:], (*s)[i:])
+	(*s)[i] = r
+}
+
+func observePhases(st *zoekt.Stats) {
+	for _, p := range []struct {
+		name string
+		d    time.Duration
+	}{
+		{"matchtree", st.MatchTreeDuration},
+		{"iterate", st.IterateDuration},
+		{"verify", st.VerifyDuration},
+		{"regexp", st.RegexpDuration},
+		{"fill", st.FillDuration},
+		{"score", st.ScoreDuration},
+		{"merge", st.MergeDuration},
+	} {
+		metricSearchPhaseDuration.WithLabelValues(p.name).Observe(p.d.Seconds())
+	}
+}
+
+// releasePins returns a function that unpins the given shards on its
+// first call.
+func releasePins(pinned []rankedShard) func() {
+	var once sync.Once
+	return func() {
+		once.Do(func() {
+			for _, s := range pinned {
+				s.unpin()
+			}
+		})
+	}
+}
+
+// maxDocCountCacheSize bounds the number of distinct queries for which
+// we remember the eligible document count.
+const maxDocCountCacheSize = 1000
+
+// estimateDocCount returns the number of documents that q may match,
+// summed over shards. Shards answer this from their metadata alone,
+// so we do it inline rather than through the search fan-out, and
+// cache the result until the shard set changes. Must be called under
+// rlock.
+func (ss *shardedSearcher) estimateDocCount(ctx context.Context, shards []rankedShard, q query.Q) int {
+	key := q.String()
+
+	ss.docCountsMu.Lock()
+	if ss.docCounts == nil || ss.docCountsVersion != ss.rankedVersion {
+		ss.docCounts = map[string]int{}
+		ss.docCountsVersion = ss.rankedVersion
+	}
+	n, ok := ss.docCounts[key]
+	ss.docCountsMu.Unlock()
+	if ok {
+		return n
+	}
+
+	opts := &zoekt.SearchOptions{EstimateDocCount: true}
+	for _, s := range shards {
+		n += estimateOneShard(ctx, s, q, opts)
+	}
+
+	ss.docCountsMu.Lock()
+	if ss.docCountsVersion == ss.rankedVersion {
+		if len(ss.docCounts) >= maxDocCountCacheSize {
+			ss.docCounts = map[string]int{}
+		}
+		ss.docCounts[key] = n
+	}
+	ss.docCountsMu.Unlock()
+	return n
+}
+
+func estimateOneShard(ctx context.Context, s zoekt.Searcher, q query.Q, opts *zoekt.SearchOptions) (n int) {
+	defer func() {
+		if r := recover(); r != nil {
+			log.Printf("crashed shard: %s: %s, %s", s.String(), r, debug.Stack())
+			n = 0
+		}
+	}()
+
+	res, err := s.Search(ctx, q, opts)
+	if err != nil {
+		return 0
+	}
+	return res.ShardFilesConsidered
 }
 
 func copySlice(src *[]byte) {
+	if *src == nil {
+		return
+	}
 	dst := make([]byte, len(*src))
 	copy(dst, *src)
 	*src = dst
 }
 
 type shardResult struct {
-	sr  *zoekt.SearchResult
-	err error
+	shard rankedShard
+	sr    *zoekt.SearchResult
+	err   error
+
+	// Wall clock time of the shard's search.
+	duration time.Duration
+}
+
+// release drops the pin that searchOneShard took for the result.
+func (r *shardResult) release() {
+	if r.shard.refs != nil {
+		r.shard.unpin()
+	}
 }
 
-func searchOneShard(ctx context.Context, s zoekt.Searcher, q query.Q, opts *zoekt.SearchOptions, sink chan shardResult) {
+// searchOneShard searches s and sends the result to sink. The shard is
+// pinned while it is searched, and the receiver of the result must
+// call release on it.
+func searchOneShard(ctx context.Context, s rankedShard, q query.Q, opts *zoekt.SearchOptions, sink chan shardResult) {
+	if s.refs != nil {
+		s.pin()
+	}
 	metricSearchShardRunning.Inc()
+	start := time.Now()
 	defer func() {
 		metricSearchShardRunning.Dec()
 		if r := recover(); r != nil {
@@ -355,12 +843,12 @@ func searchOneShard(ctx context.Context, s zoekt.Searcher, q query.Q, opts *zoek
 
 			var r zoekt.SearchResult
 			r.Stats.Crashes = 1
-			sink <- shardResult{&r, nil}
+			sink <- shardResult{s, &r, nil, time.Since(start)}
 		}
 	}()
 
 	ms, err := s.Search(ctx, q, opts)
-	sink <- shardResult{ms, err}
+	sink <- shardResult{s, ms, err, time.Since(start)}
 }
 
 func (ss *shardedSearcher) List(ctx context.Context, r query.Q) (rl *zoekt.RepoList, err error) {
@@ -397,9 +885,16 @@ func (ss *shardedSearcher) List(ctx context.Context, r query.Q) (rl *zoekt.RepoL
 	tr.LazyPrintf("shardCount: %d", len(shards))
 
 	for _, s := range shards {
-		go func(s zoekt.Searcher) {
+		if s.refs != nil {
+			// Keep lazy shards from being evicted under us.
+			s.pin()
+		}
+		go func(s rankedShard) {
 			metricListShardRunning.Inc()
 			defer func() {
+				if s.refs != nil {
+					s.unpin()
+				}
 				metricListShardRunning.Dec()
 				if r := recover(); r != nil {
 					all <- res{
@@ -409,7 +904,7 @@ func (ss *shardedSearcher) List(ctx context.Context, r query.Q) (rl *zoekt.RepoL
 			}()
 			ms, err := s.List(ctx, r)
 			all <- res{ms, err}
-		}(s.Searcher)
+		}(s)
 	}
 
 	crashes := 0
@@ -459,7 +954,11 @@ func (s *shardedSearcher) getShards() []rankedShard {
 		res = append(res, sh)
 	}
 	sort.Slice(res, func(i, j int) bool {
-		return res[i].rank > res[j].rank
+		if res[i].rank != res[j].rank {
+			return res[i].rank > res[j].rank
+		}
+		// Paginated searches need a stable order.
+		return res[i].name < res[j].name
 	})
 
 	// Cache ranked. We currently hold a read lock, so start a goroutine which
@@ -502,30 +1001,51 @@ func shardRank(s zoekt.Searcher) uint16 {
 }
 
 func (s *shardedSearcher) replace(key string, shard zoekt.Searcher) {
-	var rank uint16
-	if shard != nil {
-		rank = shardRank(shard)
+	s.replaceAll(map[string]zoekt.Searcher{key: shard})
+}
+
+// replaceAll swaps in the given shards under a single write lock. A
+// nil shard removes the key.
+func (s *shardedSearcher) replaceAll(shards map[string]zoekt.Searcher) {
+	ranks := make(map[string]uint16, len(shards))
+	for key, shard := range shards {
+		if shard != nil {
+			ranks[key] = shardRank(shard)
+		}
 	}
 
 	s.lock()
 	defer s.unlock()
-	old := s.shards[key]
-	if old.Searcher != nil {
-		old.Close()
-	}
+	for key, shard := range shards {
+		old := s.shards[key]
+		if old.Searcher != nil {
+			// Results pinning the old shard may still be in flight;
+			// it is closed when the last of them is released.
+			old.unpin()
+		}
 
-	if shard == nil {
-		delete(s.shards, key)
-	} else {
-		s.shards[key] = rankedShard{
-			rank:     rank,
-			Searcher: shard,
+		if shard == nil {
+			delete(s.shards, key)
+		} else {
+			refs := new(int32)
+			if ls, ok := shard.(*lazyShard); ok {
+				// Evictions check the count on the shard.
+				refs = &ls.refs
+			}
+			atomic.StoreInt32(refs, 1)
+			s.shards[key] = rankedShard{
+				rank:     ranks[key],
+				name:     key,
+				Searcher: shard,
+				refs:     refs,
+			}
 		}
 	}
 	s.rankedVersion++
 	s.ranked = nil
 
 	metricShardsLoaded.Set(float64(len(s.shards)))
+	metricShardSwapsTotal.Inc()
 }
 
 func loadShard(fn string) (zoekt.Searcher, error) {
@@ -18,14 +18,23 @@ import (
 	"bytes"
 	"context"
 	"fmt"
+	"io/ioutil"
 	"log"
+	"net/http"
+	"net/http/httptest"
 	"os"
+	"path/filepath"
+	"reflect"
 	"runtime"
+	"strings"
+	"sync/atomic"
 	"testing"
 	"time"
 
 	"github.com/google/zoekt"
+	"github.com/google/zoekt/internal/corpus"
 	"github.com/google/zoekt/query"
+	"github.com/google/zoekt/web"
 )
 
 type crashSearcher struct{}
@@ -226,3 +235,863 @@ func TestUnloadIndex(t *testing.T) {
 		}
 	}
 }
+
+type docCountSearcher struct {
+	docs      int
+	estimates int
+}
+
+func (s *docCountSearcher) Close()         {}
+func (s *docCountSearcher) String() string { return "docCountSearcher" }
+
+func (s *docCountSearcher) Search(ctx context.Context, q query.Q, opts *zoekt.SearchOptions) (*zoekt.SearchResult, error) {
+	if opts.EstimateDocCount {
+		s.estimates++
+		return &zoekt.SearchResult{Stats: zoekt.Stats{ShardFilesConsidered: s.docs}}, nil
+	}
+	if opts.LimitPolicy != nil {
+		return nil, fmt.Errorf("LimitPolicy passed to shard")
+	}
+	return &zoekt.SearchResult{
+		Stats: zoekt.Stats{MatchCount: opts.ShardMaxMatchCount},
+	}, nil
+}
+
+func (s *docCountSearcher) List(ctx context.Context, q query.Q) (*zoekt.RepoList, error) {
+	return &zoekt.RepoList{}, nil
+}
+
+func TestLimitPolicy(t *testing.T) {
+	ss := newShardedSearcher(2)
+	a := &docCountSearcher{docs: 3}
+	b := &docCountSearcher{docs: 4}
+	ss.replace("a", a)
+	ss.replace("b", b)
+
+	var gotDocs []int
+	opts := &zoekt.SearchOptions{
+		LimitPolicy: func(numDocs int, o *zoekt.SearchOptions) {
+			gotDocs = append(gotDocs, numDocs)
+			o.ShardMaxMatchCount = 10 * numDocs
+		},
+	}
+
+	q := &query.Substring{Pattern: "bla"}
+	for i := 0; i < 2; i++ {
+		res, err := ss.Search(context.Background(), q, opts)
+		if err != nil {
+			t.Fatalf("Search: %v", err)
+		}
+		if want := 2 * 70; res.Stats.MatchCount != want {
+			t.Errorf("got MatchCount %d, want %d", res.Stats.MatchCount, want)
+		}
+	}
+	if len(gotDocs) != 2 || gotDocs[0] != 7 || gotDocs[1] != 7 {
+		t.Errorf("got policy calls %v, want [7 7]", gotDocs)
+	}
+	if a.estimates != 1 || b.estimates != 1 {
+		t.Errorf("got %d, %d estimates, want 1 each", a.estimates, b.estimates)
+	}
+
+	// A new shard set invalidates the cached estimate.
+	ss.replace("b", nil)
+	if _, err := ss.Search(context.Background(), q, opts); err != nil {
+		t.Fatalf("Search: %v", err)
+	}
+	if a.estimates != 2 || gotDocs[2] != 3 {
+		t.Errorf("got %d estimates, policy calls %v after replace", a.estimates, gotDocs)
+	}
+}
+
+type closeSearcher struct {
+	rankSearcher
+	closed bool
+}
+
+func (s *closeSearcher) Close() {
+	s.closed = true
+}
+
+func TestSearchPinned(t *testing.T) {
+	ss := newShardedSearcher(2)
+	hit := &closeSearcher{rankSearcher: rankSearcher{rank: 1}}
+	ss.replace("hit", hit)
+
+	q := &query.Substring{Pattern: "bla"}
+	res, release, err := ss.SearchPinned(context.Background(), q, &zoekt.SearchOptions{})
+	if err != nil {
+		t.Fatalf("SearchPinned: %v", err)
+	}
+	if len(res.Files) != 1 {
+		t.Fatalf("got %d files, want 1", len(res.Files))
+	}
+
+	// Replacing the shard must not close it while the result is
+	// still in use.
+	ss.replace("hit", nil)
+	if hit.closed {
+		t.Fatal("shard closed while pinned")
+	}
+
+	release()
+	if !hit.closed {
+		t.Fatal("shard not closed after release")
+	}
+
+	// Plain Search copies the result and does not keep pins.
+	other := &closeSearcher{}
+	ss.replace("other", other)
+	if _, err := ss.Search(context.Background(), q, &zoekt.SearchOptions{}); err != nil {
+		t.Fatalf("Search: %v", err)
+	}
+	ss.Close()
+	if !other.closed {
+		t.Error("shard kept open after Search returned")
+	}
+}
+
+type facetSearcher struct {
+	rankSearcher
+	repo string
+}
+
+func (s *facetSearcher) Search(ctx context.Context, q query.Q, opts *zoekt.SearchOptions) (*zoekt.SearchResult, error) {
+	return &zoekt.SearchResult{
+		Stats: zoekt.Stats{FileCount: 1, MatchCount: 2},
+		Facets: &zoekt.Facets{
+			Repository: map[string]zoekt.FacetCount{s.repo: {Files: 1, Matches: 2}},
+			Language:   map[string]zoekt.FacetCount{"Go": {Files: 1, Matches: 2}},
+		},
+	}, nil
+}
+
+func TestFacetsMerge(t *testing.T) {
+	ss := newShardedSearcher(2)
+	ss.replace("a1", &facetSearcher{repo: "a"})
+	ss.replace("a2", &facetSearcher{repo: "a"})
+	ss.replace("b", &facetSearcher{repo: "b"})
+
+	res, err := ss.Search(context.Background(), &query.Substring{Pattern: "bla"}, &zoekt.SearchOptions{CountOnly: true})
+	if err != nil {
+		t.Fatalf("Search: %v", err)
+	}
+
+	want := &zoekt.Facets{
+		Repository: map[string]zoekt.FacetCount{"a": {Files: 2, Matches: 4}, "b": {Files: 1, Matches: 2}},
+		Language:   map[string]zoekt.FacetCount{"Go": {Files: 3, Matches: 6}},
+	}
+	if !reflect.DeepEqual(res.Facets, want) {
+		t.Errorf("got %+v, want %+v", res.Facets, want)
+	}
+}
+
+func memShard(t *testing.T, repo string, docs ...zoekt.Document) zoekt.Searcher {
+	b, err := zoekt.NewIndexBuilder(&zoekt.Repository{Name: repo})
+	if err != nil {
+		t.Fatalf("NewIndexBuilder: %v", err)
+	}
+	for i, d := range docs {
+		if err := b.Add(d); err != nil {
+			t.Fatalf("Add %d: %v", i, err)
+		}
+	}
+
+	var buf bytes.Buffer
+	b.Write(&buf)
+	s, err := zoekt.NewSearcher(&memSeeker{buf.Bytes()})
+	if err != nil {
+		t.Fatalf("NewSearcher: %v", err)
+	}
+	return s
+}
+
+func TestSharedMemoryBudget(t *testing.T) {
+	ss := newShardedSearcher(1)
+	for _, repo := range []string{"a", "b", "c"} {
+		var docs []zoekt.Document
+		for i := 0; i < 10; i++ {
+			docs = append(docs, zoekt.Document{
+				Name:    fmt.Sprintf("%s%d", repo, i),
+				Content: []byte("needle"),
+			})
+		}
+		ss.replace(repo, memShard(t, repo, docs...))
+	}
+
+	q := &query.Substring{Pattern: "needle"}
+	res, err := ss.Search(context.Background(), q, &zoekt.SearchOptions{})
+	if err != nil {
+		t.Fatalf("Search: %v", err)
+	}
+	perFile := res.MemoryBytes / 30
+
+	// Each shard would fit the budget on its own.
+	res, err = ss.Search(context.Background(), q, &zoekt.SearchOptions{MaxMemoryBytes: 15 * perFile})
+	if err != nil {
+		t.Fatalf("Search: %v", err)
+	}
+	if !res.MemoryBudgetExceeded {
+		t.Errorf("budget not exceeded")
+	}
+	if len(res.Files) > 15 {
+		t.Errorf("got %d files, want at most 15", len(res.Files))
+	}
+}
+
+// waitSearcher returns a truncated result once its search is
+// canceled.
+type waitSearcher struct {
+	rankSearcher
+}
+
+func (s *waitSearcher) Search(ctx context.Context, q query.Q, opts *zoekt.SearchOptions) (*zoekt.SearchResult, error) {
+	<-ctx.Done()
+	return &zoekt.SearchResult{Stats: zoekt.Stats{Truncated: true}}, nil
+}
+
+func TestTotalMaxMatchCountNotTruncated(t *testing.T) {
+	ss := newShardedSearcher(1)
+	ss.workers = 1
+	ss.replace("a", &facetSearcher{rankSearcher: rankSearcher{rank: 1}, repo: "a"})
+	ss.replace("b", &waitSearcher{})
+	ss.replace("c", &waitSearcher{})
+
+	// Reaching the match limit cancels the other shards, but the
+	// search did not run out of time.
+	res, err := ss.Search(context.Background(), &query.Substring{Pattern: "needle"},
+		&zoekt.SearchOptions{TotalMaxMatchCount: 1})
+	if err != nil {
+		t.Fatalf("Search: %v", err)
+	}
+	if res.Stats.Truncated {
+		t.Errorf("got Truncated for a match limit cutoff, stats %+v", res.Stats)
+	}
+}
+
+func TestPaginate(t *testing.T) {
+	ss := newShardedSearcher(2)
+	var want []string
+	for _, repo := range []string{"a", "b"} {
+		var docs []zoekt.Document
+		for i := 0; i < 5; i++ {
+			name := fmt.Sprintf("%s%d", repo, i)
+			content := "needle"
+			if i == 2 {
+				content = "haystack"
+			} else {
+				want = append(want, name)
+			}
+			docs = append(docs, zoekt.Document{Name: name, Content: []byte(content)})
+		}
+		ss.replace(repo, memShard(t, repo, docs...))
+	}
+
+	q := &query.Substring{Pattern: "needle"}
+	opts := zoekt.SearchOptions{
+		Paginate:           true,
+		MaxDocDisplayCount: 3,
+	}
+
+	var got []string
+	for pages := 0; ; pages++ {
+		if pages > len(want) {
+			t.Fatalf("too many pages")
+		}
+		res, err := ss.Search(context.Background(), q, &opts)
+		if err != nil {
+			t.Fatalf("Search: %v", err)
+		}
+		if len(res.Files) > opts.MaxDocDisplayCount {
+			t.Errorf("got %d files, want at most %d", len(res.Files), opts.MaxDocDisplayCount)
+		}
+		for _, f := range res.Files {
+			got = append(got, f.FileName)
+		}
+		if res.NextCursor == "" {
+			break
+		}
+		opts.Cursor = res.NextCursor
+	}
+
+	if !reflect.DeepEqual(got, want) {
+		t.Errorf("got %v, want %v", got, want)
+	}
+
+	opts.Cursor = ""
+	res, err := ss.Search(context.Background(), q, &opts)
+	if err != nil {
+		t.Fatalf("Search: %v", err)
+	}
+	opts.Cursor = res.NextCursor
+
+	if _, err := ss.Search(context.Background(), &query.Substring{Pattern: "hay"}, &opts); err == nil {
+		t.Error("cursor accepted for a different query")
+	}
+
+	ss.replace("b", nil)
+	if _, err := ss.Search(context.Background(), q, &opts); err == nil {
+		t.Error("cursor accepted after the shards changed")
+	}
+}
+
+// guardSearcher counts the searches that ran after it was closed.
+type guardSearcher struct {
+	rankSearcher
+	closed int32
+	late   *int32
+}
+
+func (s *guardSearcher) Close() {
+	atomic.StoreInt32(&s.closed, 1)
+}
+
+func (s *guardSearcher) Search(ctx context.Context, q query.Q, opts *zoekt.SearchOptions) (*zoekt.SearchResult, error) {
+	time.Sleep(time.Millisecond)
+	if atomic.LoadInt32(&s.closed) != 0 {
+		atomic.AddInt32(s.late, 1)
+	}
+	return &zoekt.SearchResult{
+		Files:      []zoekt.FileMatch{{FileName: "f"}},
+		ResumeDocs: []uint32{0},
+	}, nil
+}
+
+func TestPaginateReplace(t *testing.T) {
+	var late int32
+	newShards := func() map[string]zoekt.Searcher {
+		m := map[string]zoekt.Searcher{}
+		for i := 0; i < 50; i++ {
+			m[fmt.Sprintf("s%d", i)] = &guardSearcher{late: &late}
+		}
+		return m
+	}
+
+	ss := newShardedSearcher(2)
+	ss.workers = 2
+	ss.replaceAll(newShards())
+
+	done := make(chan struct{})
+	go func() {
+		defer close(done)
+		for i := 0; i < 20; i++ {
+			ss.replaceAll(newShards())
+		}
+	}()
+
+	// Each page fills with the first shard, so the searches of
+	// the other shards are still queued when it returns.
+	q := &query.Substring{Pattern: "needle"}
+	opts := zoekt.SearchOptions{Paginate: true, MaxDocDisplayCount: 1}
+	for i := 0; i < 20; i++ {
+		_, release, err := ss.SearchPinned(context.Background(), q, &opts)
+		if err != nil {
+			t.Fatalf("SearchPinned: %v", err)
+		}
+		release()
+	}
+	<-done
+	ss.Close()
+
+	// Give searches that outlived their page time to run.
+	time.Sleep(20 * time.Millisecond)
+	if n := atomic.LoadInt32(&late); n > 0 {
+		t.Errorf("%d searches ran on closed shards", n)
+	}
+}
+
+func TestSlowShards(t *testing.T) {
+	var s slowShards
+	for _, ms := range []int{3, 9, 1, 7, 5, 8, 2} {
+		s.add(shardResult{duration: time.Duration(ms) * time.Millisecond})
+	}
+
+	var got []time.Duration
+	for _, r := range s {
+		got = append(got, r.duration/time.Millisecond)
+	}
+	want := []time.Duration{9, 8, 7, 5, 3}
+	if !reflect.DeepEqual(got, want) {
+		t.Errorf("got %v, want %v", got, want)
+	}
+}
+
+func TestExplainSlowShards(t *testing.T) {
+	ss := newShardedSearcher(2)
+	ss.replace("a", memShard(t, "a", zoekt.Document{Name: "f", Content: []byte("needle")}))
+
+	q := &query.Substring{Pattern: "needle"}
+	res, err := ss.Search(context.Background(), q, &zoekt.SearchOptions{ExplainSlowerThan: time.Nanosecond})
+	if err != nil {
+		t.Fatalf("Search: %v", err)
+	}
+	if len(res.SlowestShards) != 1 {
+		t.Fatalf("got %v, want 1 shard", res.SlowestShards)
+	}
+	if got := res.SlowestShards[0]; got.Stats.FileCount != 1 || !strings.Contains(got.MatchTree, "needle") {
+		t.Errorf("got %+v, want stats and match tree for needle", got)
+	}
+}
+
+func TestResidency(t *testing.T) {
+	dir, err := ioutil.TempDir("", "residency")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer os.RemoveAll(dir)
+
+	fn := writeShard(t, dir, &zoekt.Repository{Name: "repo"},
+		zoekt.Document{Name: "f1", Content: bytes.Repeat([]byte("needle haystack\n"), 1000)})
+
+	shard, err := loadShard(fn)
+	if err != nil {
+		t.Fatalf("loadShard: %v", err)
+	}
+	ss := newShardedSearcher(1)
+	defer ss.Close()
+	ss.replace(fn, shard)
+
+	if _, err := ss.Search(context.Background(), &query.Substring{Pattern: "needle"}, &zoekt.SearchOptions{}); err != nil {
+		t.Fatal(err)
+	}
+
+	rs := ss.Residency()
+	if len(rs) != 1 || rs[0].Shard != fn {
+		t.Fatalf("got %+v, want one entry for %s", rs, fn)
+	}
+	sections := map[string]zoekt.SectionResidency{}
+	for _, s := range rs[0].Sections {
+		if s.Resident > s.Bytes {
+			t.Errorf("section %s: resident %d > size %d", s.Section, s.Resident, s.Bytes)
+		}
+		sections[s.Section] = s
+	}
+	for _, want := range []string{"content", "postings", "newlines", "names"} {
+		if _, ok := sections[want]; !ok {
+			t.Errorf("missing section %q in %+v", want, rs[0].Sections)
+		}
+	}
+	// The search just read the content.
+	if c := sections["content"]; c.Bytes == 0 || c.Resident == 0 {
+		t.Errorf("got content %+v, want some resident bytes", c)
+	}
+
+	w := httptest.NewRecorder()
+	ResidencyHandler(ss).ServeHTTP(w, httptest.NewRequest("GET", "/debug/residency", nil))
+	if body := w.Body.String(); !strings.Contains(body, "repo.zoekt") || !strings.Contains(body, "total (1 shards)") {
+		t.Errorf("got page %q", body)
+	}
+}
+
+func TestMemoryBudget(t *testing.T) {
+	dir, err := ioutil.TempDir("", "budget")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer os.RemoveAll(dir)
+
+	ss := newShardedSearcher(1)
+	ss.residency = newResidencyManager(1)
+	defer ss.Close()
+	tl := &loader{ss: ss}
+
+	var fns []string
+	for _, repo := range []string{"repo1", "repo2"} {
+		fn := writeShard(t, dir, &zoekt.Repository{Name: repo},
+			zoekt.Document{Name: "f", Content: []byte("needle in " + repo)})
+		tl.addPending(1)
+		tl.load(fn)
+		fns = append(fns, fn)
+	}
+
+	isOpen := func(fn string) bool {
+		return ss.shards[fn].Searcher.(*lazyShard).isOpen()
+	}
+
+	ss.residency.evict()
+	if isOpen(fns[0]) || isOpen(fns[1]) {
+		t.Fatal("shards over the budget were not evicted")
+	}
+
+	// Listing repositories, searching other repositories, and
+	// searching for text that no shard has does not open a shard.
+	rl, err := ss.List(context.Background(), &query.Repo{})
+	if err != nil {
+		t.Fatal(err)
+	}
+	if len(rl.Repos) != 2 {
+		t.Errorf("got %d repos, want 2", len(rl.Repos))
+	}
+	sr, err := ss.Search(context.Background(), &query.Substring{Pattern: "haystack"}, &zoekt.SearchOptions{})
+	if err != nil {
+		t.Fatal(err)
+	}
+	if len(sr.Files) != 0 || isOpen(fns[0]) || isOpen(fns[1]) {
+		t.Errorf("got %d files, open %v %v, want no files and no open shards", len(sr.Files), isOpen(fns[0]), isOpen(fns[1]))
+	}
+	q := query.NewAnd(&query.Repo{Pattern: "repo1"}, &query.Substring{Pattern: "needle"})
+	sr, release, err := ss.SearchPinned(context.Background(), q, &zoekt.SearchOptions{})
+	if err != nil {
+		t.Fatal(err)
+	}
+	if len(sr.Files) != 1 || sr.Files[0].Repository != "repo1" {
+		t.Fatalf("got %+v, want a match in repo1", sr.Files)
+	}
+	if !isOpen(fns[0]) || isOpen(fns[1]) {
+		t.Errorf("got open %v %v, want only repo1 open", isOpen(fns[0]), isOpen(fns[1]))
+	}
+
+	// Estimating the document count for a LimitPolicy uses the
+	// repository metadata.
+	ss.residency.evict()
+	if err := ss.rlock(context.Background()); err != nil {
+		t.Fatal(err)
+	}
+	n := ss.estimateDocCount(context.Background(), ss.getShards(), &query.Substring{Pattern: "needle"})
+	ss.runlock()
+	if n != 2 {
+		t.Errorf("got estimate %d, want 2", n)
+	}
+	if !isOpen(fns[0]) || isOpen(fns[1]) {
+		t.Errorf("got open %v %v after estimate, want only the pinned repo1 open", isOpen(fns[0]), isOpen(fns[1]))
+	}
+
+	// Pinned shards are not evicted.
+	ss.residency.evict()
+	if !isOpen(fns[0]) {
+		t.Error("pinned shard was evicted")
+	}
+	release()
+
+	// Evictions do not wait for running searches.
+	if err := ss.rlock(context.Background()); err != nil {
+		t.Fatal(err)
+	}
+	ss.residency.evict()
+	ss.runlock()
+	if isOpen(fns[0]) {
+		t.Error("released shard was not evicted")
+	}
+	if n := atomic.LoadInt64(&ss.residency.openBytes); n != 0 {
+		t.Errorf("got %d open bytes, want 0", n)
+	}
+}
+
+// backendSearcher records the options of its searches, and delays
+// the first delayed of them.
+type backendSearcher struct {
+	zoekt.Searcher
+	delay    time.Duration
+	delayed  int32
+	searches int32
+	wallTime int64
+	limited  int32
+}
+
+func (s *backendSearcher) Search(ctx context.Context, q query.Q, opts *zoekt.SearchOptions) (*zoekt.SearchResult, error) {
+	atomic.StoreInt64(&s.wallTime, int64(opts.MaxWallTime))
+	if opts.LimitPolicy != nil {
+		atomic.AddInt32(&s.limited, 1)
+	}
+	if atomic.AddInt32(&s.searches, 1) <= s.delayed {
+		select {
+		case <-time.After(s.delay):
+		case <-ctx.Done():
+			return nil, ctx.Err()
+		}
+	}
+	return s.Searcher.Search(ctx, q, opts)
+}
+
+func backendServer(t *testing.T, s zoekt.Searcher) *httptest.Server {
+	srv := &web.Server{Searcher: s, RPC: true, Top: web.Top}
+	mux, err := web.NewMux(srv)
+	if err != nil {
+		t.Fatalf("NewMux: %v", err)
+	}
+	return httptest.NewServer(mux)
+}
+
+func TestFederated(t *testing.T) {
+	a := &backendSearcher{Searcher: memShard(t, "a",
+		zoekt.Document{Name: "f1", Content: []byte("needle needle")},
+		zoekt.Document{Name: "f2", Content: []byte("haystack")})}
+	b := &backendSearcher{Searcher: memShard(t, "b",
+		zoekt.Document{Name: "f3", Content: []byte("needle")}),
+		delay: time.Minute, delayed: 1}
+	dead := httptest.NewServer(http.NotFoundHandler())
+	dead.Close()
+
+	srvA, srvB := backendServer(t, a), backendServer(t, b)
+	defer srvA.Close()
+	defer srvB.Close()
+
+	fs, err := NewFederatedSearcher([]Backend{
+		{Addrs: []string{srvA.URL}},
+		{Addrs: []string{srvB.URL}},
+		{Addrs: []string{dead.URL}},
+	}, FederatedOptions{HedgeDelay: 50 * time.Millisecond})
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer fs.Close()
+
+	q := &query.Substring{Pattern: "needle"}
+	sr, err := fs.Search(context.Background(), q, &zoekt.SearchOptions{MaxWallTime: 20 * time.Second})
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	var got []string
+	for _, f := range sr.Files {
+		got = append(got, f.Repository+"/"+f.FileName)
+	}
+	if want := []string{"a/f1", "b/f3"}; !reflect.DeepEqual(got, want) {
+		t.Errorf("got files %v, want %v", got, want)
+	}
+	if sr.Stats.FileCount != 2 || sr.Stats.FilesLoaded != 2 {
+		t.Errorf("got stats %+v, want the sum of both backends", sr.Stats)
+	}
+	// Backend b was slow the first time, so it got a backup
+	// request.
+	if n := atomic.LoadInt32(&b.searches); n != 2 {
+		t.Errorf("got %d searches on b, want 2", n)
+	}
+	if sr.Stats.Crashes != 1 {
+		t.Errorf("got %d crashes, want 1 for the dead backend", sr.Stats.Crashes)
+	}
+	if wt := time.Duration(atomic.LoadInt64(&a.wallTime)); wt <= 0 || wt > 20*time.Second {
+		t.Errorf("got MaxWallTime %v on backend, want at most 20s", wt)
+	}
+	if sr.Stats.Truncated {
+		t.Error("result truncated")
+	}
+
+	// A LimitPolicy is applied by the backends, without an extra
+	// request to estimate the document count.
+	policy := func(numdocs int, opts *zoekt.SearchOptions) {
+		t.Error("LimitPolicy called on the federated searcher")
+	}
+	if _, err := fs.Search(context.Background(), q, &zoekt.SearchOptions{MaxDocDisplayCount: 5, LimitPolicy: policy}); err != nil {
+		t.Fatal(err)
+	}
+	if n, l := atomic.LoadInt32(&a.searches), atomic.LoadInt32(&a.limited); n != 2 || l != 1 {
+		t.Errorf("got %d searches on a, %d with a LimitPolicy, want 2 and 1", n, l)
+	}
+
+	// A backend without time left is skipped, and the result is
+	// incomplete.
+	ctx, cancel := context.WithDeadline(context.Background(), time.Now())
+	defer cancel()
+	sr, err = (&remoteSearcher{addrs: []string{srvA.URL}}).Search(ctx, q, &zoekt.SearchOptions{})
+	if err != nil {
+		t.Fatal(err)
+	}
+	if sr.Stats.ShardsSkipped != 1 || !sr.Stats.Truncated {
+		t.Errorf("got stats %+v, want a skipped, truncated backend", sr.Stats)
+	}
+
+	rl, err := fs.List(context.Background(), &query.Repo{Pattern: "a"})
+	if err != nil {
+		t.Fatal(err)
+	}
+	if len(rl.Repos) != 1 || rl.Repos[0].Repository.Name != "a" || rl.Crashes != 1 {
+		t.Errorf("got %+v, want repo a and 1 crash", rl)
+	}
+}
+
+func writeShard(t testing.TB, dir string, repo *zoekt.Repository, docs ...zoekt.Document) string {
+	builder, err := zoekt.NewIndexBuilder(repo)
+	if err != nil {
+		t.Fatalf("NewIndexBuilder: %v", err)
+	}
+	for _, d := range docs {
+		if err := builder.Add(d); err != nil {
+			t.Fatal(err)
+		}
+	}
+	fn := filepath.Join(dir, repo.Name+".zoekt")
+	f, err := os.Create(fn)
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer f.Close()
+	if err := builder.Write(f); err != nil {
+		t.Fatal(err)
+	}
+	return fn
+}
+
+func TestSortByRank(t *testing.T) {
+	dir, err := ioutil.TempDir("", "rank")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer os.RemoveAll(dir)
+
+	low := writeShard(t, dir, &zoekt.Repository{Name: "low", Rank: 1})
+	high := writeShard(t, dir, &zoekt.Repository{Name: "high", Rank: 3})
+	mid := writeShard(t, dir, &zoekt.Repository{Name: "mid", Rank: 2})
+	bad := filepath.Join(dir, "bad.zoekt")
+	if err := ioutil.WriteFile(bad, []byte("x"), 0o644); err != nil {
+		t.Fatal(err)
+	}
+
+	fns := []string{bad, low, high, mid}
+	sortByRank(fns)
+	if want := []string{high, mid, low, bad}; !reflect.DeepEqual(fns, want) {
+		t.Errorf("got %v, want %v", fns, want)
+	}
+}
+
+func TestLoadInBackground(t *testing.T) {
+	dir, err := ioutil.TempDir("", "background")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer os.RemoveAll(dir)
+
+	for i := 0; i < 3; i++ {
+		writeShard(t, dir, &zoekt.Repository{Name: fmt.Sprintf("repo%d", i)},
+			zoekt.Document{Name: "f", Content: []byte("needle")})
+	}
+
+	s, err := NewDirectorySearcherWithOptions(dir, DirectorySearcherOptions{LoadInBackground: true})
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer s.Close()
+
+	q := &query.Substring{Pattern: "needle"}
+	for deadline := time.Now().Add(10 * time.Second); ; {
+		sr, err := s.Search(context.Background(), q, &zoekt.SearchOptions{})
+		if err != nil {
+			t.Fatal(err)
+		}
+		// Shards count as pending from the start, including
+		// while they are ranked.
+		if got := len(sr.Files) + sr.Stats.ShardsPending; got < 3 {
+			t.Errorf("got %d files and %d pending shards, want at least 3 in total", len(sr.Files), sr.Stats.ShardsPending)
+		}
+		if sr.Stats.ShardsPending == 0 && len(sr.Files) == 3 {
+			break
+		}
+		if time.Now().After(deadline) {
+			t.Fatalf("shards not loaded: %+v", sr.Stats)
+		}
+		time.Sleep(10 * time.Millisecond)
+	}
+}
+
+func TestLoaderBatches(t *testing.T) {
+	dir, err := ioutil.TempDir("", "batch")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer os.RemoveAll(dir)
+
+	var fns []string
+	for i := 0; i < 5; i++ {
+		fns = append(fns, writeShard(t, dir, &zoekt.Repository{Name: fmt.Sprintf("repo%d", i)}))
+	}
+	fns = append(fns, filepath.Join(dir, "missing.zoekt"))
+
+	ss := newShardedSearcher(1)
+	defer ss.Close()
+	tl := &loader{ss: ss}
+	version := ss.rankedVersion
+	tl.addPending(len(fns))
+	tl.load(fns...)
+
+	if len(ss.shards) != 5 {
+		t.Errorf("got %d shards, want 5", len(ss.shards))
+	}
+	if got := ss.rankedVersion - version; got != 1 {
+		t.Errorf("got %d swaps, want 1", got)
+	}
+	if ss.pending != 0 {
+		t.Errorf("got %d pending, want 0", ss.pending)
+	}
+
+	tl.drop(fns[:2]...)
+	if len(ss.shards) != 3 {
+		t.Errorf("got %d shards after drop, want 3", len(ss.shards))
+	}
+}
+
+// benchShards writes the default corpus to n shards in dir.
+func benchShards(b *testing.B, dir string, n int) []string {
+	opts := corpus.DefaultOptions()
+	c := corpus.Generate(opts)
+
+	var fns []string
+	for i := 0; i < n; i++ {
+		var docs []zoekt.Document
+		for j := i; j < len(c.Docs); j += n {
+			docs = append(docs, c.Docs[j])
+		}
+		fns = append(fns, writeShard(b, dir, opts.Repository(fmt.Sprintf("repo%d", i)), docs...))
+	}
+	return fns
+}
+
+func benchDir(b *testing.B) string {
+	dir, err := ioutil.TempDir("", "bench")
+	if err != nil {
+		b.Fatal(err)
+	}
+	return dir
+}
+
+func BenchmarkLoadShard(b *testing.B) {
+	dir := benchDir(b)
+	defer os.RemoveAll(dir)
+	fns := benchShards(b, dir, 1)
+	b.ReportAllocs()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		s, err := loadShard(fns[0])
+		if err != nil {
+			b.Fatalf("loadShard: %v", err)
+		}
+		s.Close()
+	}
+}
+
+func BenchmarkShardedSearch(b *testing.B) {
+	dir := benchDir(b)
+	defer os.RemoveAll(dir)
+	ss := newShardedSearcher(int64(runtime.GOMAXPROCS(0)))
+	defer ss.Close()
+	for _, fn := range benchShards(b, dir, 8) {
+		s, err := loadShard(fn)
+		if err != nil {
+			b.Fatalf("loadShard: %v", err)
+		}
+		ss.replace(fn, s)
+	}
+
+	words := corpus.Generate(corpus.DefaultOptions()).Words
+	for _, tc := range []struct {
+		name  string
+		query string
+	}{
+		{"substring", "case:yes " + words[1]},
+		{"case_insensitive", "case:no " + words[50]},
+		{"regex", "case:yes " + words[1] + `\(\)`},
+		{"boolean", "(" + words[1] + " or " + words[len(words)/2] + ") -" + words[50]},
+	} {
+		q, err := query.Parse(tc.query)
+		if err != nil {
+			b.Fatalf("Parse(%q): %v", tc.query, err)
+		}
+		b.Run(tc.name, func(b *testing.B) {
+			b.ReportAllocs()
+			for i := 0; i < b.N; i++ {
+				opts := zoekt.SearchOptions{MaxDocDisplayCount: 50}
+				if _, err := ss.Search(context.Background(), q, &opts); err != nil {
+					b.Fatalf("Search: %v", err)
+				}
+			}
+		})
+	}
+}
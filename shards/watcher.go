@@ -15,21 +15,30 @@
 package shards
 
 import (
+	"bytes"
 	"fmt"
+	"io/ioutil"
 	"log"
 	"os"
 	"path/filepath"
 	"runtime"
+	"sort"
 	"sync"
 	"time"
 
 	"github.com/fsnotify/fsnotify"
+	"github.com/google/zoekt"
+	"github.com/google/zoekt/placement"
 )
 
 type shardLoader interface {
-	// Load a new file. Should be safe for concurrent calls.
-	load(filename string)
-	drop(filename string)
+	// addPending adjusts the number of files waiting to be loaded.
+	addPending(n int)
+	// Load new files, in the given order. They must have been
+	// counted with addPending, and count as loaded once they are
+	// in the shard set.
+	load(filenames ...string)
+	drop(filenames ...string)
 }
 
 type DirectoryWatcher struct {
@@ -37,6 +46,9 @@ type DirectoryWatcher struct {
 	timestamps map[string]time.Time
 	loader     shardLoader
 
+	// manifest, if set, is the file listing the shards to serve.
+	manifest string
+
 	closeOnce sync.Once
 	// quit is closed by Close to signal the directory watcher to stop.
 	quit chan struct{}
@@ -52,18 +64,33 @@ func (sw *DirectoryWatcher) Stop() {
 }
 
 func NewDirectoryWatcher(dir string, loader shardLoader) (*DirectoryWatcher, error) {
+	return newDirectoryWatcher(dir, loader, false, "")
+}
+
+// newDirectoryWatcher returns a watcher that has loaded the shards in
+// dir, or that loads them in the background if background is set. If
+// manifest is set, only the shards it lists are loaded.
+func newDirectoryWatcher(dir string, loader shardLoader, background bool, manifest string) (*DirectoryWatcher, error) {
 	sw := &DirectoryWatcher{
 		dir:        dir,
 		timestamps: map[string]time.Time{},
 		loader:     loader,
+		manifest:   manifest,
 		quit:       make(chan struct{}),
 		stopped:    make(chan struct{}),
 	}
-	if err := sw.scan(); err != nil {
+	// Listing the shards is quick, so it is done up front even in
+	// the background, and searches see them as pending at once.
+	toLoad, err := sw.update()
+	if err != nil {
 		return nil, err
 	}
+	if !background {
+		sw.load(toLoad)
+		toLoad = nil
+	}
 
-	if err := sw.watch(); err != nil {
+	if err := sw.watch(toLoad); err != nil {
 		return nil, err
 	}
 
@@ -75,17 +102,40 @@ func (s *DirectoryWatcher) String() string {
 }
 
 func (s *DirectoryWatcher) scan() error {
-	fs, err := filepath.Glob(filepath.Join(s.dir, "*.zoekt"))
+	toLoad, err := s.update()
 	if err != nil {
 		return err
 	}
+	s.load(toLoad)
+	return nil
+}
+
+// update drops the shards that are gone, and returns the shards that
+// are new or changed. They are counted as pending right away, since
+// ranking them takes a while for a large directory.
+func (s *DirectoryWatcher) update() ([]string, error) {
+	fs, err := filepath.Glob(filepath.Join(s.dir, "*.zoekt"))
+	if err != nil {
+		return nil, err
+	}
 
 	if len(s.timestamps) == 0 && len(fs) == 0 {
-		return fmt.Errorf("directory %s is empty", s.dir)
+		return nil, fmt.Errorf("directory %s is empty", s.dir)
+	}
+
+	var serve map[string]bool
+	if s.manifest != "" {
+		serve, err = readManifest(s.manifest)
+		if err != nil {
+			return nil, err
+		}
 	}
 
 	ts := map[string]time.Time{}
 	for _, fn := range fs {
+		if serve != nil && !serve[filepath.Base(fn)] {
+			continue
+		}
 		fi, err := os.Lstat(fn)
 		if err != nil {
 			continue
@@ -113,42 +163,100 @@ func (s *DirectoryWatcher) scan() error {
 
 	if len(toDrop) > 0 {
 		log.Printf("unloading %d shards", len(toDrop))
+		for _, t := range toDrop {
+			log.Printf("unloading: %s", t)
+		}
+		s.loader.drop(toDrop...)
 	}
-	for _, t := range toDrop {
-		log.Printf("unloading: %s", t)
-		s.loader.drop(t)
-	}
 
+	s.loader.addPending(len(toLoad))
+	return toLoad, nil
+}
+
+// load loads the shards returned by update, most important first.
+func (s *DirectoryWatcher) load(toLoad []string) {
 	if len(toLoad) == 0 {
-		return nil
+		return
 	}
 
 	log.Printf("loading %d shards", len(toLoad))
+	sortByRank(toLoad)
+	s.loader.load(toLoad...)
+}
+
+// readManifest reads the manifest fn. A manifest that is empty, or
+// whose last line is not terminated, is probably being rewritten in
+// place, so it is rejected; the write that completes it triggers
+// another scan.
+func readManifest(fn string) (map[string]bool, error) {
+	data, err := ioutil.ReadFile(fn)
+	if err != nil {
+		return nil, err
+	}
+	if len(data) == 0 || data[len(data)-1] != '\n' {
+		return nil, fmt.Errorf("manifest %s is empty or incomplete", fn)
+	}
+	return placement.ReadManifest(bytes.NewReader(data))
+}
+
+// sortByRank sorts shard files by decreasing repository rank, so the
+// most important shards are loaded first. It only reads the metadata
+// of the shards; files that can't be read sort last.
+func sortByRank(fns []string) {
+	ranks := make([]int, len(fns))
+	work := make(chan int)
+	var wg sync.WaitGroup
+	for i := 0; i < runtime.GOMAXPROCS(0); i++ {
+		wg.Add(1)
+		go func() {
+			defer wg.Done()
+			for j := range work {
+				ranks[j] = readRank(fns[j])
+			}
+		}()
+	}
+	for j := range fns {
+		work <- j
+	}
+	close(work)
+	wg.Wait()
 
-	// Limit amount of concurrent shard loads.
-	throttle := make(chan struct{}, runtime.GOMAXPROCS(0))
-	lastProgress := time.Now()
-	for i, t := range toLoad {
-		// If taking a while to start-up occasionally give a progress message
-		if time.Since(lastProgress) > 10*time.Second {
-			log.Printf("still need to load %d shards...", len(toLoad)-i)
-			lastProgress = time.Now()
+	rank := make(map[string]int, len(fns))
+	for j, fn := range fns {
+		rank[fn] = ranks[j]
+	}
+	sort.Slice(fns, func(i, j int) bool {
+		if rank[fns[i]] != rank[fns[j]] {
+			return rank[fns[i]] > rank[fns[j]]
 		}
+		return fns[i] < fns[j]
+	})
+}
 
-		throttle <- struct{}{}
-		go func(k string) {
-			s.loader.load(k)
-			<-throttle
-		}(t)
+// readRank returns the repository rank of a shard, or -1 if its
+// metadata can't be read.
+func readRank(fn string) int {
+	f, err := os.Open(fn)
+	if err != nil {
+		return -1
 	}
-	for i := 0; i < cap(throttle); i++ {
-		throttle <- struct{}{}
+	inf, err := zoekt.NewIndexFile(f)
+	if err != nil {
+		f.Close()
+		return -1
 	}
+	defer inf.Close()
 
-	return nil
+	repo, _, err := zoekt.ReadMetadata(inf)
+	if err != nil {
+		return -1
+	}
+	return int(repo.Rank)
 }
 
-func (s *DirectoryWatcher) watch() error {
+// watch rescans the directory when it changes. It loads the shards
+// in initial first.
+func (s *DirectoryWatcher) watch(initial []string) error {
 	watcher, err := fsnotify.NewWatcher()
 	if err != nil {
 		return err
@@ -156,6 +264,14 @@ func (s *DirectoryWatcher) watch() error {
 	if err := watcher.Add(s.dir); err != nil {
 		return err
 	}
+	// Rescan when the manifest is replaced, too.
+	if s.manifest != "" {
+		if d := filepath.Dir(s.manifest); d != filepath.Clean(s.dir) {
+			if err := watcher.Add(d); err != nil {
+				return err
+			}
+		}
+	}
 
 	// intermediate signal channel so if there are multiple watcher.Events we
 	// only call scan once.
@@ -185,8 +301,11 @@ func (s *DirectoryWatcher) watch() error {
 
 	go func() {
 		defer close(s.stopped)
+		s.load(initial)
 		for range signal {
-			s.scan()
+			if err := s.scan(); err != nil {
+				log.Printf("scan %s: %v", s.dir, err)
+			}
 		}
 	}()
 
@@ -15,12 +15,15 @@
 package shards
 
 import (
+	"bytes"
 	"io/ioutil"
 	"os"
 	"path/filepath"
 	"strings"
 	"testing"
 	"time"
+
+	"github.com/google/zoekt/placement"
 )
 
 type loggingLoader struct {
@@ -28,12 +31,18 @@ type loggingLoader struct {
 	drops chan string
 }
 
-func (l *loggingLoader) load(k string) {
-	l.loads <- k
+func (l *loggingLoader) addPending(n int) {}
+
+func (l *loggingLoader) load(keys ...string) {
+	for _, k := range keys {
+		l.loads <- k
+	}
 }
 
-func (l *loggingLoader) drop(k string) {
-	l.drops <- k
+func (l *loggingLoader) drop(keys ...string) {
+	for _, k := range keys {
+		l.drops <- k
+	}
 }
 
 func advanceFS() {
@@ -105,3 +114,167 @@ func TestDirWatcherUnloadOnce(t *testing.T) {
 	default:
 	}
 }
+
+func TestDirWatcherManifest(t *testing.T) {
+	dir, err := ioutil.TempDir("", "")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer os.RemoveAll(dir)
+
+	for _, nm := range []string{"a.zoekt", "b.zoekt"} {
+		if err := ioutil.WriteFile(filepath.Join(dir, nm), []byte("hello"), 0o644); err != nil {
+			t.Fatalf("WriteFile: %v", err)
+		}
+	}
+	manifest := filepath.Join(dir, "manifest")
+	if err := ioutil.WriteFile(manifest, []byte("# node 1\na.zoekt\n"), 0o644); err != nil {
+		t.Fatalf("WriteFile: %v", err)
+	}
+
+	logger := &loggingLoader{
+		loads: make(chan string, 10),
+		drops: make(chan string, 10),
+	}
+	dw, err := newDirectoryWatcher(dir, logger, false, manifest)
+	if err != nil {
+		t.Fatalf("newDirectoryWatcher: %v", err)
+	}
+	defer dw.Stop()
+
+	if got, want := <-logger.loads, filepath.Join(dir, "a.zoekt"); got != want {
+		t.Fatalf("got load event %v, want %v", got, want)
+	}
+	select {
+	case k := <-logger.loads:
+		t.Fatalf("loaded %q, which is not in the manifest", k)
+	default:
+	}
+
+	if err := ioutil.WriteFile(manifest, []byte("b.zoekt\n"), 0o644); err != nil {
+		t.Fatalf("WriteFile: %v", err)
+	}
+	if got, want := <-logger.loads, filepath.Join(dir, "b.zoekt"); got != want {
+		t.Fatalf("got load event %v, want %v", got, want)
+	}
+	if got, want := <-logger.drops, filepath.Join(dir, "a.zoekt"); got != want {
+		t.Fatalf("got drop event %v, want %v", got, want)
+	}
+}
+
+func TestDirWatcherManifestNoShards(t *testing.T) {
+	dir, err := ioutil.TempDir("", "")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer os.RemoveAll(dir)
+
+	if err := ioutil.WriteFile(filepath.Join(dir, "a.zoekt"), []byte("hello"), 0o644); err != nil {
+		t.Fatalf("WriteFile: %v", err)
+	}
+	manifest := filepath.Join(dir, "manifest")
+	writeManifest := func(shards ...string) {
+		var buf bytes.Buffer
+		if err := placement.WriteManifest(&buf, shards); err != nil {
+			t.Fatalf("WriteManifest: %v", err)
+		}
+		if err := ioutil.WriteFile(manifest, buf.Bytes(), 0o644); err != nil {
+			t.Fatalf("WriteFile: %v", err)
+		}
+	}
+
+	// A node that is assigned no shards starts and loads none.
+	writeManifest()
+	logger := &loggingLoader{
+		loads: make(chan string, 10),
+		drops: make(chan string, 10),
+	}
+	dw, err := newDirectoryWatcher(dir, logger, false, manifest)
+	if err != nil {
+		t.Fatalf("newDirectoryWatcher: %v", err)
+	}
+	defer dw.Stop()
+	select {
+	case k := <-logger.loads:
+		t.Fatalf("loaded %q, which is not in the manifest", k)
+	default:
+	}
+
+	writeManifest("a.zoekt")
+	if got, want := <-logger.loads, filepath.Join(dir, "a.zoekt"); got != want {
+		t.Fatalf("got load event %v, want %v", got, want)
+	}
+
+	// Once all its shards move away, the node drops them.
+	writeManifest()
+	if got, want := <-logger.drops, filepath.Join(dir, "a.zoekt"); got != want {
+		t.Fatalf("got drop event %v, want %v", got, want)
+	}
+}
+
+func TestDirWatcherManifestDir(t *testing.T) {
+	dir, err := ioutil.TempDir("", "")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer os.RemoveAll(dir)
+	manifestDir, err := ioutil.TempDir("", "")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer os.RemoveAll(manifestDir)
+
+	for _, nm := range []string{"a.zoekt", "b.zoekt"} {
+		if err := ioutil.WriteFile(filepath.Join(dir, nm), []byte("hello"), 0o644); err != nil {
+			t.Fatalf("WriteFile: %v", err)
+		}
+	}
+	manifest := filepath.Join(manifestDir, "manifest")
+	if err := ioutil.WriteFile(manifest, []byte("a.zoekt\n"), 0o644); err != nil {
+		t.Fatalf("WriteFile: %v", err)
+	}
+
+	logger := &loggingLoader{
+		loads: make(chan string, 10),
+		drops: make(chan string, 10),
+	}
+	dw, err := newDirectoryWatcher(dir, logger, false, manifest)
+	if err != nil {
+		t.Fatalf("newDirectoryWatcher: %v", err)
+	}
+	defer dw.Stop()
+
+	if got, want := <-logger.loads, filepath.Join(dir, "a.zoekt"); got != want {
+		t.Fatalf("got load event %v, want %v", got, want)
+	}
+
+	// A manifest that is being rewritten in place is ignored.
+	for _, partial := range []string{"", "b.zo"} {
+		if err := ioutil.WriteFile(manifest, []byte(partial), 0o644); err != nil {
+			t.Fatalf("WriteFile: %v", err)
+		}
+		advanceFS()
+	}
+	select {
+	case k := <-logger.loads:
+		t.Fatalf("loaded %q from a partial manifest", k)
+	case k := <-logger.drops:
+		t.Fatalf("dropped %q for a partial manifest", k)
+	default:
+	}
+
+	// Renaming a new manifest into its directory rescans.
+	tmp := filepath.Join(manifestDir, "manifest.tmp")
+	if err := ioutil.WriteFile(tmp, []byte("b.zoekt\n"), 0o644); err != nil {
+		t.Fatalf("WriteFile: %v", err)
+	}
+	if err := os.Rename(tmp, manifest); err != nil {
+		t.Fatalf("Rename: %v", err)
+	}
+	if got, want := <-logger.loads, filepath.Join(dir, "b.zoekt"); got != want {
+		t.Fatalf("got load event %v, want %v", got, want)
+	}
+	if got, want := <-logger.drops, filepath.Join(dir, "a.zoekt"); got != want {
+		t.Fatalf("got drop event %v, want %v", got, want)
+	}
+}
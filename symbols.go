@@ -0,0 +1,584 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package zoekt
+
+import (
+	"bytes"
+	"encoding/binary"
+	"fmt"
+	"regexp"
+	"regexp/syntax"
+	"sort"
+	"strings"
+	"unicode/utf8"
+
+	"github.com/google/zoekt/query"
+)
+
+// symbolIndexBuilder indexes symbol names. It builds an ngram index
+// of the names, and a table of the distinct names for queries that the
+// ngrams can't answer. Both lead to symbol IDs, which index the
+// runeDocSections of the shard.
+//
+// It also records the kind and scope of each symbol, as IDs into
+// tables of the distinct kinds and scopes, and the postings of the
+// symbols of each kind.
+type symbolIndexBuilder struct {
+	postings map[ngram][]byte
+	last     map[ngram]uint32
+
+	names    map[string][]byte
+	lastName map[string]uint32
+
+	kinds        []string
+	kindIDs      map[string]uint16
+	scopes       []string
+	scopeIDs     map[string]uint32
+	meta         []byte
+	kindPostings [][]byte
+	lastKind     []uint32
+}
+
+// symbolMetaSize is the size of the metadata of a symbol: kind and
+// parent kind as uint16, and scope as uint32.
+const symbolMetaSize = 8
+
+// maxSymbolKinds bounds the kind table, whose IDs are stored as
+// uint16. Further kinds are recorded as unknown.
+const maxSymbolKinds = 1 << 16
+
+func newSymbolIndexBuilder() *symbolIndexBuilder {
+	return &symbolIndexBuilder{
+		postings: map[ngram][]byte{},
+		last:     map[ngram]uint32{},
+		names:    map[string][]byte{},
+		lastName: map[string]uint32{},
+
+		// ID 0 is the empty string, used for symbols without
+		// metadata.
+		kinds:        []string{""},
+		kindIDs:      map[string]uint16{"": 0},
+		scopes:       []string{""},
+		scopeIDs:     map[string]uint32{"": 0},
+		kindPostings: [][]byte{nil},
+		lastKind:     []uint32{0},
+	}
+}
+
+func (s *symbolIndexBuilder) kindID(kind string) uint16 {
+	id, ok := s.kindIDs[kind]
+	if !ok {
+		if len(s.kinds) == maxSymbolKinds {
+			return 0
+		}
+		id = uint16(len(s.kinds))
+		s.kindIDs[kind] = id
+		s.kinds = append(s.kinds, kind)
+		s.kindPostings = append(s.kindPostings, nil)
+		s.lastKind = append(s.lastKind, 0)
+	}
+	return id
+}
+
+func (s *symbolIndexBuilder) scopeID(scope string) uint32 {
+	id, ok := s.scopeIDs[scope]
+	if !ok {
+		id = uint32(len(s.scopes))
+		s.scopeIDs[scope] = id
+		s.scopes = append(s.scopes, scope)
+	}
+	return id
+}
+
+// add indexes the name and metadata of symbol id. Meta may be
+// nil. IDs must be added in increasing order.
+func (s *symbolIndexBuilder) add(id uint32, name []byte, meta *Symbol) {
+	var buf [8]byte
+	var kind, parentKind uint16
+	var scope uint32
+	if meta != nil {
+		kind = s.kindID(meta.Kind)
+		parentKind = s.kindID(meta.ParentKind)
+		scope = s.scopeID(meta.Parent)
+	}
+	binary.BigEndian.PutUint16(buf[0:], kind)
+	binary.BigEndian.PutUint16(buf[2:], parentKind)
+	binary.BigEndian.PutUint32(buf[4:], scope)
+	s.meta = append(s.meta, buf[:symbolMetaSize]...)
+	if kind != 0 {
+		m := binary.PutUvarint(buf[:], uint64(id-s.lastKind[kind]))
+		s.kindPostings[kind] = append(s.kindPostings[kind], buf[:m]...)
+		s.lastKind[kind] = id
+	}
+
+	m := binary.PutUvarint(buf[:], uint64(id-s.lastName[string(name)]))
+	s.names[string(name)] = append(s.names[string(name)], buf[:m]...)
+	s.lastName[string(name)] = id
+
+	var runeGram [3]rune
+	for i := 0; len(name) > 0; i++ {
+		c, sz := utf8.DecodeRune(name)
+		name = name[sz:]
+		runeGram[0], runeGram[1], runeGram[2] = runeGram[1], runeGram[2], c
+		if i < 2 {
+			continue
+		}
+
+		ng := runesToNGram(runeGram)
+		last, ok := s.last[ng]
+		if ok && last == id {
+			// The ngram occurs twice in this name.
+			continue
+		}
+		m := binary.PutUvarint(buf[:], uint64(id-last))
+		s.postings[ng] = append(s.postings[ng], buf[:m]...)
+		s.last[ng] = id
+	}
+}
+
+// sortedNames returns the distinct symbol names in sorted order.
+func (s *symbolIndexBuilder) sortedNames() []string {
+	names := make([]string, 0, len(s.names))
+	for n := range s.names {
+		names = append(names, n)
+	}
+	sort.Strings(names)
+	return names
+}
+
+// symbolIDs returns the IDs of the symbols whose names contain ng,
+// or a case variant of it if caseSensitive is false.
+func (d *indexData) symbolIDs(ng ngram, caseSensitive bool, stats *Stats) ([]uint32, error) {
+	variants := []ngram{ng}
+	if !caseSensitive {
+		variants = generateCaseNgrams(ng)
+	}
+
+	var ids []uint32
+	for _, v := range variants {
+		sec, ok := d.symbolNgrams[v]
+		if !ok {
+			continue
+		}
+		blob, err := d.readSectionBlob(sec)
+		if err != nil {
+			return nil, err
+		}
+		stats.IndexBytesLoaded += int64(len(blob))
+		ids = unionIDs(ids, fromDeltas(blob, nil))
+	}
+	return ids, nil
+}
+
+// kindSymbolIDs returns the IDs of the symbols whose kind starts
+// with kind, ignoring case.
+func (d *indexData) kindSymbolIDs(kind string, stats *Stats) ([]uint32, error) {
+	kind = strings.ToLower(kind)
+	var ids []uint32
+	for k, name := range d.symbolKinds {
+		if k == 0 || !strings.HasPrefix(strings.ToLower(name), kind) {
+			continue
+		}
+		blob, err := d.readSectionBlob(simpleSection{
+			off: d.symbolKindPostingsStart + d.symbolKindPostingsIndex[k],
+			sz:  d.symbolKindPostingsIndex[k+1] - d.symbolKindPostingsIndex[k],
+		})
+		if err != nil {
+			return nil, err
+		}
+		stats.IndexBytesLoaded += int64(len(blob))
+		ids = unionIDs(ids, fromDeltas(blob, nil))
+	}
+	return ids, nil
+}
+
+// symbolInfo returns the metadata of symbol id, whose name is sym,
+// or nil if the symbol has none.
+func (d *indexData) symbolInfo(id uint32, sym []byte) *Symbol {
+	off := int(id) * symbolMetaSize
+	if off+symbolMetaSize > len(d.symbolMeta) {
+		return nil
+	}
+	meta := d.symbolMeta[off : off+symbolMetaSize]
+	kind := binary.BigEndian.Uint16(meta[0:])
+	if kind == 0 {
+		return nil
+	}
+	parentKind := binary.BigEndian.Uint16(meta[2:])
+	scope := binary.BigEndian.Uint32(meta[4:])
+	return &Symbol{
+		Sym:        string(sym),
+		Kind:       d.symbolKinds[kind],
+		Parent:     string(d.symbolScopes[d.symbolScopesIndex[scope]:d.symbolScopesIndex[scope+1]]),
+		ParentKind: d.symbolKinds[parentKind],
+	}
+}
+
+// firstSymbol returns the ID of the first symbol of doc.
+func (d *indexData) firstSymbol(doc uint32) uint32 {
+	var start uint32
+	if doc > 0 {
+		start = d.fileEndRunes[doc-1]
+	}
+	secs := d.runeDocSections
+	return uint32(sort.Search(len(secs), func(i int) bool { return secs[i].Start >= start }))
+}
+
+// literalSymbolIDs returns the IDs of the symbols whose names contain
+// all of lits. It returns false if none of lits is long enough to be
+// looked up in the ngram index.
+func (d *indexData) literalSymbolIDs(lits []string, caseSensitive bool, stats *Stats) ([]uint32, bool, error) {
+	var ids []uint32
+	indexed := false
+	for _, lit := range lits {
+		if utf8.RuneCountInString(lit) < ngramSize {
+			continue
+		}
+		for _, o := range splitNGrams([]byte(lit)) {
+			cur, err := d.symbolIDs(o.ngram, caseSensitive, stats)
+			if err != nil {
+				return nil, false, err
+			}
+			if !indexed {
+				ids = cur
+				indexed = true
+			} else {
+				ids = intersectIDs(ids, cur)
+			}
+			if len(ids) == 0 {
+				return nil, true, nil
+			}
+		}
+	}
+	return ids, indexed, nil
+}
+
+// scanSymbolNames returns the IDs of the symbols whose names match t,
+// by checking every entry of the name table.
+func (d *indexData) scanSymbolNames(t *symbolMatchTree, stats *Stats) ([]uint32, error) {
+	var ids []uint32
+	stats.IndexBytesLoaded += int64(len(d.symbolNames))
+	for i := 0; i+1 < len(d.symbolNameIndex); i++ {
+		name := d.symbolNames[d.symbolNameIndex[i]:d.symbolNameIndex[i+1]]
+		if len(t.findAll(name, 1)) == 0 {
+			continue
+		}
+		blob, err := d.readSectionBlob(simpleSection{
+			off: d.symbolNameIDsStart + d.symbolNameIDsIndex[i],
+			sz:  d.symbolNameIDsIndex[i+1] - d.symbolNameIDsIndex[i],
+		})
+		if err != nil {
+			return nil, err
+		}
+		stats.IndexBytesLoaded += int64(len(blob))
+		ids = append(ids, fromDeltas(blob, nil)...)
+	}
+
+	// Each symbol has one name, so the lists are disjoint.
+	sort.Slice(ids, func(i, j int) bool { return ids[i] < ids[j] })
+	return ids, nil
+}
+
+// symbolLiterals returns strings that every match of r contains.
+// Case folded literals are left out of case sensitive queries.
+func symbolLiterals(r *syntax.Regexp, caseSensitive bool) []string {
+	switch r.Op {
+	case syntax.OpLiteral:
+		if r.Flags&syntax.FoldCase == 0 || !caseSensitive {
+			return []string{string(r.Rune)}
+		}
+	case syntax.OpCapture, syntax.OpPlus:
+		return symbolLiterals(r.Sub[0], caseSensitive)
+	case syntax.OpRepeat:
+		if r.Min >= 1 {
+			return symbolLiterals(r.Sub[0], caseSensitive)
+		}
+	case syntax.OpConcat:
+		var res []string
+		for _, sub := range r.Sub {
+			res = append(res, symbolLiterals(sub, caseSensitive)...)
+		}
+		return res
+	}
+	return nil
+}
+
+func unionIDs(a, b []uint32) []uint32 {
+	if len(a) == 0 {
+		return b
+	}
+	res := make([]uint32, 0, len(a)+len(b))
+	for len(a) > 0 && len(b) > 0 {
+		switch {
+		case a[0] < b[0]:
+			res = append(res, a[0])
+			a = a[1:]
+		case a[0] > b[0]:
+			res = append(res, b[0])
+			b = b[1:]
+		default:
+			res = append(res, a[0])
+			a, b = a[1:], b[1:]
+		}
+	}
+	res = append(res, a...)
+	return append(res, b...)
+}
+
+func intersectIDs(a, b []uint32) []uint32 {
+	res := a[:0]
+	for len(a) > 0 && len(b) > 0 {
+		switch {
+		case a[0] < b[0]:
+			a = a[1:]
+		case a[0] > b[0]:
+			b = b[1:]
+		default:
+			res = append(res, a[0])
+			a, b = a[1:], b[1:]
+		}
+	}
+	return res
+}
+
+// symbolMatchTree finds a substring or regular expression in symbol
+// names. The matching symbols are found through the symbol ngram index
+// or the symbol name table, so its cost depends on the number of
+// matching symbols rather than on the number of occurrences of the
+// pattern in the content.
+type symbolMatchTree struct {
+	d *indexData
+
+	// At most one of substr and regexp is set. If neither is,
+	// the whole name of every symbol of kind matches.
+	substr *query.Substring
+	regexp *regexp.Regexp
+	kind   string
+
+	patBytes      []byte
+	patLowered    []byte
+	ids           []uint32
+	symbolMatches int
+	bytesLoaded   int64
+
+	// mutable
+	doc       uint32
+	docIDs    []uint32
+	current   []*candidateMatch
+	evaluated bool
+}
+
+func (d *indexData) newSymbolMatchTree(q *query.Symbol) (matchTree, error) {
+	t := &symbolMatchTree{d: d, kind: q.Kind}
+
+	var lits []string
+	var caseSensitive bool
+	switch s := q.Expr.(type) {
+	case nil:
+		if q.Kind == "" {
+			return nil, fmt.Errorf("symbol search needs a pattern or a kind")
+		}
+	case *query.Substring:
+		t.substr = s
+		t.patBytes = []byte(s.Pattern)
+		t.patLowered = toLower(t.patBytes)
+		lits = []string{s.Pattern}
+		caseSensitive = s.CaseSensitive
+	case *query.Regexp:
+		prefix := ""
+		if !s.CaseSensitive {
+			prefix = "(?i)"
+		}
+		re, err := regexp.Compile(prefix + s.Regexp.String())
+		if err != nil {
+			return nil, err
+		}
+		t.regexp = re
+		lits = symbolLiterals(s.Regexp, s.CaseSensitive)
+		caseSensitive = s.CaseSensitive
+	default:
+		return nil, fmt.Errorf("symbol search does not support %s", q.Expr)
+	}
+
+	var stats Stats
+	var ids []uint32
+	var err error
+	if q.Expr != nil {
+		var indexed bool
+		ids, indexed, err = d.literalSymbolIDs(lits, caseSensitive, &stats)
+		if err == nil && !indexed {
+			ids, err = d.scanSymbolNames(t, &stats)
+		}
+		if err != nil {
+			return nil, err
+		}
+	}
+	if q.Kind != "" && (q.Expr == nil || len(ids) > 0) {
+		kindIDs, err := d.kindSymbolIDs(q.Kind, &stats)
+		if err != nil {
+			return nil, err
+		}
+		if q.Expr == nil {
+			ids = kindIDs
+		} else {
+			ids = intersectIDs(ids, kindIDs)
+		}
+	}
+	if len(ids) == 0 {
+		return &noMatchTree{"symbol"}, nil
+	}
+
+	t.ids = ids
+	t.bytesLoaded = stats.IndexBytesLoaded
+	return t, nil
+}
+
+func (t *symbolMatchTree) String() string {
+	kind := ""
+	if t.kind != "" {
+		kind = fmt.Sprintf("kind:%s, ", t.kind)
+	}
+	switch {
+	case t.regexp != nil:
+		return fmt.Sprintf("symregexp(%s%s, %d symbols)", kind, t.regexp, len(t.ids))
+	case t.substr != nil:
+		return fmt.Sprintf("symsubstr(%s%q, %d symbols)", kind, t.substr.Pattern, len(t.ids))
+	}
+	return fmt.Sprintf("symkind(%s, %d symbols)", t.kind, len(t.ids))
+}
+
+// docOf returns the document holding symbol id.
+func (t *symbolMatchTree) docOf(id uint32) uint32 {
+	start := t.d.runeDocSections[id].Start
+	ends := t.d.fileEndRunes
+	return uint32(sort.Search(len(ends), func(i int) bool { return ends[i] > start }))
+}
+
+func (t *symbolMatchTree) nextDoc() uint32 {
+	if len(t.ids) == 0 {
+		return maxUInt32
+	}
+	return t.docOf(t.ids[0])
+}
+
+func (t *symbolMatchTree) prepare(doc uint32) {
+	for len(t.ids) > 0 && t.docOf(t.ids[0]) < doc {
+		t.ids = t.ids[1:]
+	}
+	n := 0
+	for n < len(t.ids) && t.docOf(t.ids[n]) == doc {
+		n++
+	}
+	t.doc = doc
+	t.docIDs = t.ids[:n]
+	t.ids = t.ids[n:]
+	t.current = t.current[:0]
+	t.evaluated = false
+}
+
+func (t *symbolMatchTree) matches(cp *contentProvider, cost int, known map[matchTree]bool) (bool, bool) {
+	if t.evaluated {
+		return len(t.current) > 0, true
+	}
+	if len(t.docIDs) == 0 {
+		return false, true
+	}
+	if cost < costContent {
+		return false, false
+	}
+
+	data := cp.data(false)
+	secs := cp.docSections()
+	first := t.d.firstSymbol(t.doc)
+	for _, id := range t.docIDs {
+		sec := secs[id-first]
+		t.current = t.appendMatches(t.current, data, sec)
+	}
+	t.symbolMatches += len(t.docIDs)
+	t.evaluated = true
+	return len(t.current) > 0, true
+}
+
+// appendMatches appends the occurrences of the pattern in the symbol
+// at sec.
+func (t *symbolMatchTree) appendMatches(cands []*candidateMatch, data []byte, sec DocumentSection) []*candidateMatch {
+	for _, m := range t.findAll(data[sec.Start:sec.End], -1) {
+		cm := &candidateMatch{
+			file:        t.doc,
+			byteOffset:  sec.Start + uint32(m[0]),
+			byteMatchSz: uint32(m[1] - m[0]),
+		}
+		if t.substr != nil {
+			cm.caseSensitive = t.substr.CaseSensitive
+			cm.substrBytes = t.patBytes
+			cm.substrLowered = t.patLowered
+		}
+		cands = append(cands, cm)
+	}
+	return cands
+}
+
+// findAll returns the byte ranges of at most n matches of the pattern
+// in name, or of all matches if n is negative. Empty matches are
+// skipped.
+func (t *symbolMatchTree) findAll(name []byte, n int) [][2]int {
+	var res [][2]int
+	if t.substr == nil && t.regexp == nil {
+		if len(name) > 0 {
+			res = append(res, [2]int{0, len(name)})
+		}
+		return res
+	}
+	if t.regexp != nil {
+		for _, m := range t.regexp.FindAllIndex(name, n) {
+			if m[1] > m[0] {
+				res = append(res, [2]int{m[0], m[1]})
+			}
+		}
+		return res
+	}
+
+	for off := 0; off < len(name) && len(res) != n; {
+		var sz int
+		if t.substr.CaseSensitive {
+			i := bytes.Index(name[off:], t.patBytes)
+			if i < 0 {
+				break
+			}
+			off += i
+			sz = len(t.patBytes)
+		} else {
+			m, ok := caseFoldingEqualsRunes(t.patLowered, name[off:])
+			if !ok || off+m > len(name) {
+				_, step := utf8.DecodeRune(name[off:])
+				off += step
+				continue
+			}
+			sz = m
+		}
+
+		res = append(res, [2]int{off, off + sz})
+		_, step := utf8.DecodeRune(name[off:])
+		off += step
+	}
+	return res
+}
+
+func (t *symbolMatchTree) updateStats(s *Stats) {
+	s.IndexBytesLoaded += t.bytesLoaded
+	s.NgramMatches += t.symbolMatches
+	t.bytesLoaded = 0
+	t.symbolMatches = 0
+}
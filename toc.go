@@ -27,7 +27,11 @@ package zoekt
 // 13: content checksums
 // 14: languages
 // 15: rune based symbol sections
-const IndexFormatVersion = 15
+// 16: ngram index of symbol names
+// 17: table of distinct symbol names
+// 18: symbol kinds and scopes
+// 19: per document ASCII flags
+const IndexFormatVersion = 19
 
 // FeatureVersion is increased if a feature is added that requires reindexing data
 // without changing the format version
@@ -63,6 +67,18 @@ type indexTOC struct {
 	nameEndRunes     simpleSection
 	contentChecksums simpleSection
 	runeDocSections  simpleSection
+
+	symbolNgramText simpleSection
+	symbolPostings  compoundSection
+	symbolNames     compoundSection
+	symbolNameIDs   compoundSection
+
+	symbolKinds        compoundSection
+	symbolScopes       compoundSection
+	symbolMeta         simpleSection
+	symbolKindPostings compoundSection
+
+	asciiFlags simpleSection
 }
 
 func (t *indexTOC) sections() []section {
@@ -88,5 +104,47 @@ func (t *indexTOC) sections() []section {
 		&t.contentChecksums,
 		&t.languages,
 		&t.runeDocSections,
+		&t.symbolNgramText,
+		&t.symbolPostings,
+		&t.symbolNames,
+		&t.symbolNameIDs,
+		&t.symbolKinds,
+		&t.symbolScopes,
+		&t.symbolMeta,
+		&t.symbolKindPostings,
+		&t.asciiFlags,
+	}
+}
+
+// indexRegion is a group of sections that hold one kind of data.
+type indexRegion struct {
+	name     string
+	sections []simpleSection
+}
+
+// regions groups the sections by the kind of data they hold, for
+// reporting memory use.
+func (t *indexTOC) regions() []indexRegion {
+	compound := func(ss ...*compoundSection) []simpleSection {
+		var res []simpleSection
+		for _, s := range ss {
+			res = append(res, s.data, s.index)
+		}
+		return res
+	}
+
+	return []indexRegion{
+		{"content", compound(&t.fileContents)},
+		{"postings", append(compound(&t.postings), t.ngramText)},
+		{"newlines", compound(&t.newlines)},
+		{"symbols", append(compound(&t.symbolPostings, &t.symbolNames, &t.symbolNameIDs,
+			&t.symbolKinds, &t.symbolScopes, &t.symbolKindPostings),
+			t.symbolNgramText, t.symbolMeta)},
+		{"names", append(compound(&t.fileNames, &t.namePostings),
+			t.nameNgramText, t.nameRuneOffsets, t.nameEndRunes)},
+		{"other", append(compound(&t.fileSections),
+			t.metaData, t.repoMetaData, t.branchMasks, t.subRepos,
+			t.runeOffsets, t.fileEndRunes, t.contentChecksums,
+			t.languages, t.runeDocSections, t.asciiFlags)},
 	}
 }
@@ -18,6 +18,7 @@ import (
 	"time"
 
 	"github.com/google/zoekt"
+	"github.com/google/zoekt/query"
 )
 
 type LastInput struct {
@@ -111,3 +112,37 @@ type PrintInput struct {
 	Lines      []string
 	Last       LastInput
 }
+
+// SearchRequest is the input of the /api/search endpoint. It is
+// posted either as JSON or as gob, as given by the Content-Type
+// header.
+type SearchRequest struct {
+	Query string
+
+	// Q is the parsed query, used instead of Query if set. It can
+	// only be sent as gob.
+	Q query.Q `json:"-"`
+
+	// Options for the search. LimitPolicy is not transmitted.
+	Opts zoekt.SearchOptions
+
+	// If set, show this many files, with match limits derived
+	// from the number of eligible documents, as for the HTML
+	// interface.
+	Num int
+
+	// Fields names the FileMatch and LineMatch fields to return,
+	// eg. []string{"FileName", "LineMatches"}. If empty, all
+	// fields are returned.
+	Fields []string
+}
+
+// ListRequest is the input of the /api/list endpoint, which returns
+// a zoekt.RepoList. It is encoded like SearchRequest.
+type ListRequest struct {
+	// Query selects the repositories, eg. "r:zoekt".
+	Query string
+
+	// Q is the parsed query, used instead of Query if set.
+	Q query.Q `json:"-"`
+}
@@ -16,12 +16,17 @@ package web
 
 import (
 	"bytes"
+	"compress/gzip"
 	"context"
+	"encoding/gob"
+	"encoding/json"
 	"fmt"
 	"io/ioutil"
 	"log"
 	"net/http"
 	"net/http/httptest"
+	"os"
+	"path/filepath"
 	"strings"
 	"testing"
 	"time"
@@ -440,3 +445,277 @@ func TestTruncateLine(t *testing.T) {
 		t.Fatalf("got %s, want substring %q", result, want)
 	}
 }
+
+func TestSearchAPI(t *testing.T) {
+	b, err := zoekt.NewIndexBuilder(&zoekt.Repository{
+		Name:                 "name",
+		FileURLTemplate:      "file-url",
+		LineFragmentTemplate: "#line",
+	})
+	if err != nil {
+		t.Fatalf("NewIndexBuilder: %v", err)
+	}
+	if err := b.Add(zoekt.Document{
+		Name:    "f2",
+		Content: []byte("to carry water in the no later bla"),
+	}); err != nil {
+		t.Fatalf("Add: %v", err)
+	}
+
+	srv := Server{
+		Searcher: searcherForTest(t, b),
+		Top:      Top,
+		RPC:      true,
+	}
+	mux, err := NewMux(&srv)
+	if err != nil {
+		t.Fatalf("NewMux: %v", err)
+	}
+	ts := httptest.NewServer(mux)
+	defer ts.Close()
+
+	body, err := json.Marshal(&SearchRequest{
+		Query:  "water",
+		Num:    10,
+		Fields: []string{"FileName", "LineMatches"},
+	})
+	if err != nil {
+		t.Fatal(err)
+	}
+	for _, accept := range []string{JSONContentType, GobContentType} {
+		req, err := http.NewRequest("POST", ts.URL+"/api/search", bytes.NewReader(body))
+		if err != nil {
+			t.Fatal(err)
+		}
+		req.Header.Set("Content-Type", JSONContentType+"; charset=utf-8")
+		req.Header.Set("Accept", accept)
+		req.Header.Set("Accept-Encoding", "gzip")
+
+		// Disable the transport's transparent decompression,
+		// so we see the encoding on the wire.
+		client := &http.Client{Transport: &http.Transport{DisableCompression: true}}
+		res, err := client.Do(req)
+		if err != nil {
+			t.Fatalf("Do: %v", err)
+		}
+		if got := res.Header.Get("Content-Encoding"); got != "gzip" {
+			t.Errorf("%s: got Content-Encoding %q, want gzip", accept, got)
+		}
+		zr, err := gzip.NewReader(res.Body)
+		if err != nil {
+			t.Fatalf("gzip.NewReader: %v", err)
+		}
+
+		var result zoekt.SearchResult
+		if accept == GobContentType {
+			err = gob.NewDecoder(zr).Decode(&result)
+		} else {
+			err = json.NewDecoder(zr).Decode(&result)
+		}
+		res.Body.Close()
+		if err != nil {
+			t.Fatalf("%s: Decode: %v", accept, err)
+		}
+
+		if len(result.Files) != 1 {
+			t.Fatalf("%s: got %d files, want 1", accept, len(result.Files))
+		}
+		f := result.Files[0]
+		if f.FileName != "f2" || f.Repository != "" || f.Checksum != nil {
+			t.Errorf("%s: fields not selected: %#v", accept, f)
+		}
+		if len(f.LineMatches) != 1 || f.LineMatches[0].Line != nil {
+			t.Fatalf("%s: got line matches %#v", accept, f.LineMatches)
+		}
+		if got := f.LineMatches[0].LineFragments[0].Offset; got != 9 {
+			t.Errorf("%s: got offset %d, want 9", accept, got)
+		}
+		if got := result.LineFragments["name"]; got != "#line" {
+			t.Errorf("%s: got fragment template %q", accept, got)
+		}
+	}
+
+	checkNeedles(t, ts, "/api/search?q=water&fields=Line,LineMatches", []string{`"Line":"dG8gY2Fycnkgd2F0ZXIgaW4gdGhlIG5vIGxhdGVyIGJsYQ=="`})
+
+	// Oversized bodies are rejected.
+	big := append([]byte(`{"Query": "`), bytes.Repeat([]byte("a"), maxRequestBytes)...)
+	big = append(big, `"}`...)
+	res, err := http.Post(ts.URL+"/api/search", JSONContentType, bytes.NewReader(big))
+	if err != nil {
+		t.Fatalf("Post: %v", err)
+	}
+	res.Body.Close()
+	if res.StatusCode == http.StatusOK {
+		t.Errorf("got status %d for an oversized request", res.StatusCode)
+	}
+}
+
+func TestWriteAPIResponse(t *testing.T) {
+	result := map[string]int{"a": 1}
+	for _, tc := range []struct {
+		accept, acceptEncoding string
+		wantType, wantEncoding string
+	}{
+		{"", "", JSONContentType, ""},
+		{GobContentType, "gzip", GobContentType, "gzip"},
+		{GobContentType + ";q=0, " + JSONContentType, "gzip;q=0", JSONContentType, ""},
+		{JSONContentType + ";q=0.5, " + GobContentType + ";q=0.8", "br, GZIP;q=0.1", GobContentType, "gzip"},
+		{JSONContentType + ", " + GobContentType + ";q=0.8", "identity", JSONContentType, ""},
+	} {
+		r := httptest.NewRequest("GET", "/api/list", nil)
+		r.Header.Set("Accept", tc.accept)
+		r.Header.Set("Accept-Encoding", tc.acceptEncoding)
+		w := httptest.NewRecorder()
+		if err := writeAPIResponse(w, r, result); err != nil {
+			t.Fatalf("writeAPIResponse: %v", err)
+		}
+		if got := w.Header().Get("Content-Type"); got != tc.wantType {
+			t.Errorf("Accept %q: got Content-Type %q, want %q", tc.accept, got, tc.wantType)
+		}
+		if got := w.Header().Get("Content-Encoding"); got != tc.wantEncoding {
+			t.Errorf("Accept-Encoding %q: got Content-Encoding %q, want %q", tc.acceptEncoding, got, tc.wantEncoding)
+		}
+	}
+
+	// Encoding errors are returned before anything is written.
+	r := httptest.NewRequest("GET", "/api/list", nil)
+	r.Header.Set("Accept-Encoding", "gzip")
+	w := httptest.NewRecorder()
+	if err := writeAPIResponse(w, r, map[string]interface{}{"c": make(chan int)}); err == nil {
+		t.Fatal("writeAPIResponse succeeded for a value JSON cannot encode")
+	}
+	if len(w.Header()) != 0 || w.Body.Len() != 0 {
+		t.Errorf("got headers %v and body %q after an encoding error", w.Header(), w.Body.String())
+	}
+}
+
+// optsSearcher records the options of the last search.
+type optsSearcher struct {
+	zoekt.Searcher
+	opts zoekt.SearchOptions
+}
+
+func (s *optsSearcher) Search(ctx context.Context, q query.Q, opts *zoekt.SearchOptions) (*zoekt.SearchResult, error) {
+	s.opts = *opts
+	return &zoekt.SearchResult{}, nil
+}
+
+func TestSearchAPIMaxMemory(t *testing.T) {
+	for _, tc := range []struct {
+		server, request, want int64
+	}{
+		{0, 0, 0},
+		{0, 5000, 5000},
+		{1000, 0, 1000},
+		{1000, 500, 500},
+		{1000, 5000, 1000},
+		{1000, -1, 1000},
+	} {
+		searcher := &optsSearcher{}
+		srv := Server{
+			Searcher:       searcher,
+			Top:            Top,
+			RPC:            true,
+			MaxMemoryBytes: tc.server,
+		}
+		mux, err := NewMux(&srv)
+		if err != nil {
+			t.Fatalf("NewMux: %v", err)
+		}
+		ts := httptest.NewServer(mux)
+
+		body, err := json.Marshal(&SearchRequest{
+			Query: "water",
+			Opts:  zoekt.SearchOptions{MaxMemoryBytes: tc.request},
+		})
+		if err != nil {
+			t.Fatal(err)
+		}
+		res, err := http.Post(ts.URL+"/api/search", JSONContentType, bytes.NewReader(body))
+		if err != nil {
+			t.Fatalf("Post: %v", err)
+		}
+		res.Body.Close()
+		ts.Close()
+		if res.StatusCode != http.StatusOK {
+			t.Fatalf("got status %d", res.StatusCode)
+		}
+		if got := searcher.opts.MaxMemoryBytes; got != tc.want {
+			t.Errorf("server limit %d, request %d: got MaxMemoryBytes %d, want %d", tc.server, tc.request, got, tc.want)
+		}
+	}
+}
+
+func TestSlowQueryLog(t *testing.T) {
+	b, err := zoekt.NewIndexBuilder(&zoekt.Repository{Name: "name"})
+	if err != nil {
+		t.Fatalf("NewIndexBuilder: %v", err)
+	}
+	if err := b.Add(zoekt.Document{
+		Name:    "f2",
+		Content: []byte("to carry water in the no later bla"),
+	}); err != nil {
+		t.Fatalf("Add: %v", err)
+	}
+
+	dir, err := ioutil.TempDir("", "slowlog")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer os.RemoveAll(dir)
+
+	// Every search is slow, and each entry gets a file of its own.
+	slowLog, err := NewSlowQueryLog(dir, 0, 1, 2)
+	if err != nil {
+		t.Fatalf("NewSlowQueryLog: %v", err)
+	}
+	srv := Server{
+		Searcher:    searcherForTest(t, b),
+		Top:         Top,
+		HTML:        true,
+		SlowQueries: slowLog,
+	}
+	mux, err := NewMux(&srv)
+	if err != nil {
+		t.Fatalf("NewMux: %v", err)
+	}
+	ts := httptest.NewServer(mux)
+	defer ts.Close()
+
+	for i := 0; i < 3; i++ {
+		checkNeedles(t, ts, fmt.Sprintf("/search?q=water+%d&num=20", i), nil)
+	}
+	slowLog.Close()
+
+	files, err := filepath.Glob(filepath.Join(dir, "*"))
+	if err != nil {
+		t.Fatal(err)
+	}
+	if len(files) != 2 {
+		t.Fatalf("got files %v, want 2", files)
+	}
+
+	f, err := os.Open(files[1])
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer f.Close()
+	entries, err := ReadSlowQueries(f)
+	if err != nil {
+		t.Fatalf("ReadSlowQueries: %v", err)
+	}
+	if len(entries) != 1 {
+		t.Fatalf("got %d entries, want 1", len(entries))
+	}
+
+	e := entries[0]
+	if e.Query != "water 2" {
+		t.Errorf("got query %q, want %q", e.Query, "water 2")
+	}
+	if _, err := query.Parse(e.Query); err != nil {
+		t.Errorf("Parse(%q): %v", e.Query, err)
+	}
+	if opts := e.SearchOptions(); opts.MaxDocDisplayCount != 20 || opts.LimitPolicy == nil {
+		t.Errorf("got options %v, want 20 results with adaptive limits", opts)
+	}
+}
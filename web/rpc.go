@@ -0,0 +1,323 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package web
+
+import (
+	"bytes"
+	"compress/gzip"
+	"encoding/gob"
+	"encoding/json"
+	"fmt"
+	"io"
+	"log"
+	"mime"
+	"net/http"
+	"strconv"
+	"strings"
+	"time"
+
+	"github.com/google/zoekt"
+	"github.com/google/zoekt/query"
+)
+
+// Content types understood by the /api/search endpoint. Gob is the
+// compact encoding; JSON is the default for both directions.
+const (
+	GobContentType  = "application/x-gob"
+	JSONContentType = "application/json"
+)
+
+// maxRequestBytes bounds the size of a POST body. Queries listing
+// many repositories are the largest requests.
+const maxRequestBytes = 16 << 20
+
+// The fields that SearchRequest.Fields may select.
+var selectableFields = map[string]bool{
+	"Score":             true,
+	"Debug":             true,
+	"FileName":          true,
+	"Repository":        true,
+	"Branches":          true,
+	"LineMatches":       true,
+	"Content":           true,
+	"Checksum":          true,
+	"Language":          true,
+	"SubRepositoryName": true,
+	"SubRepositoryPath": true,
+	"Version":           true,
+
+	// LineMatch.Line, and its Before and After context. Clients
+	// that have the content can do with the offsets alone.
+	"Line": true,
+}
+
+func (s *Server) serveAPISearch(w http.ResponseWriter, r *http.Request) {
+	if err := s.serveAPISearchErr(w, r); err != nil {
+		http.Error(w, err.Error(), http.StatusTeapot)
+	}
+}
+
+// decodeRequest decodes a POST body as given by its Content-Type.
+func decodeRequest(w http.ResponseWriter, r *http.Request, req interface{}) error {
+	if r.Method != http.MethodPost {
+		return fmt.Errorf("unsupported method %s", r.Method)
+	}
+
+	mediaType := ""
+	if ct := r.Header.Get("Content-Type"); ct != "" {
+		var err error
+		if mediaType, _, err = mime.ParseMediaType(ct); err != nil {
+			return fmt.Errorf("invalid content type %q: %v", ct, err)
+		}
+	}
+
+	body := http.MaxBytesReader(w, r.Body, maxRequestBytes)
+	switch mediaType {
+	case GobContentType:
+		return gob.NewDecoder(body).Decode(req)
+	case JSONContentType, "":
+		return json.NewDecoder(body).Decode(req)
+	default:
+		return fmt.Errorf("unsupported content type %q", mediaType)
+	}
+}
+
+// parseSearchRequest reads a SearchRequest from a POST body, or from
+// the q, num and fields URL parameters of a GET request.
+func parseSearchRequest(w http.ResponseWriter, r *http.Request) (*SearchRequest, error) {
+	req := &SearchRequest{}
+	if r.Method == http.MethodGet {
+		qvals := r.URL.Query()
+		req.Query = qvals.Get("q")
+		if numStr := qvals.Get("num"); numStr != "" {
+			num, err := strconv.Atoi(numStr)
+			if err != nil {
+				return nil, err
+			}
+			req.Num = num
+		}
+		if fields := qvals.Get("fields"); fields != "" {
+			req.Fields = strings.Split(fields, ",")
+		}
+		return req, nil
+	}
+
+	if err := decodeRequest(w, r, req); err != nil {
+		return nil, err
+	}
+	return req, nil
+}
+
+func (s *Server) serveAPISearchErr(w http.ResponseWriter, r *http.Request) error {
+	req, err := parseSearchRequest(w, r)
+	if err != nil {
+		return err
+	}
+	for _, f := range req.Fields {
+		if !selectableFields[f] {
+			return fmt.Errorf("unknown field %q", f)
+		}
+	}
+
+	queryStr, q := req.Query, req.Q
+	if q != nil {
+		queryStr = q.String()
+	} else if queryStr == "" {
+		return fmt.Errorf("no query found")
+	} else if q, err = query.Parse(queryStr); err != nil {
+		return err
+	}
+
+	sOpts := req.Opts
+	if sOpts.MaxWallTime == 0 {
+		sOpts.MaxWallTime = 10 * time.Second
+	}
+	if m := s.MaxMemoryBytes; m > 0 && (sOpts.MaxMemoryBytes <= 0 || sOpts.MaxMemoryBytes > m) {
+		// Requests may only lower the server's limit.
+		sOpts.MaxMemoryBytes = m
+	}
+	sOpts.SetDefaults()
+	if req.Num > 0 {
+		sOpts.MaxDocDisplayCount = req.Num
+		sOpts.LimitPolicy = adaptiveLimits
+	}
+
+	// The response is encoded straight from the index, so keep
+	// the shards pinned until it is written.
+	result, release, err := s.pinnedSearch(r.Context(), queryStr, q, &sOpts)
+	defer release()
+	if err != nil {
+		return err
+	}
+	if len(req.Fields) > 0 {
+		selectFields(result, req.Fields)
+	}
+
+	return writeAPIResponse(w, r, result)
+}
+
+func (s *Server) serveAPIList(w http.ResponseWriter, r *http.Request) {
+	if err := s.serveAPIListErr(w, r); err != nil {
+		http.Error(w, err.Error(), http.StatusTeapot)
+	}
+}
+
+func (s *Server) serveAPIListErr(w http.ResponseWriter, r *http.Request) error {
+	var req ListRequest
+	if err := decodeRequest(w, r, &req); err != nil {
+		return err
+	}
+
+	q := req.Q
+	if q == nil {
+		var err error
+		if q, err = query.Parse(req.Query); err != nil {
+			return err
+		}
+	}
+
+	rl, err := s.Searcher.List(r.Context(), q)
+	if err != nil {
+		return err
+	}
+	return writeAPIResponse(w, r, rl)
+}
+
+// selectFields clears all FileMatch and LineMatch data not named in
+// fields.
+func selectFields(res *zoekt.SearchResult, fields []string) {
+	keep := map[string]bool{}
+	for _, f := range fields {
+		keep[f] = true
+	}
+
+	for i := range res.Files {
+		f := &res.Files[i]
+		if !keep["Score"] {
+			f.Score = 0
+		}
+		if !keep["Debug"] {
+			f.Debug = ""
+		}
+		if !keep["FileName"] {
+			f.FileName = ""
+		}
+		if !keep["Repository"] {
+			f.Repository = ""
+		}
+		if !keep["Branches"] {
+			f.Branches = nil
+		}
+		if !keep["LineMatches"] {
+			f.LineMatches = nil
+		} else if !keep["Line"] {
+			for j := range f.LineMatches {
+				f.LineMatches[j].Line = nil
+				f.LineMatches[j].Before = nil
+				f.LineMatches[j].After = nil
+			}
+		}
+		if !keep["Content"] {
+			f.Content = nil
+		}
+		if !keep["Checksum"] {
+			f.Checksum = nil
+		}
+		if !keep["Language"] {
+			f.Language = ""
+		}
+		if !keep["SubRepositoryName"] {
+			f.SubRepositoryName = ""
+		}
+		if !keep["SubRepositoryPath"] {
+			f.SubRepositoryPath = ""
+		}
+		if !keep["Version"] {
+			f.Version = ""
+		}
+	}
+}
+
+// acceptQuality returns the quality that the header of the request
+// gives to value, e.g. 0.5 for "gzip" in "Accept-Encoding: br,
+// gzip;q=0.5". Values that are not listed have quality 0.
+func acceptQuality(r *http.Request, header, value string) float64 {
+	for _, line := range r.Header.Values(header) {
+		for _, elem := range strings.Split(line, ",") {
+			params := strings.Split(elem, ";")
+			if !strings.EqualFold(strings.TrimSpace(params[0]), value) {
+				continue
+			}
+			for _, p := range params[1:] {
+				k, v, _ := strings.Cut(p, "=")
+				if strings.TrimSpace(k) != "q" {
+					continue
+				}
+				q, err := strconv.ParseFloat(strings.TrimSpace(v), 64)
+				if err != nil {
+					return 0
+				}
+				return q
+			}
+			return 1
+		}
+	}
+	return 0
+}
+
+// writeAPIResponse encodes the result as gob if the client prefers it,
+// and as JSON otherwise, gzip compressed if the client allows. The
+// result is encoded before anything is written, so encoding errors
+// can still be reported.
+func writeAPIResponse(w http.ResponseWriter, r *http.Request, result interface{}) error {
+	useGob := acceptQuality(r, "Accept", GobContentType) > acceptQuality(r, "Accept", JSONContentType)
+	useGzip := acceptQuality(r, "Accept-Encoding", "gzip") > 0
+
+	var buf bytes.Buffer
+	var out io.Writer = &buf
+	var zw *gzip.Writer
+	if useGzip {
+		zw = gzip.NewWriter(&buf)
+		out = zw
+	}
+	var err error
+	if useGob {
+		err = gob.NewEncoder(out).Encode(result)
+	} else {
+		err = json.NewEncoder(out).Encode(result)
+	}
+	if err == nil && zw != nil {
+		err = zw.Close()
+	}
+	if err != nil {
+		return err
+	}
+
+	if useGob {
+		w.Header().Set("Content-Type", GobContentType)
+	} else {
+		w.Header().Set("Content-Type", JSONContentType)
+	}
+	if useGzip {
+		w.Header().Set("Content-Encoding", "gzip")
+	}
+	w.Header().Set("Content-Length", strconv.Itoa(buf.Len()))
+	if _, err := buf.WriteTo(w); err != nil {
+		// The response has started, so there is no reporting
+		// this to the client.
+		log.Printf("writing API response: %v", err)
+	}
+	return nil
+}
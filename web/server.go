@@ -80,9 +80,19 @@ type Server struct {
 	// Serve HTML interface
 	HTML bool
 
+	// Serve the machine-oriented search API under /api/search.
+	RPC bool
+
+	// If set, record slow searches here.
+	SlowQueries *SlowQueryLog
+
 	// If set, show files from the index.
 	Print bool
 
+	// If set, searches stop once their results take about this
+	// many bytes. API requests may set a lower limit.
+	MaxMemoryBytes int64
+
 	// Version string for this server.
 	Version string
 
@@ -113,6 +123,11 @@ type Server struct {
 	templateMu    sync.Mutex
 	templateCache map[string]*template.Template
 
+	// repo => builder for FileURLTemplate and
+	// LineFragmentTemplate, resp. Protected by templateMu.
+	fileURLBuilders  map[string]*urlBuilder
+	fragmentBuilders map[string]*urlBuilder
+
 	lastStatsMu sync.Mutex
 	lastStats   *zoekt.RepoStats
 	lastStatsTS time.Time
@@ -157,6 +172,8 @@ func NewMux(s *Server) (*http.ServeMux, error) {
 	}
 
 	s.templateCache = map[string]*template.Template{}
+	s.fileURLBuilders = map[string]*urlBuilder{}
+	s.fragmentBuilders = map[string]*urlBuilder{}
 	s.startTime = time.Now()
 
 	mux := http.NewServeMux()
@@ -168,6 +185,10 @@ func NewMux(s *Server) (*http.ServeMux, error) {
 		mux.HandleFunc("/about", s.serveAbout)
 		mux.HandleFunc("/print", s.servePrint)
 	}
+	if s.RPC {
+		mux.HandleFunc("/api/search", s.serveAPISearch)
+		mux.HandleFunc("/api/list", s.serveAPIList)
+	}
 
 	return mux, nil
 }
@@ -219,44 +240,24 @@ func (s *Server) serveSearchErr(w http.ResponseWriter, r *http.Request) error {
 	}
 
 	sOpts := zoekt.SearchOptions{
-		MaxWallTime: 10 * time.Second,
+		MaxWallTime:    10 * time.Second,
+		MaxMemoryBytes: s.MaxMemoryBytes,
 	}
 
 	sOpts.SetDefaults()
 
-	ctx := r.Context()
-	if result, err := s.Searcher.Search(ctx, q, &zoekt.SearchOptions{EstimateDocCount: true}); err != nil {
-		return err
-	} else if numdocs := result.ShardFilesConsidered; numdocs > 10000 {
-		// If the search touches many shards and many files, we
-		// have to limit the number of matches.  This setting
-		// is based on the number of documents eligible after
-		// considering reponames, so large repos (both
-		// android, chromium are about 500k files) aren't
-		// covered fairly.
-
-		// 10k docs, 50 num -> max match = (250 + 250 / 10)
-		sOpts.ShardMaxMatchCount = num*5 + (5*num)/(numdocs/1000)
-
-		// 10k docs, 50 num -> max important match = 4
-		sOpts.ShardMaxImportantMatch = num/20 + num/(numdocs/500)
-	} else {
-		// Virtually no limits for a small corpus; important
-		// matches are just as expensive as normal matches.
-		n := numdocs + num*100
-		sOpts.ShardMaxImportantMatch = n
-		sOpts.ShardMaxMatchCount = n
-		sOpts.TotalMaxMatchCount = n
-		sOpts.TotalMaxImportantMatch = n
-	}
 	sOpts.MaxDocDisplayCount = num
+	sOpts.LimitPolicy = adaptiveLimits
 
-	result, err := s.Searcher.Search(ctx, q, &sOpts)
+	ctx := r.Context()
+	result, release, err := s.pinnedSearch(ctx, queryStr, q, &sOpts)
+	defer release()
 	if err != nil {
 		return err
 	}
 
 	fileMatches, err := s.formatResults(result, queryStr, s.Print)
+	release()
 	if err != nil {
 		return err
 	}
@@ -287,6 +288,85 @@ func (s *Server) serveSearchErr(w http.ResponseWriter, r *http.Request) error {
 	return nil
 }
 
+// pinnedSearch runs q, parsed from queryStr, without copying the
+// matched content out of the index if the searcher supports that. The
+// result may only be used until release is called; calling release
+// more than once is harmless. Searches with an empty queryStr are not
+// recorded in the slow query log, as they cannot be replayed.
+func (s *Server) pinnedSearch(ctx context.Context, queryStr string, q query.Q, opts *zoekt.SearchOptions) (result *zoekt.SearchResult, release func(), err error) {
+	searchOpts := opts
+	slowLog := s.SlowQueries
+	if queryStr == "" {
+		slowLog = nil
+	}
+	if slowLog != nil {
+		copyOpts := *opts
+		copyOpts.ExplainSlowerThan = slowLog.Threshold
+		searchOpts = &copyOpts
+	}
+
+	start := time.Now()
+	if ps, ok := s.Searcher.(zoekt.PinningSearcher); ok {
+		result, release, err = ps.SearchPinned(ctx, q, searchOpts)
+	} else {
+		result, err = s.Searcher.Search(ctx, q, searchOpts)
+		release = func() {}
+	}
+
+	if slowLog != nil && err == nil {
+		if d := time.Since(start); d >= slowLog.Threshold {
+			s.logSlowQuery(queryStr, q, opts, d, result)
+		}
+	}
+	return result, release, err
+}
+
+func (s *Server) logSlowQuery(queryStr string, q query.Q, opts *zoekt.SearchOptions, d time.Duration, result *zoekt.SearchResult) {
+	entry := SlowQuery{
+		Time:           time.Now(),
+		Query:          queryStr,
+		Parsed:         q.String(),
+		Options:        *opts,
+		AdaptiveLimits: opts.LimitPolicy != nil,
+		Duration:       d,
+		Stats:          result.Stats,
+		Shards:         result.SlowestShards,
+	}
+	entry.Options.LimitPolicy = nil
+	if err := s.SlowQueries.Record(&entry); err != nil {
+		log.Printf("slow query log: %v", err)
+	}
+}
+
+// adaptiveLimits sets the match limits for a search that should
+// display opts.MaxDocDisplayCount results out of numdocs eligible
+// documents.
+func adaptiveLimits(numdocs int, opts *zoekt.SearchOptions) {
+	num := opts.MaxDocDisplayCount
+	if numdocs > 10000 {
+		// If the search touches many shards and many files, we
+		// have to limit the number of matches.  This setting
+		// is based on the number of documents eligible after
+		// considering reponames, so large repos (both
+		// android, chromium are about 500k files) aren't
+		// covered fairly.
+
+		// 10k docs, 50 num -> max match = (250 + 250 / 10)
+		opts.ShardMaxMatchCount = num*5 + (5*num)/(numdocs/1000)
+
+		// 10k docs, 50 num -> max important match = 4
+		opts.ShardMaxImportantMatch = num/20 + num/(numdocs/500)
+	} else {
+		// Virtually no limits for a small corpus; important
+		// matches are just as expensive as normal matches.
+		n := numdocs + num*100
+		opts.ShardMaxImportantMatch = n
+		opts.ShardMaxMatchCount = n
+		opts.TotalMaxMatchCount = n
+		opts.TotalMaxImportantMatch = n
+	}
+}
+
 func (s *Server) servePrint(w http.ResponseWriter, r *http.Request) {
 	err := s.servePrintErr(w, r)
 	if err != nil {
@@ -540,7 +620,8 @@ func (s *Server) servePrintErr(w http.ResponseWriter, r *http.Request) error {
 	}
 
 	ctx := r.Context()
-	result, err := s.Searcher.Search(ctx, q, &sOpts)
+	result, release, err := s.pinnedSearch(ctx, "", q, &sOpts)
+	defer release()
 	if err != nil {
 		return err
 	}
@@ -0,0 +1,171 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package web
+
+import (
+	"encoding/json"
+	"fmt"
+	"io"
+	"os"
+	"path/filepath"
+	"sort"
+	"sync"
+	"time"
+
+	"github.com/google/zoekt"
+)
+
+// SlowQuery is an entry of the slow query log.
+type SlowQuery struct {
+	Time time.Time
+
+	// Query is the query as the user typed it, so it can be
+	// parsed again for replay. Parsed is its parsed form.
+	Query  string
+	Parsed string
+
+	// Options are the search options before the adaptive
+	// limits were applied. AdaptiveLimits records whether they
+	// were.
+	Options        zoekt.SearchOptions
+	AdaptiveLimits bool
+
+	Duration time.Duration
+	Stats    zoekt.Stats
+
+	// Shards holds the timing and match trees of the slowest
+	// shards.
+	Shards []zoekt.ShardTiming
+}
+
+// SearchOptions returns the options to replay the query with.
+func (q *SlowQuery) SearchOptions() *zoekt.SearchOptions {
+	opts := q.Options
+	if q.AdaptiveLimits {
+		opts.LimitPolicy = adaptiveLimits
+	}
+	return &opts
+}
+
+// ReadSlowQueries reads the entries of a slow query log file.
+func ReadSlowQueries(r io.Reader) ([]*SlowQuery, error) {
+	dec := json.NewDecoder(r)
+	var res []*SlowQuery
+	for {
+		var q SlowQuery
+		if err := dec.Decode(&q); err == io.EOF {
+			return res, nil
+		} else if err != nil {
+			return res, err
+		}
+		res = append(res, &q)
+	}
+}
+
+const slowLogTimeFormat = "20060102T150405.000000000"
+
+// SlowQueryLog records searches that take at least Threshold as JSON
+// lines. It writes to files in a directory, starting a new file once
+// the current one reaches a size limit, and removing the oldest files
+// beyond a limit.
+type SlowQueryLog struct {
+	Threshold time.Duration
+
+	dir      string
+	maxBytes int64
+	maxFiles int
+
+	mu   sync.Mutex
+	f    *os.File
+	size int64
+}
+
+// NewSlowQueryLog returns a log writing to dir, which must exist. Files
+// are rotated after maxBytes, and at most maxFiles are kept.
+func NewSlowQueryLog(dir string, threshold time.Duration, maxBytes int64, maxFiles int) (*SlowQueryLog, error) {
+	if fi, err := os.Stat(dir); err != nil {
+		return nil, err
+	} else if !fi.IsDir() {
+		return nil, fmt.Errorf("%s is not a directory", dir)
+	}
+	if maxFiles < 1 {
+		maxFiles = 1
+	}
+	return &SlowQueryLog{
+		Threshold: threshold,
+		dir:       dir,
+		maxBytes:  maxBytes,
+		maxFiles:  maxFiles,
+	}, nil
+}
+
+// Record appends q to the log.
+func (l *SlowQueryLog) Record(q *SlowQuery) error {
+	data, err := json.Marshal(q)
+	if err != nil {
+		return err
+	}
+	data = append(data, '\n')
+
+	l.mu.Lock()
+	defer l.mu.Unlock()
+	if l.f == nil || (l.maxBytes > 0 && l.size+int64(len(data)) > l.maxBytes) {
+		if err := l.rotate(); err != nil {
+			return err
+		}
+	}
+
+	n, err := l.f.Write(data)
+	l.size += int64(n)
+	return err
+}
+
+func (l *SlowQueryLog) rotate() error {
+	if l.f != nil {
+		l.f.Close()
+		l.f = nil
+	}
+
+	nm := filepath.Join(l.dir, fmt.Sprintf("slow-queries.%s.%d.jsonl", time.Now().UTC().Format(slowLogTimeFormat), os.Getpid()))
+	f, err := os.Create(nm)
+	if err != nil {
+		return err
+	}
+	l.f = f
+	l.size = 0
+
+	old, err := filepath.Glob(filepath.Join(l.dir, "slow-queries.*.jsonl"))
+	if err != nil {
+		return err
+	}
+	sort.Strings(old)
+	for len(old) > l.maxFiles {
+		os.Remove(old[0])
+		old = old[1:]
+	}
+	return nil
+}
+
+// Close closes the current log file.
+func (l *SlowQueryLog) Close() error {
+	l.mu.Lock()
+	defer l.mu.Unlock()
+	if l.f == nil {
+		return nil
+	}
+	err := l.f.Close()
+	l.f = nil
+	return err
+}
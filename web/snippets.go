@@ -15,9 +15,6 @@
 package web
 
 import (
-	"bytes"
-	"html/template"
-	"log"
 	"net/url"
 	"strconv"
 	"strings"
@@ -28,39 +25,34 @@ import (
 func (s *Server) formatResults(result *zoekt.SearchResult, query string, localPrint bool) ([]*FileMatch, error) {
 	var fmatches []*FileMatch
 
-	templateMap := map[string]*template.Template{}
-	fragmentMap := map[string]*template.Template{}
+	urlMap := map[string]*urlBuilder{}
+	fragmentMap := map[string]*urlBuilder{}
 	if !localPrint {
 		for repo, str := range result.RepoURLs {
 			if str != "" {
-				templateMap[repo] = s.getTemplate(str)
+				urlMap[repo] = s.getURLBuilder(s.fileURLBuilders, repo, str)
 			}
 		}
 		for repo, str := range result.LineFragments {
 			if str != "" {
-				fragmentMap[repo] = s.getTemplate(str)
+				fragmentMap[repo] = s.getURLBuilder(s.fragmentBuilders, repo, str)
 			}
 		}
 	}
 	getFragment := func(repo string, linenum int) string {
-		tpl := fragmentMap[repo]
+		b := fragmentMap[repo]
 
-		if tpl == nil || localPrint {
+		if b == nil || localPrint {
 			return "#l" + strconv.Itoa(linenum)
 		}
 
-		var buf bytes.Buffer
-		if err := tpl.Execute(&buf, map[string]string{
-			"LineNumber": strconv.Itoa(linenum),
-		}); err != nil {
-			log.Printf("fragment template: %v", err)
-			return ""
-		}
-		return buf.String()
+		return b.expand(&urlFields{
+			LineNumber: strconv.Itoa(linenum),
+		})
 	}
 	getURL := func(repo, filename string, branches []string, version string) string {
-		tpl := templateMap[repo]
-		if localPrint || tpl == nil {
+		b := urlMap[repo]
+		if localPrint || b == nil {
 			v := make(url.Values)
 			v.Add("r", repo)
 			v.Add("f", filename)
@@ -71,21 +63,14 @@ func (s *Server) formatResults(result *zoekt.SearchResult, query string, localPr
 			return "print?" + v.Encode()
 		}
 
-		var buf bytes.Buffer
-		b := ""
-		if len(branches) > 0 {
-			b = branches[0]
+		f := urlFields{
+			Version: version,
+			Path:    filename,
 		}
-		err := tpl.Execute(&buf, map[string]string{
-			"Branch":  b,
-			"Version": version,
-			"Path":    filename,
-		})
-		if err != nil {
-			log.Printf("url template: %v", err)
-			return ""
+		if len(branches) > 0 {
+			f.Branch = branches[0]
 		}
-		return buf.String()
+		return b.expand(&f)
 	}
 
 	// hash => result-id
@@ -180,6 +180,9 @@ document.onkeydown=function(e){
           <dt><a href="search?q=-%28Path File%29 Stream">-(Path File) Stream</a></dt><dd>search "Stream", but exclude files containing both "Path" and "File"</dd>
           <dt><a href="search?q=-Path%5c+file+Stream">-Path\ file Stream</a></dt><dd>search "Stream", but exclude files containing "Path File"</dd>
           <dt><a href="search?q=sym:data">sym:data</a></span></dt><dd>search for symbol definitions containing "data"</dd>
+          <dt><a href="search?q=sym:%5ENew">sym:^New</a></dt><dd>search for symbol definitions starting with "New"</dd>
+          <dt><a href="search?q=sym:data+kind:func">sym:data kind:func</a></dt><dd>search for function definitions containing "data"</dd>
+          <dt><a href="search?q=open+near:20+close">open near:20 close</a></dt><dd>search for "open" at most 20 characters from "close"; near:2l allows 2 lines</dd>
           <dt><a href="search?q=phone+r:droid">phone r:droid</a></dt><dd>search for "phone" in repositories whose name contains "droid"</dd>
           <dt><a href="search?q=phone+b:master">phone b:master</a></dt><dd>for Git repos, find "phone" in files in branches whose name contains "master".</dd>
           <dt><a href="search?q=phone+b:HEAD">phone b:HEAD</a></dt><dd>for Git repos, find "phone" in the default ('HEAD') branch.</dd>
@@ -223,6 +226,9 @@ document.onkeydown=function(e){
   <div class="container-fluid container-results">
     <h5>
       {{if .Stats.Crashes}}<br><b>{{.Stats.Crashes}} shards crashed</b><br>{{end}}
+      {{if .Stats.ShardsPending}}<br><b>{{.Stats.ShardsPending}} shards are still loading; results are incomplete</b><br>{{end}}
+      {{if .Stats.Truncated}}<br><b>The search ran out of time; results are incomplete</b><br>{{end}}
+      {{if .Stats.MemoryBudgetExceeded}}<br><b>The search ran out of memory; results are incomplete</b><br>{{end}}
       {{ $fileCount := len .FileMatches }}
       Found {{.Stats.MatchCount}} results in {{.Stats.FileCount}} files{{if or (lt $fileCount .Stats.FileCount) (or (gt .Stats.ShardsSkipped 0) (gt .Stats.FilesSkipped 0)) }},
         showing top {{ $fileCount }} files (<a rel="nofollow"
@@ -0,0 +1,192 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package web
+
+import (
+	"bytes"
+	"html/template"
+	"log"
+	"strings"
+)
+
+// urlFields holds the values available to FileURLTemplate and
+// LineFragmentTemplate.
+type urlFields struct {
+	Branch     string
+	Version    string
+	Path       string
+	LineNumber string
+}
+
+func (f *urlFields) get(name string) string {
+	switch name {
+	case "Branch":
+		return f.Branch
+	case "Version":
+		return f.Version
+	case "Path":
+		return f.Path
+	case "LineNumber":
+		return f.LineNumber
+	}
+	return ""
+}
+
+// urlPart is a literal string or, if field is set, the value of a
+// field.
+type urlPart struct {
+	literal string
+	field   string
+}
+
+// urlBuilder expands a URL or line fragment template. Templates that
+// only interpolate fields into plain text, like
+// "https://host/{{.Path}}#L{{.LineNumber}}", are expanded by
+// concatenation. Everything else is executed as html/template.
+type urlBuilder struct {
+	src string
+
+	// nil if we must execute tpl.
+	parts []urlPart
+	tpl   *template.Template
+}
+
+// htmlEscaper mirrors the escaping that html/template applies to
+// values substituted in text context.
+var htmlEscaper = strings.NewReplacer(
+	"\x00", "�",
+	`"`, "&#34;",
+	"&", "&amp;",
+	"'", "&#39;",
+	"+", "&#43;",
+	"<", "&lt;",
+	">", "&gt;",
+)
+
+func newURLBuilder(src string) *urlBuilder {
+	b := &urlBuilder{src: src}
+	if parts, ok := compileURLTemplate(src); ok {
+		b.parts = parts
+		return b
+	}
+
+	t, err := template.New("cache").Parse(src)
+	if err != nil {
+		log.Printf("template parse error: %v", err)
+		t = template.Must(template.New("empty").Parse(""))
+	}
+	b.tpl = t
+	return b
+}
+
+// compileURLTemplate splits src into literals and {{.Field}} actions.
+// It fails for any other action, and for literals that would move
+// html/template out of the text context.
+func compileURLTemplate(src string) ([]urlPart, bool) {
+	parts := []urlPart{}
+	for len(src) > 0 {
+		start := strings.Index(src, "{{")
+		if start == -1 {
+			start = len(src)
+		}
+		if lit := src[:start]; lit != "" {
+			if strings.Contains(lit, "<") || strings.Contains(lit, "}}") {
+				return nil, false
+			}
+			parts = append(parts, urlPart{literal: lit})
+		}
+		src = src[start:]
+		if src == "" {
+			break
+		}
+
+		end := strings.Index(src, "}}")
+		if end == -1 {
+			return nil, false
+		}
+		action := strings.TrimSpace(src[2:end])
+		src = src[end+2:]
+
+		if len(action) < 2 || action[0] != '.' {
+			return nil, false
+		}
+		for _, c := range action[1:] {
+			if !(c >= 'a' && c <= 'z' || c >= 'A' && c <= 'Z' || c >= '0' && c <= '9' || c == '_') {
+				return nil, false
+			}
+		}
+		parts = append(parts, urlPart{field: action[1:]})
+	}
+	return parts, true
+}
+
+// expand returns the template output for the given fields.
+func (b *urlBuilder) expand(f *urlFields) string {
+	if b.parts == nil {
+		var buf bytes.Buffer
+		if err := b.tpl.Execute(&buf, map[string]string{
+			"Branch":     f.Branch,
+			"Version":    f.Version,
+			"Path":       f.Path,
+			"LineNumber": f.LineNumber,
+		}); err != nil {
+			log.Printf("url template: %v", err)
+			return ""
+		}
+		return buf.String()
+	}
+
+	if len(b.parts) == 1 && b.parts[0].field == "" {
+		return b.parts[0].literal
+	}
+
+	var sb strings.Builder
+	sz := 0
+	for _, p := range b.parts {
+		if p.field == "" {
+			sz += len(p.literal)
+		} else {
+			sz += len(f.get(p.field))
+		}
+	}
+	sb.Grow(sz)
+	for _, p := range b.parts {
+		if p.field == "" {
+			sb.WriteString(p.literal)
+			continue
+		}
+		v := f.get(p.field)
+		if strings.ContainsAny(v, "\x00\"&'+<>") {
+			htmlEscaper.WriteString(&sb, v)
+		} else {
+			sb.WriteString(v)
+		}
+	}
+	return sb.String()
+}
+
+// getURLBuilder returns the builder for a template of the given
+// repository. Builders are kept across requests, and replaced when the
+// repository's template changes.
+func (s *Server) getURLBuilder(cache map[string]*urlBuilder, repo, src string) *urlBuilder {
+	s.templateMu.Lock()
+	defer s.templateMu.Unlock()
+	if b := cache[repo]; b != nil && b.src == src {
+		return b
+	}
+	b := newURLBuilder(src)
+	cache[repo] = b
+	return b
+}
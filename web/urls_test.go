@@ -0,0 +1,63 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package web
+
+import (
+	"bytes"
+	"html/template"
+	"testing"
+)
+
+func TestURLBuilder(t *testing.T) {
+	fields := urlFields{
+		Branch:     "master",
+		Version:    "1234",
+		Path:       "dir/a&b'c\"d+e<f>g\x00h.go",
+		LineNumber: "42",
+	}
+	for _, c := range []struct {
+		src      string
+		compiled bool
+	}{
+		{"", true},
+		{"file-url", true},
+		{"https://host/{{.Version}}/{{ .Path }}", true},
+		{"#L{{.LineNumber}}", true},
+		{"{{.Branch}}{{.Missing}}/x", true},
+		{"<a>{{.Path}}", false},
+		{"{{.Path | urlquery}}", false},
+		{"{{if .Branch}}b{{end}}", false},
+	} {
+		b := newURLBuilder(c.src)
+		if got := b.parts != nil; got != c.compiled {
+			t.Errorf("%q: got compiled %v, want %v", c.src, got, c.compiled)
+		}
+
+		tpl := template.Must(template.New("cache").Parse(c.src))
+		var buf bytes.Buffer
+		if err := tpl.Execute(&buf, map[string]string{
+			"Branch":     fields.Branch,
+			"Version":    fields.Version,
+			"Path":       fields.Path,
+			"LineNumber": fields.LineNumber,
+		}); err != nil {
+			t.Fatalf("Execute(%q): %v", c.src, err)
+		}
+
+		if got, want := b.expand(&fields), buf.String(); got != want {
+			t.Errorf("%q: got %q, want %q", c.src, got, want)
+		}
+	}
+}
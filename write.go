@@ -116,10 +116,61 @@ func (b *IndexBuilder) Write(out io.Writer) error {
 	w.Write(b.languages)
 	toc.languages.end(w)
 
+	toc.asciiFlags.start(w)
+	w.Write(b.asciiFlags)
+	toc.asciiFlags.end(w)
+
 	toc.runeDocSections.start(w)
 	w.Write(marshalDocSections(b.runeDocSections))
 	toc.runeDocSections.end(w)
 
+	keys := make(ngramSlice, 0, len(b.symbols.postings))
+	for k := range b.symbols.postings {
+		keys = append(keys, k)
+	}
+	sort.Sort(keys)
+	toc.symbolNgramText.start(w)
+	for _, k := range keys {
+		w.U64(uint64(k))
+	}
+	toc.symbolNgramText.end(w)
+	toc.symbolPostings.start(w)
+	for _, k := range keys {
+		toc.symbolPostings.addItem(w, b.symbols.postings[k])
+	}
+	toc.symbolPostings.end(w)
+
+	names := b.symbols.sortedNames()
+	toc.symbolNames.start(w)
+	for _, n := range names {
+		toc.symbolNames.addItem(w, []byte(n))
+	}
+	toc.symbolNames.end(w)
+	toc.symbolNameIDs.start(w)
+	for _, n := range names {
+		toc.symbolNameIDs.addItem(w, b.symbols.names[n])
+	}
+	toc.symbolNameIDs.end(w)
+
+	toc.symbolKinds.start(w)
+	for _, k := range b.symbols.kinds {
+		toc.symbolKinds.addItem(w, []byte(k))
+	}
+	toc.symbolKinds.end(w)
+	toc.symbolScopes.start(w)
+	for _, s := range b.symbols.scopes {
+		toc.symbolScopes.addItem(w, []byte(s))
+	}
+	toc.symbolScopes.end(w)
+	toc.symbolMeta.start(w)
+	w.Write(b.symbols.meta)
+	toc.symbolMeta.end(w)
+	toc.symbolKindPostings.start(w)
+	for _, p := range b.symbols.kindPostings {
+		toc.symbolKindPostings.addItem(w, p)
+	}
+	toc.symbolKindPostings.end(w)
+
 	if err := b.writeJSON(&IndexMetadata{
 		IndexFormatVersion:  IndexFormatVersion,
 		IndexTime:           time.Now(),